@@ -0,0 +1,293 @@
+#pragma once
+#include "RedBlackTree.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#ifndef NENIY_CONCURRENTREDBLACKTREE
+#define NENIY_CONCURRENTREDBLACKTREE
+
+// Read-mostly concurrent RedBlackTree on the Left-Right technique: two copies of the tree,
+// readers always use the one no writer touches and never block or retry. Writers are
+// serialized; a change goes to the hidden copy, the copies are swapped, and once readers
+// have left the old copy the change is repeated on it. Takes twice the memory of one tree.
+// A reader writes only to a slot of its own thread, see ReadSlot; the first read of a
+// thread registers it with the tree.
+template <typename ValueType, typename Compare = std::less<ValueType>, typename Alloc = std::allocator<ValueType>,
+          typename Policy = DefaultTreePolicy>
+class ConcurrentRedBlackTree {
+ public:
+  using Tree = RedBlackTree<ValueType, Compare, Alloc, Policy>;
+
+  ConcurrentRedBlackTree() = default;
+
+  explicit ConcurrentRedBlackTree(Tree tree) : trees{tree, std::move(tree)} {}
+
+  ConcurrentRedBlackTree(const ConcurrentRedBlackTree&) = delete;
+
+  ConcurrentRedBlackTree& operator=(const ConcurrentRedBlackTree&) = delete;
+
+  // Runs fn(const Tree&) on a tree no writer changes meanwhile; references and iterators
+  // into it must not outlive the call
+  template <typename Function>
+  decltype(auto) read(Function fn) const {
+    ReadGuard guard(*this);
+    return fn(std::as_const(trees[guard.tree]));
+  }
+
+  // Lookups return copies, so nothing points into the tree after the read
+
+  std::size_t size() const {
+    return read([](const Tree& tree) { return tree.size(); });
+  }
+
+  template <typename K>
+  bool contains(const K& key) const {
+    return read([&](const Tree& tree) { return tree.find(key) != tree.end(); });
+  }
+
+  template <typename K>
+  std::optional<ValueType> find(const K& key) const {
+    return read([&](const Tree& tree) { return Copy(tree, tree.find(key)); });
+  }
+
+  template <typename K>
+  std::optional<ValueType> find_greater_than(const K& key) const {
+    return read([&](const Tree& tree) { return Copy(tree, tree.find_greater_than(key)); });
+  }
+
+  template <typename K>
+  std::optional<ValueType> find_less_than(const K& key) const {
+    return read([&](const Tree& tree) { return Copy(tree, tree.find_less_than(key)); });
+  }
+
+  std::optional<ValueType> statistic(std::size_t stat_num) const {
+    return read([&](const Tree& tree) { return Copy(tree, tree.statistic(stat_num)); });
+  }
+
+  template <typename K>
+  std::size_t rank(const K& key) const {
+    return read([&](const Tree& tree) { return tree.rank(key); });
+  }
+
+  // Writers
+
+  template <typename V>
+  bool insert(V&& value) {
+    return Write([&](Tree& tree, bool last_copy) {
+      return last_copy ? tree.insert(std::forward<V>(value)).second : tree.insert(std::as_const(value)).second;
+    });
+  }
+
+  template <typename K>
+  std::size_t erase(const K& key) {
+    return Write([&](Tree& tree, bool) { return tree.erase(key); });
+  }
+
+  void clear() {
+    Write([](Tree& tree, bool) { tree.clear(); });
+  }
+
+  // Applies fn(Tree&) to both copies in turn, so it must make the same change every time;
+  // returns the result of the first call
+  template <typename Function>
+  decltype(auto) modify(Function fn) {
+    return Write([&](Tree& tree, bool) { return fn(tree); });
+  }
+
+ private:
+  static constexpr std::size_t kCacheLine = 64;
+
+  // Each thread reading the tree announces itself in a slot of its own, which no other
+  // thread writes; readers[v] counts its reads begun under version v. A slot stays with the
+  // tree until the tree is destroyed, and a thread that exits hands it to the next newcomer.
+  struct alignas(kCacheLine) ReadSlot {
+    std::atomic<std::int64_t> readers[2]{};
+    std::atomic<bool> taken{true};
+    ReadSlot* next = nullptr;
+  };
+
+  // Shared with the threads' lists of slots, so an exiting thread can return its slot
+  // even when it outlives the tree
+  struct ReadSlots {
+    ReadSlots() = default;
+
+    ReadSlots(const ReadSlots&) = delete;
+
+    ReadSlots& operator=(const ReadSlots&) = delete;
+
+    ~ReadSlots() {
+      for (ReadSlot* slot = head.load(); slot != nullptr;) {
+        delete std::exchange(slot, slot->next);
+      }
+    }
+
+    std::atomic<ReadSlot*> head{nullptr};
+  };
+
+  // The slots a thread holds, by tree id, with the last one looked up in front
+  struct ThreadSlots {
+    struct Held {
+      std::uint64_t tree;
+      std::weak_ptr<ReadSlots> slots;
+      ReadSlot* slot;
+    };
+
+    ThreadSlots() = default;
+
+    ThreadSlots(const ThreadSlots&) = delete;
+
+    ThreadSlots& operator=(const ThreadSlots&) = delete;
+
+    ~ThreadSlots() {
+      for (Held& held : holding) {
+        if (std::shared_ptr<ReadSlots> alive = held.slots.lock()) {
+          held.slot->taken.store(false);
+        }
+      }
+    }
+
+    std::uint64_t last_tree = 0;
+    ReadSlot* last_slot = nullptr;
+    std::vector<Held> holding;
+  };
+
+  struct ReadGuard {
+    explicit ReadGuard(const ConcurrentRedBlackTree& owner) : slot(owner.OwnSlot()), version(owner.version.load()) {
+      std::atomic<std::int64_t>& readers = slot.readers[version];
+      readers.store(readers.load(std::memory_order_relaxed) + 1);
+      tree = owner.readable.load();
+    }
+
+    ReadGuard(const ReadGuard&) = delete;
+
+    ReadGuard& operator=(const ReadGuard&) = delete;
+
+    ~ReadGuard() {
+      std::atomic<std::int64_t>& readers = slot.readers[version];
+      readers.store(readers.load(std::memory_order_relaxed) - 1, std::memory_order_release);
+    }
+
+    ReadSlot& slot;
+    int version;
+    int tree;
+  };
+
+  static std::uint64_t NextId() {
+    static std::atomic<std::uint64_t> last{0};
+    return last.fetch_add(1, std::memory_order_relaxed) + 1;
+  }
+
+  ReadSlot& OwnSlot() const {
+    static thread_local ThreadSlots thread_slots;
+    if (thread_slots.last_tree == id) {
+      return *thread_slots.last_slot;
+    }
+    auto held = std::find_if(thread_slots.holding.begin(), thread_slots.holding.end(),
+                             [&](const typename ThreadSlots::Held& held) { return held.tree == id; });
+    if (held == thread_slots.holding.end()) {
+      std::erase_if(thread_slots.holding, [](const typename ThreadSlots::Held& held) { return held.slots.expired(); });
+      thread_slots.holding.push_back({id, read_slots, TakeSlot()});
+      held = std::prev(thread_slots.holding.end());
+    }
+    thread_slots.last_tree = id;
+    thread_slots.last_slot = held->slot;
+    return *held->slot;
+  }
+
+  // Reuses a slot left by an exited thread or adds a new one. A reader on a slot the writer
+  // has not seen yet started after the writer looked, so it already sees the copy shown.
+  ReadSlot* TakeSlot() const {
+    for (ReadSlot* slot = read_slots->head.load(); slot != nullptr; slot = slot->next) {
+      bool taken = false;
+      if (!slot->taken.load(std::memory_order_relaxed) && slot->taken.compare_exchange_strong(taken, true)) {
+        return slot;
+      }
+    }
+    ReadSlot* slot = new ReadSlot;
+    slot->next = read_slots->head.load();
+    while (!read_slots->head.compare_exchange_weak(slot->next, slot)) {
+    }
+    return slot;
+  }
+
+  static std::optional<ValueType> Copy(const Tree& tree, typename Tree::const_iterator where) {
+    if (where == tree.end()) {
+      return std::nullopt;
+    }
+    return *where;
+  }
+
+  // fn(tree, last_copy) is called on the hidden copy, then on the other one
+  template <typename Function>
+  decltype(auto) Write(Function fn) {
+    std::lock_guard<std::mutex> lock(writer);
+    int shown = readable.load();
+    if constexpr (std::is_void_v<decltype(fn(trees[0], false))>) {
+      Prepare(shown, fn);
+      Publish(shown, fn);
+    } else {
+      auto result = Prepare(shown, fn);
+      Publish(shown, fn);
+      return result;
+    }
+  }
+
+  template <typename Function>
+  decltype(auto) Prepare(int shown, Function& fn) {
+    try {
+      return fn(trees[1 - shown], false);
+    } catch (...) { // undo a partial change, readers never saw it
+      trees[1 - shown] = trees[shown];
+      throw;
+    }
+  }
+
+  template <typename Function>
+  void Publish(int shown, Function& fn) {
+    readable.store(1 - shown);
+    WaitForReaders();
+    try {
+      fn(trees[shown], true);
+    } catch (...) { // keep the copies equal
+      trees[shown] = trees[1 - shown];
+      throw;
+    }
+  }
+
+  // Readers that might still see the old copy have arrived under the current version:
+  // new readers are sent to the other version's slots, then the current ones drain
+  void WaitForReaders() {
+    int previous = version.load();
+    WaitUntilEmpty(1 - previous);
+    version.store(1 - previous);
+    WaitUntilEmpty(previous);
+  }
+
+  void WaitUntilEmpty(int slots) const {
+    for (const ReadSlot* slot = read_slots->head.load(); slot != nullptr; slot = slot->next) {
+      while (slot->readers[slots].load() != 0) {
+        std::this_thread::yield();
+      }
+    }
+  }
+
+  Tree trees[2];
+  std::atomic<int> readable{0};
+  std::atomic<int> version{0};
+  std::shared_ptr<ReadSlots> read_slots = std::make_shared<ReadSlots>();
+  const std::uint64_t id = NextId();
+  std::mutex writer;
+};
+
+#endif // NENIY_CONCURRENTREDBLACKTREE
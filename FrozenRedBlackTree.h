@@ -0,0 +1,305 @@
+#pragma once
+#include "RedBlackTree.h"
+
+#include <bit>
+#include <compare>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <utility>
+
+#ifndef NENIY_FROZENREDBLACKTREE
+#define NENIY_FROZENREDBLACKTREE
+
+// Immutable sorted set for data that is rebuilt rarely and queried constantly. Values lie
+// in one array in Eytzinger (breadth-first) order: element k has children 2k and 2k + 1,
+// so the top levels share a few cache lines and a descent is a branchless loop that
+// prefetches the descendants several levels ahead. The array is a complete binary tree,
+// so the sorted position of an element follows from its index in O(1): statistic() and
+// rank() cost no extra memory, and iterators are random access positions in sorted order.
+template <typename ValueType, typename Compare = std::less<ValueType>>
+class FrozenRedBlackTree {
+ public:
+  class const_iterator {
+   public:
+    using value_type = ValueType;
+    using iterator_category = std::random_access_iterator_tag;
+    using pointer = const value_type*;
+    using reference = const value_type&;
+    using difference_type = std::ptrdiff_t;
+
+    const_iterator() = default;
+
+    bool operator==(const const_iterator& other) const { return position == other.position; }
+
+    std::strong_ordering operator<=>(const const_iterator& other) const { return position <=> other.position; }
+
+    const_iterator& operator++() {
+      ++position;
+      return *this;
+    }
+
+    const_iterator& operator--() {
+      --position;
+      return *this;
+    }
+
+    const_iterator operator++(int) {
+      const_iterator copy = *this;
+      ++*this;
+      return copy;
+    }
+
+    const_iterator operator--(int) {
+      const_iterator copy = *this;
+      --*this;
+      return copy;
+    }
+
+    const_iterator& operator+=(difference_type steps) {
+      position += steps;
+      return *this;
+    }
+
+    const_iterator& operator-=(difference_type steps) {
+      position -= steps;
+      return *this;
+    }
+
+    friend const_iterator operator+(const_iterator where, difference_type steps) { return where += steps; }
+
+    friend const_iterator operator+(difference_type steps, const_iterator where) { return where += steps; }
+
+    friend const_iterator operator-(const_iterator where, difference_type steps) { return where -= steps; }
+
+    friend difference_type operator-(const const_iterator& lhs, const const_iterator& rhs) {
+      return static_cast<difference_type>(lhs.position) - static_cast<difference_type>(rhs.position);
+    }
+
+    reference operator*() const { return tree->Value(tree->IndexOf(position)); }
+
+    pointer operator->() const { return &**this; }
+
+    reference operator[](difference_type steps) const { return *(*this + steps); }
+
+    friend class FrozenRedBlackTree;
+
+   private:
+    const_iterator(const FrozenRedBlackTree* tree, std::size_t position) : tree(tree), position(position) {}
+
+    const FrozenRedBlackTree* tree = nullptr;
+    std::size_t position = 0; // in sorted order, size() for end()
+  };
+
+  using iterator = const_iterator;
+  using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+  using reverse_iterator = const_reverse_iterator;
+
+  FrozenRedBlackTree() = default;
+
+  explicit FrozenRedBlackTree(const Compare& compare) : compare(compare) {}
+
+  // [first, last) must be strictly increasing by Compare; one copy of every element is made
+  template <std::forward_iterator ForwardIt>
+  FrozenRedBlackTree(ForwardIt first, ForwardIt last, const Compare& compare = Compare()) : compare(compare) {
+    Build(first, static_cast<std::size_t>(std::distance(first, last)));
+  }
+
+  FrozenRedBlackTree(const FrozenRedBlackTree& other) : compare(other.compare) {
+    Build(other.begin(), other.size());
+  }
+
+  FrozenRedBlackTree(FrozenRedBlackTree&& other) noexcept
+      : values(std::exchange(other.values, nullptr)), count(std::exchange(other.count, 0)),
+        levels(std::exchange(other.levels, 0)), compare(std::move(other.compare)) {}
+
+  FrozenRedBlackTree& operator=(FrozenRedBlackTree other) noexcept {
+    swap(other);
+    return *this;
+  }
+
+  ~FrozenRedBlackTree() { Destroy(); }
+
+  void swap(FrozenRedBlackTree& other) noexcept {
+    std::swap(values, other.values);
+    std::swap(count, other.count);
+    std::swap(levels, other.levels);
+    std::swap(compare, other.compare);
+  }
+
+  std::size_t size() const noexcept { return count; }
+
+  bool empty() const noexcept { return count == 0; }
+
+  const_iterator begin() const { return const_iterator(this, 0); }
+
+  const_iterator end() const { return const_iterator(this, count); }
+
+  const_iterator cbegin() const { return begin(); }
+
+  const_iterator cend() const { return end(); }
+
+  const_reverse_iterator rbegin() const { return const_reverse_iterator(end()); }
+
+  const_reverse_iterator rend() const { return const_reverse_iterator(begin()); }
+
+  // Keys other than ValueType are compared directly, so Compare must accept them
+
+  template <typename K>
+  const_iterator find(const K& key) const {
+    std::size_t index = LowerBoundIndex(key);
+    if (index == 0 || compare(key, Value(index))) {
+      return end();
+    }
+    return const_iterator(this, PositionOf(index));
+  }
+
+  template <typename K>
+  bool contains(const K& key) const { return find(key) != end(); }
+
+  template <typename K> // first element not less than key
+  const_iterator lower_bound(const K& key) const { return At(LowerBoundIndex(key)); }
+
+  template <typename K> // first element greater than key
+  const_iterator upper_bound(const K& key) const {
+    return At(Descend([&](const ValueType& value) { return !compare(key, value); }));
+  }
+
+  template <typename K>
+  const_iterator find_greater_than(const K& key) const { return upper_bound(key); }
+
+  template <typename K> // last element less than key
+  const_iterator find_less_than(const K& key) const {
+    const_iterator bound = lower_bound(key);
+    return bound == begin() ? end() : --bound;
+  }
+
+  const_iterator statistic(std::size_t stat_num) const {
+    return const_iterator(this, stat_num < count ? stat_num : count);
+  }
+
+  template <typename K> // count of elements less than key
+  std::size_t rank(const K& key) const { return lower_bound(key).position; }
+
+  std::size_t rank(const_iterator where) const { return where.position; }
+
+  // Bytes of the value array
+  std::size_t memory_bytes() const noexcept { return values == nullptr ? 0 : (count + 1) * sizeof(ValueType); }
+
+ private:
+  static constexpr std::size_t kCacheLine = 64;
+
+  // A descent prefetches the descendants of the current element log2(kPrefetchFanout) levels
+  // below: they are consecutive and fill one cache line when the values divide it
+  static constexpr std::size_t kPrefetchFanout =
+      sizeof(ValueType) < kCacheLine && kCacheLine % sizeof(ValueType) == 0 ? kCacheLine / sizeof(ValueType) : 0;
+
+  // The source is read once in order and every value is put at its index, so only the
+  // writes jump around
+  template <typename ForwardIt>
+  void Build(ForwardIt sorted, std::size_t size) {
+    if (size == 0) {
+      return;
+    }
+    // Index 0 is unused, so the descendants 2^j k ... 2^j k + 2^j - 1 start a cache line
+    ValueType* storage = static_cast<ValueType*>(
+        ::operator new((size + 1) * sizeof(ValueType), std::align_val_t{std::max(kCacheLine, alignof(ValueType))}));
+    count = size;
+    levels = std::bit_width(size);
+    std::size_t position = 0;
+    try {
+      for (; position < size; ++position, ++sorted) {
+        std::construct_at(storage + IndexOf(position), *sorted);
+      }
+    } catch (...) {
+      while (position > 0) {
+        std::destroy_at(storage + IndexOf(--position));
+      }
+      Deallocate(storage);
+      count = 0;
+      levels = 0;
+      throw;
+    }
+    values = storage;
+  }
+
+  void Destroy() noexcept {
+    if (values != nullptr) {
+      std::destroy(values + 1, values + count + 1);
+      Deallocate(values);
+    }
+  }
+
+  static void Deallocate(ValueType* storage) noexcept {
+    ::operator delete(storage, std::align_val_t{std::max(kCacheLine, alignof(ValueType))});
+  }
+
+  const ValueType& Value(std::size_t index) const { return values[index]; }
+
+  // Complete tree with levels levels, the last one holding the first last_level slots.
+  // In the perfect tree of the same height, the element at depth d and index k has
+  // position ((2k + 1) << (levels - 1 - d)) - 2^levels - 1; missing slots of the last level
+  // take the even positions from 2 * last_level on.
+  std::size_t PositionOf(std::size_t index) const {
+    std::size_t depth = std::bit_width(index) - 1;
+    std::size_t full = ((2 * index + 1) << (levels - 1 - depth)) - (std::size_t(1) << levels) - 1;
+    std::size_t last_level = count - ((std::size_t(1) << (levels - 1)) - 1);
+    std::size_t missing = (full + 1) / 2 > last_level ? (full + 1) / 2 - last_level : 0;
+    return full - missing;
+  }
+
+  std::size_t IndexOf(std::size_t position) const {
+    std::size_t last_level = count - ((std::size_t(1) << (levels - 1)) - 1);
+    std::size_t full = position < 2 * last_level ? position : 2 * position - 2 * last_level + 1;
+    std::size_t up = std::countr_zero(full + 1) + 1;
+    return ((std::size_t(1) << levels) + full + 1) >> up;
+  }
+
+  const_iterator At(std::size_t index) const { return const_iterator(this, index == 0 ? count : PositionOf(index)); }
+
+  // go_right(value) for every element on the path; the answer is the last element where the
+  // descent went left, 0 if none. The loop has no data-dependent branches besides its exit.
+  template <typename GoRight>
+  std::size_t Descend(GoRight go_right) const {
+    std::size_t index = 1;
+    while (index <= count) {
+      if constexpr (kPrefetchFanout > 1) {
+        Prefetch(index * kPrefetchFanout);
+      }
+      index = 2 * index + static_cast<std::size_t>(go_right(Value(index)));
+    }
+    // Undo the right turns after the last left one, then that left one
+    return index >> (std::countr_one(index) + 1);
+  }
+
+  template <typename K>
+  std::size_t LowerBoundIndex(const K& key) const {
+    return Descend([&](const ValueType& value) { return compare(value, key); });
+  }
+
+  void Prefetch(std::size_t index) const {
+#if defined(__GNUC__) || defined(__clang__)
+    // Past the end the address is only a hint and is never dereferenced
+    __builtin_prefetch(reinterpret_cast<const void*>(reinterpret_cast<std::uintptr_t>(values) +
+                                                     index * sizeof(ValueType)));
+#endif
+  }
+
+  ValueType* values = nullptr; // values[1 .. count] in Eytzinger order
+  std::size_t count = 0;
+  std::size_t levels = 0; // height of the complete tree, bit_width(count)
+  [[no_unique_address]] Compare compare;
+};
+
+// Immutable copy of a tree for read-only use, see FrozenRedBlackTree. The copy is a set,
+// so only trees rejecting equal elements can be frozen.
+template <typename ValueType, typename Compare, typename Alloc, typename Policy>
+  requires (Policy::duplicates == DuplicateKeys::kRejected)
+FrozenRedBlackTree<ValueType, Compare> freeze(const RedBlackTree<ValueType, Compare, Alloc, Policy>& tree) {
+  return FrozenRedBlackTree<ValueType, Compare>(tree.begin(), tree.end(), tree.key_comp());
+}
+
+#endif // NENIY_FROZENREDBLACKTREE
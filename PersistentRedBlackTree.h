@@ -0,0 +1,531 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#ifndef NENIY_PERSISTENTREDBLACKTREE
+#define NENIY_PERSISTENTREDBLACKTREE
+
+// Persistent ordered set with order statistics: nodes are immutable once published and
+// shared between versions through reference counts, so copying a tree (snapshot()) is
+// O(1). insert and erase copy the O(log n) nodes they touch (left-leaning red-black
+// balancing) and publish the new version only when it is complete, so an exception
+// leaves the tree unchanged. Different trees sharing nodes may be used from different
+// threads; a single tree object is not thread-safe. Copies of Alloc must be able to free
+// each other's nodes, from any thread that drops the last reference.
+template <typename ValueType, typename Compare = std::less<ValueType>, typename Alloc = std::allocator<ValueType>>
+class PersistentRedBlackTree {
+ private:
+  struct Node {
+    template <typename V>
+    explicit Node(V&& value) : value(std::forward<V>(value)) {}
+
+    std::atomic<std::size_t> refs{1};
+    Node* left = nullptr; // child links own a reference
+    Node* right = nullptr;
+    std::size_t subtree_size = 1;
+    bool is_red = true;
+    bool is_fresh = true; // created by the update in progress, may still be changed in place
+    ValueType value;
+  };
+
+  using NodeAlloc = typename std::allocator_traits<Alloc>::template rebind_alloc<Node>;
+  using NodeAllocTraits = std::allocator_traits<NodeAlloc>;
+
+ public:
+  // Iterators keep the path from the root, so they are larger than pointers and stay valid
+  // while the tree they came from is neither changed nor destroyed
+  class const_iterator {
+   public:
+    using value_type = ValueType;
+    using iterator_category = std::bidirectional_iterator_tag;
+    using pointer = const value_type*;
+    using reference = const value_type&;
+    using difference_type = std::ptrdiff_t;
+
+    const_iterator() = default;
+
+    bool operator==(const const_iterator& other) const {
+      return path.empty() ? other.path.empty() : !other.path.empty() && path.back() == other.path.back();
+    }
+
+    bool operator!=(const const_iterator& other) const { return !(*this == other); }
+
+    const_iterator& operator++() {
+      const Node* node = path.back();
+      if (node->right != nullptr) {
+        path.push_back(node->right);
+        DescendLeft();
+        return *this;
+      }
+      path.pop_back();
+      while (!path.empty() && path.back()->right == node) {
+        node = path.back();
+        path.pop_back();
+      }
+      return *this;
+    }
+
+    const_iterator& operator--() {
+      if (path.empty()) {
+        path.push_back(root);
+        DescendRight();
+        return *this;
+      }
+      const Node* node = path.back();
+      if (node->left != nullptr) {
+        path.push_back(node->left);
+        DescendRight();
+        return *this;
+      }
+      path.pop_back();
+      while (!path.empty() && path.back()->left == node) {
+        node = path.back();
+        path.pop_back();
+      }
+      return *this;
+    }
+
+    const_iterator operator++(int) {
+      const_iterator copy = *this;
+      ++*this;
+      return copy;
+    }
+
+    const_iterator operator--(int) {
+      const_iterator copy = *this;
+      --*this;
+      return copy;
+    }
+
+    reference operator*() const { return path.back()->value; }
+
+    pointer operator->() const { return &path.back()->value; }
+
+   private:
+    friend class PersistentRedBlackTree;
+
+    explicit const_iterator(const Node* root) : root(root) {}
+
+    void DescendLeft() {
+      while (path.back()->left != nullptr) {
+        path.push_back(path.back()->left);
+      }
+    }
+
+    void DescendRight() {
+      while (path.back()->right != nullptr) {
+        path.push_back(path.back()->right);
+      }
+    }
+
+    const Node* root = nullptr;
+    std::vector<const Node*> path; // empty for end()
+  };
+
+  using iterator = const_iterator;
+  using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+  using reverse_iterator = const_reverse_iterator;
+
+  PersistentRedBlackTree() = default;
+
+  PersistentRedBlackTree(const Compare& compare, const Alloc& alloc) : compare(compare), alloc(alloc) {}
+
+  // Shares all nodes in O(1); the allocator is copied, not selected, since nodes are shared
+  PersistentRedBlackTree(const PersistentRedBlackTree& other) : root(other.root), compare(other.compare), alloc(other.alloc) {
+    Retain(root);
+  }
+
+  PersistentRedBlackTree(PersistentRedBlackTree&& other) noexcept
+      : root(std::exchange(other.root, nullptr)), compare(other.compare), alloc(other.alloc) {}
+
+  PersistentRedBlackTree& operator=(PersistentRedBlackTree other) noexcept {
+    swap(other);
+    return *this;
+  }
+
+  ~PersistentRedBlackTree() { Release(root); }
+
+  void swap(PersistentRedBlackTree& other) noexcept {
+    using std::swap;
+    swap(root, other.root);
+    swap(compare, other.compare);
+    swap(alloc, other.alloc);
+  }
+
+  friend void swap(PersistentRedBlackTree& lhs, PersistentRedBlackTree& rhs) noexcept { lhs.swap(rhs); }
+
+  // Point-in-time view that later changes of this tree don't affect
+  PersistentRedBlackTree snapshot() const { return *this; }
+
+  std::size_t size() const noexcept { return SubtreeSize(root); }
+
+  bool empty() const noexcept { return root == nullptr; }
+
+  const_iterator begin() const {
+    const_iterator first(root);
+    if (root != nullptr) {
+      first.path.push_back(root);
+      first.DescendLeft();
+    }
+    return first;
+  }
+
+  const_iterator end() const { return const_iterator(root); }
+
+  const_iterator cbegin() const { return begin(); }
+
+  const_iterator cend() const { return end(); }
+
+  const_reverse_iterator rbegin() const { return const_reverse_iterator(end()); }
+
+  const_reverse_iterator rend() const { return const_reverse_iterator(begin()); }
+
+  template <typename V>
+  bool insert(V&& value) {
+    if (contains(value)) { // nothing is copied for a present value
+      return false;
+    }
+    Update([&](Node*& new_root) {
+      Insert(new_root, std::forward<V>(value));
+    });
+    return true;
+  }
+
+  template <typename K> // count of deleted elements
+  std::size_t erase(const K& key) {
+    if (!contains(key)) {
+      return 0;
+    }
+    Update([&](Node*& new_root) {
+      Node* top = Own(new_root);
+      if (!IsRed(top->left) && !IsRed(top->right)) {
+        top->is_red = true;
+      }
+      Erase(new_root, key);
+    });
+    return 1;
+  }
+
+  void clear() { Release(std::exchange(root, nullptr)); }
+
+  template <typename K>
+  bool contains(const K& key) const {
+    const Node* node = root;
+    while (node != nullptr) {
+      if (compare(key, node->value)) {
+        node = node->left;
+      } else if (compare(node->value, key)) {
+        node = node->right;
+      } else {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  template <typename K>
+  const_iterator find(const K& key) const {
+    const_iterator found = lower_bound(key);
+    if (found != end() && compare(key, *found)) {
+      return end();
+    }
+    return found;
+  }
+
+  template <typename K> // first element not less than key
+  const_iterator lower_bound(const K& key) const {
+    return Bound([&](const ValueType& value) { return !compare(value, key); }, true);
+  }
+
+  template <typename K> // first element greater than key
+  const_iterator upper_bound(const K& key) const {
+    return Bound([&](const ValueType& value) { return compare(key, value); }, true);
+  }
+
+  template <typename K>
+  const_iterator find_greater_than(const K& key) const { return upper_bound(key); }
+
+  template <typename K> // last element less than key
+  const_iterator find_less_than(const K& key) const {
+    return Bound([&](const ValueType& value) { return compare(value, key); }, false);
+  }
+
+  const_iterator statistic(std::size_t stat_num) const {
+    const_iterator found(root);
+    if (stat_num >= size()) {
+      return found;
+    }
+    const Node* node = root;
+    while (true) {
+      found.path.push_back(node);
+      std::size_t left_subtree = SubtreeSize(node->left);
+      if (left_subtree < stat_num) {
+        stat_num -= left_subtree + 1;
+        node = node->right;
+      } else if (left_subtree > stat_num) {
+        node = node->left;
+      } else {
+        return found;
+      }
+    }
+  }
+
+  template <typename K> // count of elements less than key
+  std::size_t rank(const K& key) const {
+    std::size_t less = 0;
+    for (const Node* node = root; node != nullptr;) {
+      if (compare(node->value, key)) {
+        less += SubtreeSize(node->left) + 1;
+        node = node->right;
+      } else {
+        node = node->left;
+      }
+    }
+    return less;
+  }
+
+ private:
+  Node* root = nullptr;
+  [[no_unique_address]] Compare compare;
+  [[no_unique_address]] NodeAlloc alloc;
+
+  template <typename V>
+  Node* CreateNode(V&& value) {
+    Node* node = NodeAllocTraits::allocate(alloc, 1);
+    try {
+      NodeAllocTraits::construct(alloc, node, std::forward<V>(value));
+    } catch (...) {
+      NodeAllocTraits::deallocate(alloc, node, 1);
+      throw;
+    }
+    return node;
+  }
+
+  static void Retain(Node* node) {
+    if (node != nullptr) {
+      node->refs.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+
+  void Release(Node* node) {
+    if (node != nullptr && node->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      Release(node->left);
+      Release(node->right);
+      NodeAllocTraits::destroy(alloc, node);
+      NodeAllocTraits::deallocate(alloc, node, 1);
+    }
+  }
+
+  static bool IsRed(const Node* node) { return node != nullptr && node->is_red; }
+
+  static std::size_t SubtreeSize(const Node* node) { return node == nullptr ? 0 : node->subtree_size; }
+
+  static void UpdateSize(Node* node) {
+    node->subtree_size = SubtreeSize(node->left) + 1 + SubtreeSize(node->right);
+  }
+
+  // Builds the new version from a private reference to the root. Every node to be changed
+  // is first replaced by a fresh copy (Own), so the shared nodes and the current version
+  // stay intact until the new root is published.
+  template <typename Function>
+  void Update(Function change) {
+    Node* new_root = root;
+    Retain(new_root);
+    try {
+      change(new_root);
+    } catch (...) {
+      Release(new_root);
+      throw;
+    }
+    if (new_root != nullptr) {
+      new_root->is_red = false;
+      ClearFresh(new_root);
+    }
+    Release(std::exchange(root, new_root));
+  }
+
+  // Fresh nodes only hang under fresh nodes, so they form a subtree at the root
+  static void ClearFresh(Node* node) {
+    if (node != nullptr && node->is_fresh) {
+      node->is_fresh = false;
+      ClearFresh(node->left);
+      ClearFresh(node->right);
+    }
+  }
+
+  // Makes the node behind link changeable: a fresh node as is, otherwise a copy sharing its children
+  Node* Own(Node*& link) {
+    Node* node = link;
+    if (node == nullptr || node->is_fresh) {
+      return node;
+    }
+    Node* copy = CreateNode(std::as_const(node->value));
+    copy->left = node->left;
+    copy->right = node->right;
+    Retain(copy->left);
+    Retain(copy->right);
+    copy->subtree_size = node->subtree_size;
+    copy->is_red = node->is_red;
+    link = copy;
+    Release(node);
+    return copy;
+  }
+
+  void RotateLeft(Node*& link) {
+    Node* node = Own(link);
+    Node* right = Own(node->right);
+    node->right = right->left;
+    right->left = node;
+    right->is_red = node->is_red;
+    node->is_red = true;
+    UpdateSize(node);
+    UpdateSize(right);
+    link = right;
+  }
+
+  void RotateRight(Node*& link) {
+    Node* node = Own(link);
+    Node* left = Own(node->left);
+    node->left = left->right;
+    left->right = node;
+    left->is_red = node->is_red;
+    node->is_red = true;
+    UpdateSize(node);
+    UpdateSize(left);
+    link = left;
+  }
+
+  void FlipColors(Node*& link) {
+    Node* node = Own(link);
+    Node* left = Own(node->left);
+    Node* right = Own(node->right);
+    node->is_red = !node->is_red;
+    left->is_red = !left->is_red;
+    right->is_red = !right->is_red;
+  }
+
+  // Restores the left-leaning invariants on the way up
+  void Balance(Node*& link) {
+    if (IsRed(link->right) && !IsRed(link->left)) {
+      RotateLeft(link);
+    }
+    if (IsRed(link->left) && IsRed(link->left->left)) {
+      RotateRight(link);
+    }
+    if (IsRed(link->left) && IsRed(link->right)) {
+      FlipColors(link);
+    }
+    UpdateSize(link);
+  }
+
+  template <typename V>
+  void Insert(Node*& link, V&& value) {
+    if (link == nullptr) {
+      link = CreateNode(std::forward<V>(value));
+      return;
+    }
+    Node* node = Own(link);
+    if (compare(value, node->value)) {
+      Insert(node->left, std::forward<V>(value));
+    } else {
+      Insert(node->right, std::forward<V>(value));
+    }
+    Balance(link);
+  }
+
+  // A red link is pushed down the side we descend into, so the deleted leaf is red
+
+  void MoveRedLeft(Node*& link) {
+    FlipColors(link);
+    if (IsRed(link->right->left)) {
+      RotateRight(link->right);
+      RotateLeft(link);
+      FlipColors(link);
+    }
+  }
+
+  void MoveRedRight(Node*& link) {
+    FlipColors(link);
+    if (IsRed(link->left->left)) {
+      RotateRight(link);
+      FlipColors(link);
+    }
+  }
+
+  void EraseMin(Node*& link) {
+    if (link->left == nullptr) {
+      Release(std::exchange(link, nullptr));
+      return;
+    }
+    Node* node = Own(link);
+    if (!IsRed(node->left) && !IsRed(node->left->left)) {
+      MoveRedLeft(link);
+    }
+    EraseMin(link->left);
+    Balance(link);
+  }
+
+  template <typename K> // key must be present
+  void Erase(Node*& link, const K& key) {
+    Own(link);
+    if (compare(key, link->value)) {
+      if (!IsRed(link->left) && !IsRed(link->left->left)) {
+        MoveRedLeft(link);
+      }
+      Erase(link->left, key);
+    } else {
+      if (IsRed(link->left)) {
+        RotateRight(link);
+      }
+      if (!compare(link->value, key) && link->right == nullptr) {
+        Release(std::exchange(link, nullptr));
+        return;
+      }
+      if (!IsRed(link->right) && !IsRed(link->right->left)) {
+        MoveRedRight(link);
+      }
+      if (!compare(link->value, key)) { // the successor takes the place of the erased node
+        const Node* successor = link->right;
+        while (successor->left != nullptr) {
+          successor = successor->left;
+        }
+        Node* node = link;
+        Node* replacement = CreateNode(successor->value);
+        replacement->left = std::exchange(node->left, nullptr);
+        replacement->right = std::exchange(node->right, nullptr);
+        replacement->is_red = node->is_red;
+        link = replacement;
+        Release(node);
+        EraseMin(link->right);
+      } else {
+        Erase(link->right, key);
+      }
+    }
+    Balance(link);
+  }
+
+  // First (in_order) or last (!in_order) element satisfying a predicate monotone in that direction
+  template <typename Predicate>
+  const_iterator Bound(Predicate satisfies, bool in_order) const {
+    const_iterator found(root);
+    std::size_t depth = 0;
+    for (const Node* node = root; node != nullptr;) {
+      found.path.push_back(node);
+      if (satisfies(node->value)) {
+        depth = found.path.size();
+        node = in_order ? node->left : node->right;
+      } else {
+        node = in_order ? node->right : node->left;
+      }
+    }
+    found.path.resize(depth);
+    return found;
+  }
+};
+
+#endif // NENIY_PERSISTENTREDBLACKTREE
@@ -0,0 +1,165 @@
+#pragma once
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+
+#ifndef NENIY_POOLALLOCATOR
+#define NENIY_POOLALLOCATOR
+
+// Slab storage behind PoolAllocator: single objects of up to kMaxSlotSize bytes are cut from
+// chunks of equal-sized slots, freed slots are reused first. Not thread-safe.
+class NodePool {
+ public:
+  static constexpr std::size_t kAlignment = alignof(std::max_align_t);
+  static constexpr std::size_t kMaxSlotSize = 256;
+
+  NodePool() = default;
+
+  NodePool(const NodePool&) = delete;
+
+  NodePool& operator=(const NodePool&) = delete;
+
+  ~NodePool() { release(); }
+
+  static constexpr bool fits(std::size_t size, std::size_t align) noexcept {
+    return size <= kMaxSlotSize && align <= kAlignment;
+  }
+
+  void* allocate(std::size_t size) {
+    SizeClass& size_class = classes[ClassOf(size)];
+    if (size_class.free_list != nullptr) {
+      Slot* slot = size_class.free_list;
+      size_class.free_list = slot->next;
+      return slot;
+    }
+    if (size_class.unused == size_class.unused_end) {
+      Grow(size_class, SlotSize(size));
+    }
+    void* slot = size_class.unused;
+    size_class.unused += SlotSize(size);
+    return slot;
+  }
+
+  void deallocate(void* pointer, std::size_t size) noexcept {
+    SizeClass& size_class = classes[ClassOf(size)];
+    size_class.free_list = ::new (pointer) Slot{size_class.free_list};
+  }
+
+  // Frees every chunk at once; all memory handed out by the pool becomes invalid
+  void release() noexcept {
+    while (chunks != nullptr) {
+      Chunk* next = chunks->next;
+      ::operator delete(chunks, chunks->bytes, std::align_val_t(kAlignment));
+      chunks = next;
+    }
+    for (SizeClass& size_class : classes) {
+      size_class = SizeClass{};
+    }
+  }
+
+ private:
+  static constexpr std::size_t kFirstChunkSlots = 64;
+  static constexpr std::size_t kMaxChunkSlots = 1 << 16;
+
+  struct Slot {
+    Slot* next;
+  };
+
+  struct alignas(kAlignment) Chunk { // followed by the slots
+    Chunk* next;
+    std::size_t bytes;
+  };
+
+  struct SizeClass {
+    Slot* free_list = nullptr;
+    std::byte* unused = nullptr; // never handed out part of the last chunk
+    std::byte* unused_end = nullptr;
+    std::size_t next_chunk_slots = kFirstChunkSlots;
+  };
+
+  static constexpr std::size_t SlotSize(std::size_t size) noexcept {
+    return (ClassOf(size) + 1) * kAlignment;
+  }
+
+  static constexpr std::size_t ClassOf(std::size_t size) noexcept {
+    return size == 0 ? 0 : (size - 1) / kAlignment;
+  }
+
+  void Grow(SizeClass& size_class, std::size_t slot_size) {
+    std::size_t bytes = sizeof(Chunk) + size_class.next_chunk_slots * slot_size;
+    Chunk* chunk = ::new (::operator new(bytes, std::align_val_t(kAlignment))) Chunk{chunks, bytes};
+    chunks = chunk;
+    size_class.unused = reinterpret_cast<std::byte*>(chunk + 1);
+    size_class.unused_end = size_class.unused + size_class.next_chunk_slots * slot_size;
+    if (size_class.next_chunk_slots < kMaxChunkSlots) {
+      size_class.next_chunk_slots *= 2;
+    }
+  }
+
+  SizeClass classes[kMaxSlotSize / kAlignment];
+  Chunk* chunks = nullptr;
+};
+
+// Allocator for node-based containers such as RedBlackTree: copies share one NodePool,
+// n == 1 requests are served from it and larger ones go to operator new
+template <typename T>
+class PoolAllocator {
+ public:
+  using value_type = T;
+  using propagate_on_container_copy_assignment = std::false_type;
+  using propagate_on_container_move_assignment = std::true_type;
+  using propagate_on_container_swap = std::true_type;
+  using is_always_equal = std::false_type;
+
+  PoolAllocator() : pool(std::make_shared<NodePool>()) {}
+
+  // No move constructor: a moved-from container must still be able to allocate
+  PoolAllocator(const PoolAllocator&) noexcept = default;
+
+  PoolAllocator& operator=(const PoolAllocator&) noexcept = default;
+
+  template <typename U>
+  PoolAllocator(const PoolAllocator<U>& other) noexcept : pool(other.pool) {}
+
+  T* allocate(std::size_t count) {
+    if (count == 1 && NodePool::fits(sizeof(T), alignof(T))) {
+      return static_cast<T*>(pool->allocate(sizeof(T)));
+    }
+    return std::allocator<T>().allocate(count);
+  }
+
+  void deallocate(T* pointer, std::size_t count) noexcept {
+    if (count == 1 && NodePool::fits(sizeof(T), alignof(T))) {
+      pool->deallocate(pointer, sizeof(T));
+    } else {
+      std::allocator<T>().deallocate(pointer, count);
+    }
+  }
+
+  // A copied container gets a pool of its own
+  PoolAllocator select_on_container_copy_construction() const { return PoolAllocator(); }
+
+  // Drops the whole pool in O(chunks) if no other allocator shares it; used by
+  // RedBlackTree::clear() and ~RedBlackTree() for trivially destructible values
+  bool try_release() noexcept {
+    if (pool.use_count() != 1) {
+      return false;
+    }
+    pool->release();
+    return true;
+  }
+
+  template <typename U>
+  bool operator==(const PoolAllocator<U>& other) const noexcept {
+    return pool == other.pool;
+  }
+
+ private:
+  template <typename U>
+  friend class PoolAllocator;
+
+  std::shared_ptr<NodePool> pool;
+};
+
+#endif // NENIY_POOLALLOCATOR
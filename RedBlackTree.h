@@ -1,30 +1,243 @@
 #pragma once
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <bitset>
+#include <concepts>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <functional>
+#include <istream>
+#include <iterator>
+#include <limits>
 #include <memory>
+#include <optional>
+#include <ostream>
+#include <span>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
 
 #ifndef NENIY_REDBLACKTREE
 #define NENIY_REDBLACKTREE
 
-template <typename ValueType, typename Compare = std::less<ValueType>, typename Alloc = std::allocator<ValueType>>
+// No aggregate besides subtree_size; nodes get no extra field
+struct NoAugmentation {};
+
+// An augmentation keeps a monoid aggregate of every subtree next to subtree_size:
+// lift(value) is the aggregate of one element, combine(lhs, rhs) is associative with
+// identity() as its unit and gets the left part first. Get projects the aggregated field
+// out of a value and must be default constructible, e.g. a captureless lambda's type.
+
+template <typename T, typename Get = std::identity>
+struct SumAugmentation {
+  using value_type = T;
+  static T identity() { return T(); }
+  template <typename V>
+  static T lift(const V& value) { return static_cast<T>(Get()(value)); }
+  static T combine(const T& lhs, const T& rhs) { return lhs + rhs; }
+};
+
+template <typename T, typename Get = std::identity>
+struct MinAugmentation {
+  using value_type = T;
+  static T identity() { return std::numeric_limits<T>::max(); }
+  template <typename V>
+  static T lift(const V& value) { return static_cast<T>(Get()(value)); }
+  static T combine(const T& lhs, const T& rhs) { return std::min(lhs, rhs); }
+};
+
+template <typename T, typename Get = std::identity>
+struct MaxAugmentation {
+  using value_type = T;
+  static T identity() { return std::numeric_limits<T>::lowest(); }
+  template <typename V>
+  static T lift(const V& value) { return static_cast<T>(Get()(value)); }
+  static T combine(const T& lhs, const T& rhs) { return std::max(lhs, rhs); }
+};
+
+// What insert does with a value equal to one already in the tree
+enum class DuplicateKeys {
+  kRejected, // a set: insert returns the existing element
+  kSeparateNodes, // a multiset: a new node after the equal ones
+  kCounted, // a multiset keeping one node per distinct value with its number of copies
+};
+
+// How the tree keeps its height logarithmic; both use the one color bit of a node
+enum class Balancing {
+  kRedBlack,
+  kWeakAvl, // rank-balanced, the bit holds the parity of the rank
+};
+
+// Compile-time options of RedBlackTree; derive from it and override what is needed
+struct DefaultTreePolicy {
+  static constexpr bool compact_layout = false; // color in the top bit of subtree_size instead of a bool
+  using size_type = std::size_t; // type of subtree_size, limits the number of elements
+  using augmentation = NoAugmentation; // aggregate kept for every subtree, see SumAugmentation
+  static constexpr DuplicateKeys duplicates = DuplicateKeys::kRejected;
+  static constexpr bool collect_stats = false; // count hot-path events, see StatsTreePolicy
+  static constexpr bool linked_iteration = false; // prev/next links in nodes, see LinkedTreePolicy
+  static constexpr Balancing balancing = Balancing::kRedBlack; // see WeakAvlTreePolicy
+};
+
+// Trees with a subtree aggregate of Augmentation, e.g. AugmentedTreePolicy<SumAugmentation<long>>
+template <typename Augmentation>
+struct AugmentedTreePolicy : DefaultTreePolicy {
+  using augmentation = Augmentation;
+};
+
+// Multisets. Equal elements are kept in insertion order in separate nodes, or counted in one
+// node, in which case iteration visits every distinct value once while positions (size(),
+// statistic(), rank(), distance()) count all copies. Set operations need unique elements.
+
+struct MultiTreePolicy : DefaultTreePolicy {
+  static constexpr DuplicateKeys duplicates = DuplicateKeys::kSeparateNodes;
+};
+
+struct CountedMultiTreePolicy : DefaultTreePolicy {
+  static constexpr DuplicateKeys duplicates = DuplicateKeys::kCounted;
+};
+
+// Trees counting their hot-path events in TreeStats, on top of any other policy:
+// StatsTreePolicy<>, StatsTreePolicy<MultiTreePolicy>...
+template <typename BasePolicy = DefaultTreePolicy>
+struct StatsTreePolicy : BasePolicy {
+  static constexpr bool collect_stats = true;
+};
+
+// Trees whose nodes also form a doubly linked list in order, closed through end(): ++ and
+// -- follow one pointer, iterators shrink to one pointer, nodes grow by two pointers. Set
+// operations (merge_union, intersect, difference) relink the result in O(n).
+template <typename BasePolicy = DefaultTreePolicy>
+struct LinkedTreePolicy : BasePolicy {
+  static constexpr bool linked_iteration = true;
+};
+
+// Weak AVL trees (Haeupler, Sen, Tarjan): every node has a rank, children differ from it by
+// 1 or 2 and leaves have rank 0. An insertion rotates at most twice like a red-black tree,
+// an erase at most twice instead of three times, and a tree built by insertions alone is
+// an AVL tree, at most 1.44 log n high instead of 2 log n. Same nodes and API otherwise.
+template <typename BasePolicy = DefaultTreePolicy>
+struct WeakAvlTreePolicy : BasePolicy {
+  static constexpr Balancing balancing = Balancing::kWeakAvl;
+};
+
+// Event counters of a tree with StatsTreePolicy since it was created or reset_stats() was
+// called. A walk is one call of the repair or update loop; its length divided by the calls
+// gives the average, the longest one bounds the latency of an operation.
+struct TreeStats {
+  std::uint64_t comparisons = 0;
+  std::uint64_t rotations = 0;
+  std::uint64_t insert_repairs = 0;      // InsertRepair calls
+  std::uint64_t recolor_steps = 0;       // red uncle recolorings (weak AVL: promotions) moving the violation up
+  std::uint64_t longest_recolor_cascade = 0;
+  std::uint64_t delete_repairs = 0;      // black depth repairs after removing a black leaf (weak AVL: any node)
+  std::uint64_t delete_repair_steps = 0; // levels the missing black node (weak AVL: the demotions) climbed
+  std::uint64_t deepest_delete_repair = 0;
+  std::uint64_t size_updates = 0;        // walks recomputing subtree_size up to the root
+  std::uint64_t size_update_steps = 0;   // nodes recomputed by them
+  std::uint64_t longest_size_update = 0;
+};
+
+// Shape of a tree, see RedBlackTree::shape_report
+struct TreeShape {
+  std::size_t nodes = 0;
+  std::size_t height = 0;       // nodes on the longest path from the root, 0 when empty
+  std::size_t black_height = 0; // black nodes on every path from the root to an empty child (rank + 1 in a weak AVL tree)
+  std::size_t max_depth = 0;    // of a node, the root has depth 0
+  double average_depth = 0;
+  std::vector<std::size_t> depth_histogram; // nodes at every depth
+};
+
+// No separate color field and 32-bit subtree sizes by default: 32 bytes per node for
+// RedBlackTree<int> on 64-bit targets instead of 40, at most 2^31 - 1 elements
+template <typename SizeType = std::uint32_t>
+struct CompactTreePolicy : DefaultTreePolicy {
+  static constexpr bool compact_layout = true;
+  using size_type = SizeType;
+};
+
+template <typename ValueType, typename Compare = std::less<ValueType>, typename Alloc = std::allocator<ValueType>,
+          typename Policy = DefaultTreePolicy>
 class RedBlackTree {
  private:
   struct BaseNode;
 
-  // base is used instead of nullptr
-  BaseNode base; // parent == root, left == begin(), right == end() - 1
+  // base is the end() node; nothing in the tree points to it. It is allocated with the tree
+  // and handed over with the nodes, so moves and swap keep every iterator valid, end() too.
+  BaseNode* base; // parent == root, left == begin(), right == end() - 1
+
+  struct NoLinks {
+    NoLinks() = default;
+    constexpr NoLinks(BaseNode*) {}
+  };
+
+  struct Links {
+    Links() = default;
+    constexpr Links(BaseNode* self) : prev(self), next(self) {}
+
+    BaseNode* prev = nullptr; // in order, through base at both ends
+    BaseNode* next = nullptr;
+  };
+
+  static constexpr bool kLinked = Policy::linked_iteration;
 
    struct BaseNode {
     BaseNode* parent;
     BaseNode* right;
     BaseNode* left;
+    [[no_unique_address]] std::conditional_t<kLinked, Links, NoLinks> links; // base links to itself when empty
+  };
+
+  using SizeType = typename Policy::size_type;
+
+  static constexpr bool kCompact = Policy::compact_layout;
+  static constexpr SizeType kRedBit = kCompact ? SizeType(1) << (sizeof(SizeType) * 8 - 1) : 0;
+  static constexpr SizeType kSizeMask = static_cast<SizeType>(~kRedBit);
+
+  struct RedFlag {
+    bool is_red = true;
+  };
+
+  struct NoRedFlag {};
+
+  using Augmentation = typename Policy::augmentation;
+
+  static constexpr bool kAugmented = !std::is_same_v<Augmentation, NoAugmentation>;
+
+  struct NoAggregate {
+    using value_type = NoAggregate;
+  };
+
+  using AggregateType = typename std::conditional_t<kAugmented, Augmentation, NoAggregate>::value_type;
+
+  static constexpr bool kUnique = Policy::duplicates == DuplicateKeys::kRejected;
+  static constexpr bool kMulti = Policy::duplicates == DuplicateKeys::kSeparateNodes;
+  static constexpr bool kCounted = Policy::duplicates == DuplicateKeys::kCounted;
+
+  static constexpr bool kStats = Policy::collect_stats;
+
+  static constexpr bool kWeakAvl = Policy::balancing == Balancing::kWeakAvl;
+
+  static_assert(!(kCounted && kAugmented), "RedBlackTree: counted duplicates can't be combined with an augmentation");
+
+  struct OneCopy {
+    OneCopy() = default;
+    constexpr explicit OneCopy(int) {}
   };
 
   struct Node : BaseNode {
     template <typename V>
-    Node(BaseNode* parent, BaseNode* left, BaseNode* right, V&& value) : BaseNode{parent, left, right}, value(std::forward<V>(value)) {}
+    Node(BaseNode* parent, BaseNode* left, BaseNode* right, V&& value) : BaseNode{parent, right, left, {}}, value(std::forward<V>(value)) {}
 
-    std::size_t subtree_size = 1;
+    SizeType subtree_size = kRedBit | 1; // in the compact layout the top bit is the color
     ValueType value;
-    bool is_red = true;
+    [[no_unique_address]] std::conditional_t<kCompact, NoRedFlag, RedFlag> color;
+    [[no_unique_address]] AggregateType aggregate{}; // of the subtree, set by UpdateSize
+    [[no_unique_address]] std::conditional_t<kCounted, SizeType, OneCopy> copies{1}; // of value, counted duplicates only
   };
 
   using NodeAlloc = typename std::allocator_traits<Alloc>::template rebind_alloc<Node>;
@@ -33,30 +246,87 @@ class RedBlackTree {
   [[no_unique_address]] Compare compare;
   [[no_unique_address]] NodeAlloc alloc;
 
+  struct NoStats {};
+
+  // Lookups of a const tree count too, possibly from concurrent readers: the counters are
+  // bumped with relaxed atomic loads and stores, which cost what plain increments do and
+  // may lose a few events under contention
+  [[no_unique_address]] mutable std::conditional_t<kStats, TreeStats, NoStats> counters;
+
+  static constexpr std::uint64_t TreeStats::*kStatFields[] = {
+      &TreeStats::comparisons,         &TreeStats::rotations,
+      &TreeStats::insert_repairs,      &TreeStats::recolor_steps,         &TreeStats::longest_recolor_cascade,
+      &TreeStats::delete_repairs,      &TreeStats::delete_repair_steps,   &TreeStats::deepest_delete_repair,
+      &TreeStats::size_updates,        &TreeStats::size_update_steps,     &TreeStats::longest_size_update};
+
+  static std::uint64_t LoadCounter(std::uint64_t& counter) {
+    return std::atomic_ref<std::uint64_t>(counter).load(std::memory_order_relaxed);
+  }
+
+  static void StoreCounter(std::uint64_t& counter, std::uint64_t value) {
+    std::atomic_ref<std::uint64_t>(counter).store(value, std::memory_order_relaxed);
+  }
+
+  void CountEvent(std::uint64_t TreeStats::*counter) const {
+    if constexpr (kStats) {
+      StoreCounter(counters.*counter, LoadCounter(counters.*counter) + 1);
+    }
+  }
+
+  // A finished walk of length steps: one call, steps steps, maybe a new longest walk
+  void CountWalk(std::uint64_t TreeStats::*calls, std::uint64_t TreeStats::*total, std::uint64_t TreeStats::*longest,
+                 std::uint64_t steps) const {
+    if constexpr (kStats) {
+      CountEvent(calls);
+      StoreCounter(counters.*total, LoadCounter(counters.*total) + steps);
+      if (steps > LoadCounter(counters.*longest)) {
+        StoreCounter(counters.*longest, steps);
+      }
+    }
+  }
+
+  // Every comparison of the tree's own searches goes through here
+  template <typename L, typename R>
+  bool Less(const L& lhs, const R& rhs) const {
+    CountEvent(&TreeStats::comparisons);
+    return compare(lhs, rhs);
+  }
+
   template <typename V>
   Node* CreateNode(BaseNode* parent, BaseNode* left, BaseNode* right, V&& value) {
+    if constexpr (sizeof(SizeType) < sizeof(std::size_t)) {
+      if (size() == max_size()) {
+        throw std::length_error("RedBlackTree: subtree_size type is too narrow");
+      }
+    }
     Node* new_node = NodeAllocTraits::allocate(alloc, 1);
     NodeAllocTraits::construct(alloc, new_node, parent, left, right, std::forward<V>(value));
     return new_node;
   }
 
-  void RemoveNode(Node* node) {
-    if (node->parent != &base) {
+  void DetachLeaf(Node* node) {
+    if constexpr (kLinked) {
+      Link(node->links.prev, node->links.next);
+    }
+    if (node->parent != nullptr) {
       if (node->parent->left == node) {
-        node->parent->left = &base;
+        node->parent->left = nullptr;
       } else {
-        node->parent->right = &base;
+        node->parent->right = nullptr;
       }
     } else {
-      base.parent = &base;
+      base->parent = nullptr;
     }
 
-    if (base.left == node) {
-      base.left = node->parent;
+    if (base->left == node) {
+      base->left = node->parent != nullptr ? node->parent : base;
     }
-    if (base.right == node) {
-      base.right = node->parent;
+    if (base->right == node) {
+      base->right = node->parent != nullptr ? node->parent : base;
     }
+  }
+
+  void DestroyNode(Node* node) {
     NodeAllocTraits::destroy(alloc, node);
     NodeAllocTraits::deallocate(alloc, node, 1);
   }
@@ -65,15 +335,69 @@ class RedBlackTree {
     return static_cast<Node*>(node);
   }
 
+  static bool IsRed(const BaseNode* node) { // empty children are black
+    if (node == nullptr) {
+      return false;
+    }
+    if constexpr (kCompact) {
+      return (static_cast<const Node*>(node)->subtree_size & kRedBit) != 0;
+    } else {
+      return static_cast<const Node*>(node)->color.is_red;
+    }
+  }
+
+  static void SetRed(BaseNode* node, bool red) {
+    if constexpr (kCompact) {
+      Data(node)->subtree_size = static_cast<SizeType>((Data(node)->subtree_size & kSizeMask) | (red ? kRedBit : 0));
+    } else {
+      Data(node)->color.is_red = red;
+    }
+  }
+
+  // Weak AVL ranks are known by parity only: an empty child has rank -1, and a child whose
+  // parity differs from its parent's is a 1-child, otherwise a 2-child
+  static bool OddRank(const BaseNode* node) {
+    return node == nullptr || IsRed(node);
+  }
+
+  static std::size_t RankDifference(const BaseNode* parent, const BaseNode* child) {
+    return OddRank(parent) != OddRank(child) ? 1 : 2;
+  }
+
+  static void StepRank(BaseNode* node) { // a promotion or a demotion
+    SetRed(node, !IsRed(node));
+  }
+
+  static std::size_t SubtreeSize(const BaseNode* node) {
+    if (node == nullptr) {
+      return 0;
+    }
+    return static_cast<const Node*>(node)->subtree_size & kSizeMask;
+  }
+
+  static void SetSubtreeSize(BaseNode* node, std::size_t size) {
+    Data(node)->subtree_size = static_cast<SizeType>((Data(node)->subtree_size & kRedBit) | size);
+  }
+
+  static std::size_t Copies(const BaseNode* node) { // elements held by the node
+    if constexpr (kCounted) {
+      return static_cast<const Node*>(node)->copies;
+    } else {
+      return 1;
+    }
+  }
+
   template <bool IsConst>
   class Iterator {
    public:
     using value_type = ValueType;
     using iterator_category = std::bidirectional_iterator_tag;
     using pointer = std::conditional_t<IsConst, const value_type*, value_type*>;
-    using reference = std::conditional_t<IsConst, const value_type&, value_type>;
+    using reference = std::conditional_t<IsConst, const value_type&, value_type&>;
     using difference_type = std::ptrdiff_t;
 
+    Iterator() = default;
+
     explicit Iterator(BaseNode* node, BaseNode* base) : node(node), base(base) {}
 
     template<bool OtherIsConst>
@@ -89,13 +413,15 @@ class RedBlackTree {
     }
 
     Iterator& operator++() {
-      if (node->right != base) {
+      if constexpr (kLinked) {
+        node = node->links.next;
+      } else if (node->right != nullptr) {
         node = node->right;
-        while (node->left != base) {
+        while (node->left != nullptr) {
           node = node->left;
         }
       } else if (base->right == node) {
-        node = node->right;
+        node = base;
       } else {
         BaseNode* parent = node->parent;
         while (parent->right == node) {
@@ -108,15 +434,17 @@ class RedBlackTree {
     }
 
     Iterator& operator--() {
-      if (node == base) {
+      if constexpr (kLinked) {
+        node = node->links.prev;
+      } else if (node == base) {
         node = base->right;
-      } else if (node->left != base) {
+      } else if (node->left != nullptr) {
         node = node->left;
-        while (node->right != base) {
+        while (node->right != nullptr) {
           node = node->right;
         }
       } else if (base->left == node) {
-        node = node->left;
+        node = base;
       } else {
         BaseNode* parent = node->parent;
         while (parent->left == node) {
@@ -148,12 +476,70 @@ class RedBlackTree {
       return &**this;
     }
 
-    template <typename AnyValueType, typename AnyCompare, typename AnyAlloc>
+    template <typename AnyValueType, typename AnyCompare, typename AnyAlloc, typename AnyPolicy>
     friend class RedBlackTree;
 
    private:
-    BaseNode* node;
-    BaseNode* base;
+    BaseNode* node = nullptr;
+    [[no_unique_address]] std::conditional_t<kLinked, NoLinks, BaseNode*> base{}; // linked steps don't need it
+  };
+
+  // Owns a node taken out of a tree by extract() until insert() puts it into a tree; with
+  // CountedMultiTreePolicy it carries every copy of its value
+  class NodeHandle {
+   public:
+    using value_type = ValueType;
+    using allocator_type = Alloc;
+
+    NodeHandle() = default;
+
+    NodeHandle(NodeHandle&& other) noexcept : node(std::exchange(other.node, nullptr)), alloc(std::move(other.alloc)) {}
+
+    NodeHandle& operator=(NodeHandle&& other) noexcept {
+      if (this != &other) {
+        Destroy();
+        node = std::exchange(other.node, nullptr);
+        alloc = std::move(other.alloc);
+      }
+      return *this;
+    }
+
+    ~NodeHandle() { Destroy(); }
+
+    bool empty() const noexcept { return node == nullptr; }
+
+    explicit operator bool() const noexcept { return node != nullptr; }
+
+    value_type& value() const { return node->value; }
+
+    allocator_type get_allocator() const { return allocator_type(*alloc); }
+
+    void swap(NodeHandle& other) noexcept {
+      std::swap(node, other.node);
+      std::swap(alloc, other.alloc);
+    }
+
+    friend void swap(NodeHandle& lhs, NodeHandle& rhs) noexcept { lhs.swap(rhs); }
+
+   private:
+    friend class RedBlackTree;
+
+    NodeHandle(Node* node, const NodeAlloc& alloc) : node(node), alloc(alloc) {}
+
+    void Destroy() {
+      if (node != nullptr) {
+        NodeAllocTraits::destroy(*alloc, node);
+        NodeAllocTraits::deallocate(*alloc, node, 1);
+        node = nullptr;
+      }
+    }
+
+    Node* node = nullptr;
+    std::optional<NodeAlloc> alloc; // empty handles need no allocator
+  };
+
+  struct Detached { // a node of a handle on its way into the tree
+    Node* node;
   };
 
  public:
@@ -161,17 +547,49 @@ class RedBlackTree {
   using const_iterator = Iterator<true>;
   using reverse_iterator = std::reverse_iterator<iterator>;
   using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+  using node_type = NodeHandle;
 
-  RedBlackTree() : base{&base, &base, &base} {}
+  struct insert_return_type {
+    iterator position;
+    bool inserted;
+    node_type node; // the handle back if an equal element kept it out
+  };
 
-  RedBlackTree(const Compare& compare, const Alloc& alloc) noexcept : base{&base, &base, &base}, compare(compare), alloc(alloc) {}
+  RedBlackTree() : base(NewBase()) {}
 
-  RedBlackTree(const RedBlackTree& other) : RedBlackTree(other.compare, NodeAllocTraits::select_on_container_copy_construction(other.alloc)) {
-    for (const ValueType& value : other) {
-      insert(value);
+  RedBlackTree(const Compare& compare, const Alloc& alloc) : base(NewBase()), compare(compare), alloc(alloc) {}
+
+  template <std::input_iterator InputIt>
+  RedBlackTree(InputIt first, InputIt last, const Compare& compare = Compare(), const Alloc& alloc = Alloc())
+      : RedBlackTree(compare, alloc) {
+    if constexpr (std::forward_iterator<InputIt> && !kCounted) {
+      if (IsSortedForBuild(first, last)) {
+        assign_sorted(first, last);
+        return;
+      }
+    }
+    if constexpr (!std::is_move_assignable_v<ValueType>) { // e.g. a pair with a const key, not sortable in place
+      insert_range(first, last);
+    } else {
+      std::vector<ValueType> values(first, last); // sort-then-build
+      // Equal elements keep their order, so like std::set a set keeps the first of them
+      std::stable_sort(values.begin(), values.end(), this->compare);
+      if constexpr (kCounted) { // equal values become copies of the first one
+        insert_range(std::make_move_iterator(values.begin()), std::make_move_iterator(values.end()));
+        return;
+      } else if constexpr (kUnique) {
+        values.erase(std::unique(values.begin(), values.end(), [this](const ValueType& lhs, const ValueType& rhs) {
+          return !this->compare(lhs, rhs);
+        }), values.end());
+      }
+      assign_sorted(std::make_move_iterator(values.begin()), std::make_move_iterator(values.end()));
     }
   }
 
+  RedBlackTree(const RedBlackTree& other) : RedBlackTree(other.compare, NodeAllocTraits::select_on_container_copy_construction(other.alloc)) {
+    AttachTree(CloneSubtree(other.base->parent, nullptr));
+  }
+
   RedBlackTree& operator=(const RedBlackTree& other) {
     if (this == &other) {
       return *this;
@@ -181,32 +599,119 @@ class RedBlackTree {
     if constexpr (NodeAllocTraits::propagate_on_container_copy_assignment::value) {
       alloc = NodeAlloc(other.alloc);
     }
-    for (const ValueType& value : other) {
-      insert(value);
+    AttachTree(CloneSubtree(other.base->parent, nullptr));
+    return *this;
+  }
+
+  // Moves and swap hand the nodes over in O(1), and iterators, pointers and references
+  // follow them, unless a move assignment between unequal allocators moves the values. The
+  // move constructor allocates a new end() node for other, so unlike them it may throw.
+
+  RedBlackTree(RedBlackTree&& other)
+      : base(std::exchange(other.base, NewBase())), compare(std::move(other.compare)), alloc(std::move(other.alloc)) {}
+
+  RedBlackTree& operator=(RedBlackTree&& other) noexcept(NodeAllocTraits::propagate_on_container_move_assignment::value ||
+                                                         NodeAllocTraits::is_always_equal::value) {
+    if (this == &other) {
+      return *this;
+    }
+    clear();
+    compare = std::move(other.compare);
+    if constexpr (NodeAllocTraits::propagate_on_container_move_assignment::value) {
+      alloc = std::move(other.alloc);
+    } else if constexpr (!NodeAllocTraits::is_always_equal::value) {
+      if (alloc != other.alloc) { // nodes can't change allocator, so values are moved one by one
+        AttachTree(CloneSubtree<true>(other.base->parent, nullptr));
+        other.clear();
+        return *this;
+      }
     }
+    StealNodes(other);
     return *this;
   }
 
-  RedBlackTree(RedBlackTree&& other) noexcept = delete;
+  void swap(RedBlackTree& other) noexcept {
+    using std::swap;
+    swap(compare, other.compare);
+    if constexpr (NodeAllocTraits::propagate_on_container_swap::value) {
+      swap(alloc, other.alloc);
+    }
+    swap(base, other.base);
+  }
+
+  friend void swap(RedBlackTree& lhs, RedBlackTree& rhs) noexcept { lhs.swap(rhs); }
+
+  // Parallel traversal: statistic() cuts the tree into threads chunks of equal rank in
+  // O(threads log n), fewer if counted nodes hold several cuts, then every chunk is walked
+  // on its own thread. fn and the reduction are called concurrently on different elements;
+  // the first exception is rethrown.
+
+  template <typename Function>
+  friend void parallel_for_each(RedBlackTree& tree, Function fn, std::size_t threads = DefaultThreads()) {
+    tree.template VisitChunks<iterator>(threads, [&](iterator first, iterator last, std::size_t) {
+      for (; first != last; ++first) {
+        fn(*first);
+      }
+    });
+  }
+
+  template <typename Function>
+  friend void parallel_for_each(const RedBlackTree& tree, Function fn, std::size_t threads = DefaultThreads()) {
+    const_cast<RedBlackTree&>(tree).template VisitChunks<const_iterator>(threads, [&](const_iterator first, const_iterator last, std::size_t) {
+      for (; first != last; ++first) {
+        fn(*first);
+      }
+    });
+  }
 
-  RedBlackTree& operator=(RedBlackTree&& other) = delete;
+  // Like std::transform_reduce: reduce must be associative, chunk results are combined in order
+  template <typename T, typename Reduce = std::plus<>, typename Transform = std::identity>
+  friend T parallel_reduce(const RedBlackTree& tree, T init, Reduce reduce = {}, Transform transform = {},
+                           std::size_t threads = DefaultThreads()) {
+    std::vector<std::optional<T>> partial(std::min(std::max<std::size_t>(threads, 1), tree.size()));
+    const_cast<RedBlackTree&>(tree).template VisitChunks<const_iterator>(threads, [&](const_iterator first, const_iterator last, std::size_t chunk) {
+      T value = transform(*first);
+      for (++first; first != last; ++first) {
+        value = reduce(std::move(value), transform(*first));
+      }
+      partial[chunk].emplace(std::move(value));
+    });
+    for (std::optional<T>& value : partial) { // counted copies may leave fewer chunks than planned
+      if (value) {
+        init = reduce(std::move(init), std::move(*value));
+      }
+    }
+    return init;
+  }
 
-  ~RedBlackTree() { TraversalDelete(base.parent); }
+  ~RedBlackTree() {
+    DestroyAll();
+    delete base;
+  }
 
   constexpr std::size_t size() const noexcept {
-    if (base.parent == &base) {
+    if (base->parent == nullptr) {
       return 0;
     }
-    return Data(base.parent)->subtree_size;
+    return SubtreeSize(base->parent);
   }
 
   constexpr bool empty() const noexcept {
     return size() == 0;
   }
 
-  iterator begin() { return iterator(base.left, &base); }
+  std::size_t max_size() const noexcept {
+    return std::min<std::size_t>(kSizeMask, NodeAllocTraits::max_size(alloc));
+  }
+
+  // Bytes taken by one element's node, see CompactTreePolicy
+  static constexpr std::size_t node_bytes() noexcept { return sizeof(Node); }
+
+  const Compare& key_comp() const noexcept { return compare; }
 
-  iterator end() { return iterator(&base, &base); }
+  iterator begin() { return iterator(base->left, base); }
+
+  iterator end() { return iterator(base, base); }
 
   const_iterator begin() const {
     return const_cast<RedBlackTree&>(*this).begin();
@@ -238,132 +743,973 @@ class RedBlackTree {
 
   template <typename V>
   std::pair<iterator, bool> insert(V&& value) {
-    if (base.parent == &base) {
-      base.parent = CreateNode(&base, &base, &base, std::forward<V>(value)); // Create a root
-      base.left = base.parent;
-      base.right = base.parent;
-      Data(base.parent)->is_red = false;
-      return {iterator(base.parent, &base), true};
+    if constexpr (kConvertOnInsert<V>) {
+      return insert(ValueType(std::forward<V>(value)));
+    }
+    if (base->parent == nullptr) {
+      base->parent = NewLeaf(nullptr, std::forward<V>(value)); // Create a root
+      base->left = base->parent;
+      base->right = base->parent;
+      RepointBase();
+      UpdateSize(base->parent);
+      SetRed(base->parent, false);
+      return {iterator(base->parent, base), true};
+    }
+    return InsertImpl(Data(base->parent), std::forward<V>(value));
+  }
+
+  // Inserts right before hint in O(1) comparisons if value belongs there (like std::set),
+  // otherwise falls back to insert(value); subtree sizes are still updated up to the root
+  template <typename V>
+  iterator insert(const_iterator hint, V&& value) {
+    if constexpr (kConvertOnInsert<V>) {
+      return insert(hint, ValueType(std::forward<V>(value)));
+    }
+    BaseNode* position = hint.node;
+    if (base->parent == nullptr) {
+      return insert(std::forward<V>(value)).first;
+    }
+    if (position == base || Less(value, Data(position)->value) || (kMulti && !Less(Data(position)->value, value))) {
+      if (position == base->left) {
+        return AttachLeaf(position, true, std::forward<V>(value));
+      }
+      BaseNode* before = std::prev(hint).node;
+      if (Less(Data(before)->value, value) || (kMulti && !Less(value, Data(before)->value))) {
+        if (before->right == nullptr) {
+          return AttachLeaf(before, false, std::forward<V>(value));
+        }
+        return AttachLeaf(position, true, std::forward<V>(value)); // position has no left child then
+      }
+    } else if (Less(Data(position)->value, value)) {
+      if (position == base->right) {
+        return AttachLeaf(position, false, std::forward<V>(value));
+      }
+      BaseNode* after = std::next(hint).node;
+      if (Less(value, Data(after)->value) || (kMulti && !Less(Data(after)->value, value))) {
+        if (position->right == nullptr) {
+          return AttachLeaf(position, false, std::forward<V>(value));
+        }
+        return AttachLeaf(after, true, std::forward<V>(value));
+      }
+    } else if constexpr (kCounted) {
+      return AddCopy(Data(position));
+    } else {
+      return iterator(position, base);
+    }
+    return insert(std::forward<V>(value)).first;
+  }
+
+  // Each element is hinted with the successor of the previous one, so increasing runs
+  // (and appends after the maximum) skip the descent from the root
+  template <std::input_iterator InputIt>
+  void insert_range(InputIt first, InputIt last) {
+    const_iterator hint = end();
+    for (; first != last; ++first) {
+      hint = std::next(insert(hint, *first));
     }
-    return InsertImpl(Data(base.parent), std::forward<V>(value));
   }
 
-  template <typename V> // count of deleted elements
-  requires (!std::is_same_v<std::remove_cvref_t<V>, iterator>)
-  std::size_t erase(V&& value) { return EraseImpl(Data(base.parent), std::forward<V>(value)); }
+  template <typename K> // count of deleted elements, all copies of key in a multiset
+  requires (!std::is_same_v<K, iterator>)
+  std::size_t erase(const K& key) { return EraseImpl(LookupKey(key)); }
+
+  template <typename K> // deletes one copy of key, returns the count of deleted elements
+  std::size_t erase_one(const K& key) {
+    iterator found = FindImpl(LookupKey(key));
+    if (found == end()) {
+      return 0;
+    }
+    if constexpr (kCounted) {
+      if (Data(found.node)->copies > 1) {
+        --Data(found.node)->copies;
+        SizeUpdate(found.node);
+        return 1;
+      }
+    }
+    DeleteLogic(Data(found.node));
+    return 1;
+  }
 
   iterator erase(const_iterator where) {
     Node* node = Data(where.node);
-    iterator after_erased(node, where.base);
+    iterator after_erased(node, base);
     ++after_erased;
     DeleteLogic(node);
     return after_erased;
   }
 
-  void clear() {
-    while (!empty()) {
-      erase(begin());
-    }
+  // Takes the element out without destroying it; iterators to other elements stay valid
+  node_type extract(const_iterator where) {
+    Node* node = Data(where.node);
+    DetachNode(node);
+    return node_type(node, alloc);
   }
 
-  template <typename V>
-  iterator find(V&& value) { return FindImpl(Data(base.parent), std::forward<V>(value)); }
-
-  template <typename V>
-  const_iterator find(V&& value) const { return const_cast<RedBlackTree&>(*this).find(std::forward<V>(value)); }
-
-  template <typename V>
-  iterator find_greater_than(V&& value) {
-    return FindLessOrGreaterImpl(base.parent, std::forward<V>(value), &base, true);
+  template <typename K> // the first copy of key, an empty handle if there is none
+  requires (!std::is_convertible_v<const K&, const_iterator>)
+  node_type extract(const K& key) {
+    iterator found = FindImpl(LookupKey(key));
+    return found == end() ? node_type() : extract(found);
   }
 
-  template <typename V>
-  const_iterator find_greater_than(V&& value) const {
-    return const_cast<RedBlackTree&>(*this).find_greater_than(std::forward<V>(value));
+  // Links the node of handle in without copying its value; a handle from a tree with an
+  // unequal allocator gets its value moved into a new node. Counted copies are added up.
+  insert_return_type insert(node_type&& handle) {
+    if (handle.empty()) {
+      return {end(), false, node_type()};
+    }
+    if (!(*handle.alloc == alloc)) {
+      auto [position, inserted] = insert(std::move(handle.value()));
+      if (inserted) {
+        handle.Destroy();
+      }
+      return {position, inserted, inserted ? node_type() : std::move(handle)};
+    }
+    auto [position, inserted] = insert(Detached{handle.node});
+    if (!inserted) {
+      return {position, false, std::move(handle)};
+    }
+    if (kCounted && Data(position.node) != handle.node) { // the copies went to an equal node
+      handle.Destroy();
+    }
+    handle.node = nullptr;
+    return {position, true, node_type()};
   }
 
-  template <typename V>
-  iterator find_less_than(V&& value) {
-    return FindLessOrGreaterImpl(base.parent, std::forward<V>(value), &base, false);
+  // Moves the elements of source missing here (all of them in a multiset) node by node in
+  // O(m log(n + m)), without allocating or copying values when the allocators are equal
+  void merge(RedBlackTree& source) {
+    if (&source == this) {
+      return;
+    }
+    for (iterator it = source.begin(); it != source.end();) {
+      iterator current = it++;
+      if (kUnique && FindImpl(LookupKey(*current)) != end()) {
+        continue;
+      }
+      insert(source.extract(current));
+    }
   }
 
-  template <typename V>
-  const_iterator find_less_than(V&& value) const {
-    return const_cast<RedBlackTree&>(*this).find_less_than(std::forward<V>(value));
-  }
+  void merge(RedBlackTree&& source) { merge(source); }
 
-  iterator statistic(std::size_t stat_num) {
-    if (base.parent == &base || stat_num >= Data(base.parent)->subtree_size) {
-      return end();
+  // Cuts [first, last) out in O(log n) and frees it; last stays valid
+  iterator erase(const_iterator first, const_iterator last) {
+    if (first == last) {
+      return iterator(last.node, base);
     }
-    return StatisticImpl(base.parent, stat_num);
+    BaseNode* stop = last.node;
+    if constexpr (kLinked) { // the pieces around the cut keep their links
+      Link(std::prev(first).node, stop);
+    }
+    // Cut by position: equal keys can't tell nodes apart, and nothing is compared, so a
+    // throwing Compare can't leave the tree in pieces
+    std::size_t first_rank = rank(first);
+    std::size_t erased = rank(last) - first_rank;
+    SplitResult head = SplitAt(TakeRoot(), first_rank);
+    std::size_t after_head = erased - Copies(head.equal);
+    DestroyNode(Data(head.equal));
+    if (stop == base) {
+      DestroySubtree(head.upper.root);
+      AttachRoot(head.lower.root);
+    } else {
+      SplitResult tail = SplitAt(head.upper, after_head);
+      DestroySubtree(tail.lower.root);
+      AttachRoot(Join(head.lower, tail.equal, tail.upper).root);
+    }
+    return iterator(stop, base);
   }
 
-  const_iterator statistic(std::size_t stat_num) const {
-    return const_cast<RedBlackTree&>(*this).statistic(stat_num);
+  void clear() {
+    DestroyAll();
+    *base = {nullptr, base, base, base};
   }
 
- private:
-  void TraversalDelete(BaseNode* node) {
-    if (node == &base) {
-      return;
+  // Replaces the contents in O(n); [first, last) must be strictly increasing by Compare
+  // (non-decreasing with MultiTreePolicy)
+  template <std::input_iterator InputIt>
+  void assign_sorted(InputIt first, InputIt last) {
+    clear();
+    if constexpr (std::forward_iterator<InputIt> || std::sized_sentinel_for<InputIt, InputIt>) {
+      AttachSorted(first, std::distance(first, last));
+    } else { // the length is needed up front
+      std::vector<ValueType> values(first, last);
+      auto it = std::make_move_iterator(values.begin());
+      AttachSorted(it, values.size());
     }
-    TraversalDelete(node->left);
-    TraversalDelete(node->right);
-    RemoveNode(Data(node));
   }
 
-  std::size_t SubtreeSize(BaseNode* node) const {
-    if (node == &base) {
-      return 0;
+  // Binary form for trivially copyable values: a header and the values in order, readable
+  // on platforms with the same value representation. load() rebuilds the tree in O(n) and
+  // throws std::runtime_error on malformed input, leaving the tree unchanged.
+
+  void save(std::ostream& out) const requires (std::is_trivially_copyable_v<ValueType> && !kCounted) {
+    SavedHeader header{};
+    std::memcpy(header.magic, kSavedMagic, sizeof(header.magic));
+    header.value_bytes = sizeof(ValueType);
+    header.count = size();
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    for (const ValueType& value : *this) {
+      out.write(reinterpret_cast<const char*>(&value), sizeof(ValueType));
     }
-    return Data(node)->subtree_size;
-  }
-
-  void SizeUpdate(BaseNode* node) { // recursively lifting with updating
-    if (node == &base) {
-      return;
+    if (!out) {
+      throw std::runtime_error("RedBlackTree::save: write failed");
     }
-    Data(node)->subtree_size = SubtreeSize(node->left) + 1 + SubtreeSize(node->right);
-    SizeUpdate(node->parent);
   }
 
-  void RotateLeft(BaseNode* node) {  // From child to parent
-    if (node == &base || node == base.parent) {
-      return;
+  void load(std::istream& in) requires (std::is_trivially_copyable_v<ValueType> && !kCounted) {
+    SavedHeader header{};
+    if (!in.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+        std::memcmp(header.magic, kSavedMagic, sizeof(header.magic)) != 0 || header.value_bytes != sizeof(ValueType)) {
+      throw std::runtime_error("RedBlackTree::load: not a saved RedBlackTree of this value type");
     }
-    if (node->parent == base.parent) {
-      base.parent = node;
+    if (header.count > max_size()) {
+      throw std::runtime_error("RedBlackTree::load: more values than the tree can hold");
     }
-    node->parent->right = node->left;
-    node->left = node->parent;
-    node->parent = node->left->parent;
-    if (node->parent != &base) {
-      if (node->parent->left == node->left) {
-        node->parent->left = node;
-      } else {
-        node->parent->right = node;
-      }
+    RedBlackTree loaded(compare, Alloc(alloc));
+    SavedReader reader(in, compare, header.count);
+    loaded.AttachSorted(reader, header.count);
+    clear();
+    StealNodes(loaded);
+  }
+
+  // Split and join relink nodes in O(log n) without copying values. Trees with unequal
+  // allocators (see PoolAllocator) get their values moved into new nodes instead.
+
+  // Moves the elements not less than key into the returned tree
+  template <typename K>
+  RedBlackTree split(const K& key) {
+    const auto& lookup_key = LookupKey(key);
+    RedBlackTree upper(compare, Alloc(alloc)); // allocates its end() node, so before the cut
+    SplitResult parts;
+    if constexpr (kMulti) {
+      std::size_t position = rank(lookup_key);
+      parts = SplitAt(TakeRoot(), position);
+    } else {
+      SplitPath path = FindSplit(base->parent, lookup_key); // compares before anything is cut
+      parts = SplitAlong(TakeRoot(), path);
     }
-    node->left->parent  = node;
-    if (node->left->right != &base) {
-      node->left->right->parent = node->left;
+    if (parts.equal != nullptr) {
+      parts.upper = Join(Piece{}, parts.equal, parts.upper);
     }
-    Data(node->left)->subtree_size = SubtreeSize(node->left->left) + 1 + SubtreeSize(node->left->right);
-    Data(node)->subtree_size = SubtreeSize(node->left) + 1 + SubtreeSize(node->right);
+    AttachRoot(parts.lower.root);
+    upper.AttachRoot(parts.upper.root);
+    return upper;
   }
 
-  void RotateRight(BaseNode* node) {  // From child to parent
-    if (node == &base || node == base.parent) {
+  // Appends other, all of whose elements must be greater than ours (not less with MultiTreePolicy)
+  void join(RedBlackTree other) {
+    if (other.empty()) {
       return;
     }
-    if (node->parent == base.parent) {
-      base.parent = node;
+    if (!empty() && (kMulti ? Less(Data(other.base->left)->value, Data(base->right)->value)
+                            : !Less(Data(base->right)->value, Data(other.base->left)->value))) {
+      throw std::invalid_argument("RedBlackTree::join: other has elements not greater than ours");
     }
-    node->parent->left = node->right;
-    node->right = node->parent;
+    CheckCombinedSize(other.size());
+    RedBlackTree donor = Adopt(std::move(other));
+    if constexpr (kLinked) {
+      Link(base->right, donor.base->left); // our base if we are empty, AttachRoot repoints it
+    }
+    auto [first, rest] = SplitFirst(donor.TakeRoot());
+    AttachRoot(Join(TakeRoot(), first, rest).root);
+  }
+
+  // Set operations in O(m log(n / m + 1)) for sizes m <= n. Nodes of other are reused or
+  // freed, so pass std::move(tree) unless the argument is still needed. On equal elements
+  // ours are kept. Up to threads threads work on disjoint subtrees; Compare is then called
+  // concurrently.
+
+  void merge_union(RedBlackTree other, std::size_t threads = 1) requires kUnique {
+    CheckCombinedSize(other.size());
+    RedBlackTree donor = Adopt(std::move(other));
+    CombineWith<kUnion>(donor, threads);
+  }
+
+  void intersect(RedBlackTree other, std::size_t threads = 1) requires kUnique {
+    CombineWith<kIntersection>(other, threads);
+  }
+
+  void difference(RedBlackTree other, std::size_t threads = 1) requires kUnique {
+    CombineWith<kDifference>(other, threads);
+  }
+
+  // Keys other than ValueType are compared directly only with a transparent Compare
+  // (Compare::is_transparent), otherwise they are converted to ValueType once per call
+
+  template <typename K>
+  iterator find(const K& key) { return FindImpl(LookupKey(key)); }
+
+  template <typename K>
+  const_iterator find(const K& key) const { return const_cast<RedBlackTree&>(*this).find(key); }
+
+  template <typename K> // first element not less than key
+  iterator lower_bound(const K& key) { return iterator(LowerBoundImpl(LookupKey(key)), base); }
+
+  template <typename K>
+  const_iterator lower_bound(const K& key) const { return const_cast<RedBlackTree&>(*this).lower_bound(key); }
+
+  template <typename K> // first element greater than key
+  iterator upper_bound(const K& key) { return iterator(UpperBoundImpl(LookupKey(key)), base); }
+
+  template <typename K>
+  const_iterator upper_bound(const K& key) const { return const_cast<RedBlackTree&>(*this).upper_bound(key); }
+
+  template <typename K>
+  std::pair<iterator, iterator> equal_range(const K& key) {
+    if constexpr (kMulti) {
+      return {lower_bound(key), upper_bound(key)};
+    }
+    iterator first = lower_bound(key);
+    iterator last = first;
+    if (last != end() && !Less(LookupKey(key), *last)) {
+      ++last;
+    }
+    return {first, last};
+  }
+
+  template <typename K>
+  std::pair<const_iterator, const_iterator> equal_range(const K& key) const {
+    return const_cast<RedBlackTree&>(*this).equal_range(key);
+  }
+
+  template <typename K> // elements equal to key
+  std::size_t count(const K& key) const {
+    const_iterator found = find(key);
+    if (found == end()) {
+      return 0;
+    }
+    if constexpr (kMulti) {
+      return rank(upper_bound(key)) - rank(found);
+    }
+    return Copies(found.node);
+  }
+
+  std::size_t copies(const_iterator where) const { return Copies(where.node); } // 1 unless counted
+
+  template <typename K>
+  iterator find_greater_than(const K& key) { return upper_bound(key); }
+
+  template <typename K>
+  const_iterator find_greater_than(const K& key) const { return upper_bound(key); }
+
+  template <typename K>
+  iterator find_less_than(const K& key) { return iterator(LessThanImpl(LookupKey(key)), base); }
+
+  template <typename K>
+  const_iterator find_less_than(const K& key) const { return const_cast<RedBlackTree&>(*this).find_less_than(key); }
+
+  iterator statistic(std::size_t stat_num) {
+    if (stat_num >= size()) {
+      return end();
+    }
+    return StatisticImpl(base->parent, stat_num);
+  }
+
+  const_iterator statistic(std::size_t stat_num) const {
+    return const_cast<RedBlackTree&>(*this).statistic(stat_num);
+  }
+
+  // Batch lookups: out[i] gets the answer for the i-th query, out.size() >= queries.size().
+  // Up to kBatchGroup descents advance level by level with prefetching, so their cache misses overlap.
+
+  template <typename K, std::size_t Extent>
+  void find_batch(std::span<K, Extent> keys, std::span<iterator> out) { BoundBatch<kFindBound>(keys, out.data()); }
+
+  template <typename K, std::size_t Extent>
+  void find_batch(std::span<K, Extent> keys, std::span<const_iterator> out) const {
+    const_cast<RedBlackTree&>(*this).template BoundBatch<kFindBound>(keys, out.data());
+  }
+
+  template <typename K, std::size_t Extent>
+  void find_greater_than_batch(std::span<K, Extent> keys, std::span<iterator> out) {
+    BoundBatch<kUpperBound>(keys, out.data());
+  }
+
+  template <typename K, std::size_t Extent>
+  void find_greater_than_batch(std::span<K, Extent> keys, std::span<const_iterator> out) const {
+    const_cast<RedBlackTree&>(*this).template BoundBatch<kUpperBound>(keys, out.data());
+  }
+
+  template <typename K, std::size_t Extent>
+  void find_less_than_batch(std::span<K, Extent> keys, std::span<iterator> out) {
+    BoundBatch<kLessThanBound>(keys, out.data());
+  }
+
+  template <typename K, std::size_t Extent>
+  void find_less_than_batch(std::span<K, Extent> keys, std::span<const_iterator> out) const {
+    const_cast<RedBlackTree&>(*this).template BoundBatch<kLessThanBound>(keys, out.data());
+  }
+
+  void statistic_batch(std::span<const std::size_t> stat_nums, std::span<iterator> out) {
+    StatisticBatch(stat_nums, out.data());
+  }
+
+  void statistic_batch(std::span<const std::size_t> stat_nums, std::span<const_iterator> out) const {
+    const_cast<RedBlackTree&>(*this).StatisticBatch(stat_nums, out.data());
+  }
+
+  template <typename K> // count of elements less than key
+  requires (!std::is_same_v<K, iterator>)
+  std::size_t rank(const K& key) const {
+    const auto& lookup_key = LookupKey(key);
+    std::size_t less = 0;
+    BaseNode* node = base->parent;
+    while (node != nullptr) {
+      if (Less(Data(node)->value, lookup_key)) {
+        less += SubtreeSize(node->left) + Copies(node);
+        node = node->right;
+      } else {
+        node = node->left;
+      }
+    }
+    return less;
+  }
+
+  std::size_t rank(const_iterator where) const { // position of where, size() for end()
+    BaseNode* node = where.node;
+    if (node == base) {
+      return size();
+    }
+    std::size_t position = SubtreeSize(node->left);
+    for (; node->parent != nullptr; node = node->parent) {
+      if (node->parent->right == node) {
+        position += SubtreeSize(node->parent->left) + Copies(node->parent);
+      }
+    }
+    return position;
+  }
+
+  template <typename L, typename H> // count of elements in [low, high)
+  std::size_t count_range(const L& low, const H& high) const {
+    std::size_t below_low = rank(low);
+    std::size_t below_high = rank(high);
+    return below_high > below_low ? below_high - below_low : 0;
+  }
+
+  std::ptrdiff_t distance(const_iterator first, const_iterator last) const {
+    return static_cast<std::ptrdiff_t>(rank(last)) - static_cast<std::ptrdiff_t>(rank(first));
+  }
+
+  iterator advance(const_iterator where, std::ptrdiff_t steps) { // end() if out of range
+    return statistic(rank(where) + steps);
+  }
+
+  const_iterator advance(const_iterator where, std::ptrdiff_t steps) const {
+    return const_cast<RedBlackTree&>(*this).advance(where, steps);
+  }
+
+  // Aggregates of an augmented tree (see AugmentedTreePolicy) in O(log n)
+
+  AggregateType aggregate() const requires kAugmented { return Aggregate(base->parent); }
+
+  AggregateType aggregate(const_iterator first, const_iterator last) const requires kAugmented {
+    return RangeAggregate(base->parent, rank(first), rank(last));
+  }
+
+  AggregateType prefix_aggregate(std::size_t count) const requires kAugmented { // of the first count elements
+    return RangeAggregate(base->parent, 0, count);
+  }
+
+  // First element whose prefix aggregate (itself included) satisfies pred, end() if none;
+  // pred must be monotone, false up to some prefix and true from there on. For example the
+  // weighted median of a SumAugmentation tree is search_prefix([&](long sum) { return 2 * sum >= total; }).
+  template <typename Predicate>
+  iterator search_prefix(Predicate pred) requires kAugmented {
+    AggregateType before = Augmentation::identity();
+    BaseNode* node = base->parent;
+    while (node != nullptr) {
+      AggregateType with_left = Augmentation::combine(before, Aggregate(node->left));
+      if (pred(std::as_const(with_left))) {
+        if (node->left == nullptr) { // only if pred holds for the empty prefix: the first element
+          return iterator(node, base);
+        }
+        node = node->left;
+        continue;
+      }
+      before = Augmentation::combine(with_left, Augmentation::lift(Data(node)->value));
+      if (pred(std::as_const(before))) {
+        return iterator(node, base);
+      }
+      node = node->right;
+    }
+    return end();
+  }
+
+  template <typename Predicate>
+  const_iterator search_prefix(Predicate pred) const requires kAugmented {
+    return const_cast<RedBlackTree&>(*this).search_prefix(std::move(pred));
+  }
+
+  // Counters of a tree with StatsTreePolicy; they stay with the tree when its elements are copied or moved
+  TreeStats stats() const requires kStats {
+    TreeStats snapshot;
+    for (std::uint64_t TreeStats::*field : kStatFields) {
+      snapshot.*field = LoadCounter(counters.*field);
+    }
+    return snapshot;
+  }
+
+  void reset_stats() requires kStats {
+    for (std::uint64_t TreeStats::*field : kStatFields) {
+      StoreCounter(counters.*field, 0);
+    }
+  }
+
+  // Height and depths in O(n)
+  TreeShape shape_report() const {
+    TreeShape shape;
+    std::vector<std::pair<const BaseNode*, std::size_t>> stack; // node and its depth
+    if (base->parent != nullptr) {
+      stack.emplace_back(base->parent, 0);
+    }
+    double depth_sum = 0;
+    while (!stack.empty()) {
+      auto [node, depth] = stack.back();
+      stack.pop_back();
+      if (shape.depth_histogram.size() <= depth) {
+        shape.depth_histogram.resize(depth + 1);
+      }
+      ++shape.depth_histogram[depth];
+      ++shape.nodes;
+      depth_sum += static_cast<double>(depth);
+      for (const BaseNode* child : {node->left, node->right}) {
+        if (child != nullptr) {
+          stack.emplace_back(child, depth + 1);
+        }
+      }
+    }
+    shape.height = shape.depth_histogram.size();
+    shape.max_depth = shape.height > 0 ? shape.height - 1 : 0;
+    shape.average_depth = shape.nodes > 0 ? depth_sum / static_cast<double>(shape.nodes) : 0;
+    shape.black_height = kWeakAvl ? RankHeight(base->parent) : BlackHeight(base->parent);
+    return shape;
+  }
+
+  // Checks the links, the balancing rules, the order of the elements and every subtree_size
+  // (and aggregate, if comparable) in O(n); throws std::logic_error naming the first broken
+  // invariant. Compare is called directly, so stats() doesn't see it.
+  void validate() const {
+    if (base->parent == nullptr) {
+      if (base->left != base || base->right != base) {
+        throw std::logic_error("RedBlackTree::validate: empty tree with begin() != end()");
+      }
+      return;
+    }
+    if (base->parent->parent != nullptr || (!kWeakAvl && IsRed(base->parent))) {
+      throw std::logic_error("RedBlackTree::validate: the root has a parent or is red");
+    }
+    const BaseNode* leftmost = base->parent;
+    const BaseNode* rightmost = base->parent;
+    while (leftmost->left != nullptr) {
+      leftmost = leftmost->left;
+    }
+    while (rightmost->right != nullptr) {
+      rightmost = rightmost->right;
+    }
+    if (base->left != leftmost || base->right != rightmost) {
+      throw std::logic_error("RedBlackTree::validate: begin() or the last element is not cached");
+    }
+    ValidateSubtree(base->parent);
+    if constexpr (kLinked) { // the links must follow the tree's order
+      const BaseNode* linked = base;
+      for (const BaseNode* node = base->left; node != nullptr; node = TreeNext(node)) {
+        if (linked->links.next != node || node->links.prev != linked) {
+          throw std::logic_error("RedBlackTree::validate: prev/next links are out of order");
+        }
+        linked = node;
+      }
+      if (linked->links.next != base || base->links.prev != linked) {
+        throw std::logic_error("RedBlackTree::validate: prev/next links are out of order");
+      }
+    }
+    for (const_iterator previous = begin(), it = std::next(previous); it != end(); previous = it++) {
+      if (kMulti ? compare(*it, *previous) : !compare(*previous, *it)) {
+        throw std::logic_error("RedBlackTree::validate: elements are out of order");
+      }
+    }
+  }
+
+ private:
+  // Allocators offering try_release() (PoolAllocator) drop all nodes at once when nothing
+  // has to be destroyed and no other container shares their memory
+  void DestroyAll() noexcept {
+    if constexpr (std::is_trivially_destructible_v<Node> && requires { { alloc.try_release() } -> std::same_as<bool>; }) {
+      if (alloc.try_release()) {
+        return;
+      }
+    }
+    DestroySubtree(base->parent);
+  }
+
+  // Frees nodes in O(n) without recursion, relinking or rebalancing: the left child is
+  // rotated up until the current node has none, then the node is freed and we go right
+  void DestroySubtree(BaseNode* node) {
+    while (node != nullptr) {
+      if (node->left == nullptr) {
+        BaseNode* right = node->right;
+        DestroyNode(Data(node));
+        node = right;
+      } else {
+        BaseNode* left = node->left;
+        node->left = left->right;
+        left->right = node;
+        node = left;
+      }
+    }
+  }
+
+  // Takes the nodes of other along with its end() node, which this empty tree trades for its own
+  void StealNodes(RedBlackTree& other) noexcept {
+    std::swap(base, other.base);
+  }
+
+  static BaseNode* NewBase() {
+    BaseNode* base = new BaseNode;
+    *base = {nullptr, base, base, base};
+    return base;
+  }
+
+  // An empty tree's begin() and end() are its base; the first and last of linked nodes lead
+  // to it too
+  void RepointBase() noexcept {
+    if (base->parent == nullptr) {
+      *base = {nullptr, base, base, base};
+    } else if constexpr (kLinked) {
+      Link(base, base->left);
+      Link(base->right, base);
+    }
+  }
+
+  static void Link(BaseNode* before, BaseNode* after) noexcept {
+    before->links.next = after;
+    after->links.prev = before;
+  }
+
+  // The links between the nodes under root must be in order already, see RelinkAll
+  void AttachRoot(BaseNode* root) {
+    *base = {root, base, base, base};
+    if (root == nullptr) {
+      return;
+    }
+    root->parent = nullptr;
+    base->left = root;
+    base->right = root;
+    while (base->left->left != nullptr) {
+      base->left = base->left->left;
+    }
+    while (base->right->right != nullptr) {
+      base->right = base->right->right;
+    }
+    RepointBase();
+  }
+
+  // Links all nodes in order in O(n), after they were built, cloned or combined by shape
+  void RelinkAll() noexcept {
+    if constexpr (kLinked) {
+      BaseNode* previous = base;
+      for (BaseNode* node = base->parent == nullptr ? nullptr : base->left; node != nullptr; node = TreeNext(node)) {
+        Link(previous, node);
+        previous = node;
+      }
+      Link(previous, base);
+    }
+  }
+
+  // In-order successor by the tree's shape, nullptr after the last node
+  template <typename NodePointer>
+  static NodePointer TreeNext(NodePointer node) noexcept {
+    if (node->right != nullptr) {
+      node = node->right;
+      while (node->left != nullptr) {
+        node = node->left;
+      }
+      return node;
+    }
+    while (node->parent != nullptr && node->parent->right == node) {
+      node = node->parent;
+    }
+    return node->parent;
+  }
+
+  void AttachTree(BaseNode* root) { // AttachRoot for nodes whose links are stale
+    AttachRoot(root);
+    RelinkAll();
+  }
+
+  template <typename InputIt>
+  void AttachSorted(InputIt& it, std::size_t count) {
+    if (count > max_size()) {
+      throw std::length_error("RedBlackTree: subtree_size type is too narrow");
+    }
+    AttachTree(BuildSorted(it, count, 0, RedLevel(count)));
+  }
+
+  static constexpr char kSavedMagic[8] = {'R', 'B', 'T', 'R', 'E', 'E', '1', '\0'};
+
+  struct SavedHeader {
+    char magic[8];
+    std::uint64_t value_bytes;
+    std::uint64_t count;
+  };
+
+  // Input iterator for AttachSorted over saved values: reads them in blocks and checks the order
+  class SavedReader {
+   public:
+    SavedReader(std::istream& in, const Compare& compare, std::uint64_t count)
+        : in(in), compare(compare), remaining(count), block(std::allocator<ValueType>().allocate(kBlock)) {
+      try {
+        Fill();
+      } catch (...) {
+        std::allocator<ValueType>().deallocate(block, kBlock);
+        throw;
+      }
+    }
+
+    SavedReader(const SavedReader&) = delete;
+
+    SavedReader& operator=(const SavedReader&) = delete;
+
+    ~SavedReader() { std::allocator<ValueType>().deallocate(block, kBlock); }
+
+    const ValueType& operator*() const { return block[next]; }
+
+    SavedReader& operator++() {
+      if (++next == filled) {
+        Fill();
+      }
+      return *this;
+    }
+
+   private:
+    static constexpr std::size_t kBlock = 4096;
+
+    void Fill() {
+      std::size_t carried = filled == 0 ? 0 : 1; // the previous last value stays for the order check
+      if (filled > 1) {
+        std::memcpy(static_cast<void*>(block), static_cast<const void*>(block + filled - 1), sizeof(ValueType));
+      }
+      std::size_t count = std::min<std::uint64_t>(kBlock - carried, remaining);
+      if (count > 0 && !in.read(reinterpret_cast<char*>(block + carried), count * sizeof(ValueType))) {
+        throw std::runtime_error("RedBlackTree::load: unexpected end of input");
+      }
+      remaining -= count;
+      filled = carried + count;
+      next = carried;
+      for (std::size_t i = 1; i < filled; ++i) {
+        if (kMulti ? compare(block[i], block[i - 1]) : !compare(block[i - 1], block[i])) {
+          throw std::runtime_error("RedBlackTree::load: values are out of order");
+        }
+      }
+    }
+
+    std::istream& in;
+    const Compare& compare;
+    std::uint64_t remaining;
+    ValueType* block; // values are created by memcpy, which is allowed for trivially copyable types
+    std::size_t filled = 0;
+    std::size_t next = 0;
+  };
+
+  // Strictly, except with MultiTreePolicy where equal elements may follow each other
+  template <typename ForwardIt>
+  bool IsSortedForBuild(ForwardIt first, ForwardIt last) const {
+    return std::adjacent_find(first, last, [this](const auto& lhs, const auto& rhs) {
+      return kMulti ? compare(rhs, lhs) : !compare(lhs, rhs);
+    }) == last;
+  }
+
+  // Nodes at this depth are red, the rest black: only the incomplete last level
+  // of a tree built by BuildSorted lies on it
+  static std::size_t RedLevel(std::size_t count) {
+    std::size_t level = 0;
+    for (std::size_t m = count; m > 0; m = (m - 1) / 2) {
+      ++level;
+    }
+    return level;
+  }
+
+  // Consumes count elements of an increasing sequence and returns the root of a balanced subtree
+  template <typename InputIt>
+  BaseNode* BuildSorted(InputIt& it, std::size_t count, std::size_t level, std::size_t red_level) {
+    if (count == 0) {
+      return nullptr;
+    }
+    std::size_t left_count = (count - 1) / 2;
+    BaseNode* left = BuildSorted(it, left_count, level + 1, red_level);
+    Node* node = nullptr;
+    try {
+      node = CreateNode(nullptr, left, nullptr, *it);
+      ++it;
+      node->right = BuildSorted(it, count - left_count - 1, level + 1, red_level);
+    } catch (...) {
+      DestroySubtree(left);
+      if (node != nullptr) {
+        DestroyNode(node);
+      }
+      throw;
+    }
+    if (node->left != nullptr) {
+      node->left->parent = node;
+    }
+    if (node->right != nullptr) {
+      node->right->parent = node;
+    }
+    UpdateSize(node);
+    if constexpr (kWeakAvl) { // the rank is the height, which the count decides
+      SetRed(node, std::bit_width(count) % 2 == 0);
+    } else {
+      SetRed(node, level == red_level);
+    }
+    return node;
+  }
+
+  template <bool MoveValues = false>
+  BaseNode* CloneSubtree(BaseNode* source, BaseNode* parent) {
+    if (source == nullptr) {
+      return nullptr;
+    }
+    Node* data = Data(source);
+    Node* node;
+    if constexpr (MoveValues) {
+      node = CreateNode(parent, nullptr, nullptr, std::move(data->value));
+    } else {
+      node = CreateNode(parent, nullptr, nullptr, std::as_const(data->value));
+    }
+    try {
+      node->left = CloneSubtree<MoveValues>(source->left, node);
+      node->right = CloneSubtree<MoveValues>(source->right, node);
+    } catch (...) {
+      DestroySubtree(node);
+      throw;
+    }
+    node->subtree_size = data->subtree_size;
+    node->color = data->color;
+    node->aggregate = data->aggregate;
+    node->copies = data->copies;
+    return node;
+  }
+
+  void SizeUpdate(BaseNode* node) { // lifting to the root with updating
+    std::uint64_t steps = 0;
+    for (; node != nullptr; node = node->parent, ++steps) {
+      UpdateSize(node);
+    }
+    CountWalk(&TreeStats::size_updates, &TreeStats::size_update_steps, &TreeStats::longest_size_update, steps);
+  }
+
+  static void UpdateSize(BaseNode* node) {
+    SetSubtreeSize(node, SubtreeSize(node->left) + Copies(node) + SubtreeSize(node->right));
+    if constexpr (kAugmented) {
+      Data(node)->aggregate = Augmentation::combine(
+          Augmentation::combine(Aggregate(node->left), Augmentation::lift(Data(node)->value)), Aggregate(node->right));
+    }
+  }
+
+  // Black height (rank + 1) of a subtree that passes the checks of validate() except the order
+  static std::size_t ValidateSubtree(const BaseNode* node) {
+    if (node == nullptr) {
+      return 0;
+    }
+    for (const BaseNode* child : {node->left, node->right}) {
+      if (child != nullptr && child->parent != node) {
+        throw std::logic_error("RedBlackTree::validate: a child doesn't point to its parent");
+      }
+      if (!kWeakAvl && IsRed(node) && IsRed(child)) {
+        throw std::logic_error("RedBlackTree::validate: a red node has a red child");
+      }
+    }
+    std::size_t left_height = ValidateSubtree(node->left);
+    std::size_t right_height = ValidateSubtree(node->right);
+    if constexpr (kWeakAvl) { // the parities must give both children one rank
+      if (node->left == nullptr && node->right == nullptr && OddRank(node)) {
+        throw std::logic_error("RedBlackTree::validate: a leaf has a nonzero rank");
+      }
+      left_height += RankDifference(node, node->left);
+      right_height += RankDifference(node, node->right);
+    }
+    if (left_height != right_height) {
+      throw std::logic_error("RedBlackTree::validate: black heights (ranks) of siblings differ");
+    }
+    if (Copies(node) == 0 || SubtreeSize(node) != SubtreeSize(node->left) + Copies(node) + SubtreeSize(node->right)) {
+      throw std::logic_error("RedBlackTree::validate: wrong subtree_size");
+    }
+    if constexpr (kAugmented && std::equality_comparable<AggregateType>) {
+      const Node* data = static_cast<const Node*>(node);
+      if (!(data->aggregate == Augmentation::combine(Augmentation::combine(Aggregate(node->left), Augmentation::lift(data->value)),
+                                                     Aggregate(node->right)))) {
+        throw std::logic_error("RedBlackTree::validate: wrong aggregate");
+      }
+    }
+    if constexpr (kWeakAvl) {
+      return left_height;
+    }
+    return left_height + (IsRed(node) ? 0 : 1);
+  }
+
+  static AggregateType Aggregate(const BaseNode* node) requires kAugmented {
+    return node == nullptr ? Augmentation::identity() : static_cast<const Node*>(node)->aggregate;
+  }
+
+  // Aggregate of the elements at positions [first, last) of the subtree; below the node where
+  // the range splits, every step takes a whole subtree on one side, so O(log n) in total
+  static AggregateType RangeAggregate(const BaseNode* node, std::size_t first, std::size_t last) requires kAugmented {
+    if (node == nullptr || first >= last) {
+      return Augmentation::identity();
+    }
+    if (first == 0 && last >= SubtreeSize(node)) {
+      return Aggregate(node);
+    }
+    std::size_t left = SubtreeSize(node->left);
+    AggregateType result = RangeAggregate(node->left, first, std::min(last, left));
+    if (first <= left && left < last) {
+      result = Augmentation::combine(result, Augmentation::lift(static_cast<const Node*>(node)->value));
+    }
+    if (last > left + 1) {
+      result = Augmentation::combine(result, RangeAggregate(node->right, first > left + 1 ? first - left - 1 : 0,
+                                                            last - left - 1));
+    }
+    return result;
+  }
+
+  void RotateLeft(BaseNode* node) {  // From child to parent
+    if (node == nullptr || node == base->parent) {
+      return;
+    }
+    CountEvent(&TreeStats::rotations);
+    if (node->parent == base->parent) {
+      base->parent = node;
+    }
+    node->parent->right = node->left;
+    node->left = node->parent;
+    node->parent = node->left->parent;
+    if (node->parent != nullptr) {
+      if (node->parent->left == node->left) {
+        node->parent->left = node;
+      } else {
+        node->parent->right = node;
+      }
+    }
+    node->left->parent  = node;
+    if (node->left->right != nullptr) {
+      node->left->right->parent = node->left;
+    }
+    UpdateSize(node->left);
+    UpdateSize(node);
+  }
+
+  void RotateRight(BaseNode* node) {  // From child to parent
+    if (node == nullptr || node == base->parent) {
+      return;
+    }
+    CountEvent(&TreeStats::rotations);
+    if (node->parent == base->parent) {
+      base->parent = node;
+    }
+    node->parent->left = node->right;
+    node->right = node->parent;
     node->parent = node->right->parent;
-    if (node->parent != &base) {
+    if (node->parent != nullptr) {
       if (node->parent->right == node->right) {
         node->parent->right = node;
       } else {
@@ -371,312 +1717,1174 @@ class RedBlackTree {
       }
     }
     node->right->parent  = node;
-    if (node->right->left != &base) {
+    if (node->right->left != nullptr) {
       node->right->left->parent = node->right;
     }
-    Data(node->right)->subtree_size = SubtreeSize(node->right->left) + 1 + SubtreeSize(node->right->right);
-    Data(node)->subtree_size = SubtreeSize(node->left) + 1 + SubtreeSize(node->right);
+    UpdateSize(node->right);
+    UpdateSize(node);
+  }
+
+  void InsertRepair(Node* node) {
+    std::uint64_t cascade = 0;
+    while (node != nullptr) {
+      if (IsRed(node) && node == base->parent) {
+        SetRed(node, false);
+      } else if (IsRed(node) && node->parent != nullptr &&
+                 IsRed(node->parent)) {  // Если требуется исправление (две
+                                          // красные вершины)
+        if (node->parent->parent != nullptr && node->parent->parent->left ==
+            node->parent) {  // Если родитель слева от деда
+          if (IsRed(node->parent->parent->right)) {  // Случай 1 (дядя красный)
+            SetRed(node->parent, false);
+            SetRed(node->parent->parent, true);
+            SetRed(node->parent->parent->right, false);
+            node = Data(node->parent->parent); // the grandparent may now clash with its parent
+            ++cascade;
+            continue;
+          } else {  // Случай 2 (дядя чёрный)
+            if (node->parent->left ==
+                node) {  // Случай 2.1 (node тоже слева от родителя)
+              RotateRight(node->parent);
+              SetRed(node->parent, false);
+              SetRed(node->parent->right, true);
+            } else {  // Случай 2.2 (node справа от родителя)
+              RotateLeft(node);
+              RotateRight(node);
+              SetRed(node, false);
+              SetRed(node->right, true);
+            }
+          }
+        } else if (node->parent->parent != nullptr) {  // Родитель справа от деда
+          if (IsRed(node->parent->parent->left)) {  // Случай 1 (дядя красный)
+            SetRed(node->parent, false);
+            SetRed(node->parent->parent, true);
+            SetRed(node->parent->parent->left, false);
+            node = Data(node->parent->parent); // the grandparent may now clash with its parent
+            ++cascade;
+            continue;
+          } else {  // Случай 2 (дядя чёрный)
+            if (node->parent->right ==
+                node) {  // Случай 2.1 (node тоже справа от родителя)
+              RotateLeft(node->parent);
+              SetRed(node->parent, false);
+              SetRed(node->parent->left, true);
+            } else {  // Случай 2.2 (node слева от родителя)
+              RotateRight(node);
+              RotateLeft(node);
+              SetRed(node, false);
+              SetRed(node->left, true);
+            }
+          }
+        }
+      }
+      break;
+    }
+    CountWalk(&TreeStats::insert_repairs, &TreeStats::recolor_steps, &TreeStats::longest_recolor_cascade, cascade);
   }
 
-  void InsertRepair(Node* node) {
-    if (node == &base) {
-      return;
+  void RotateUp(BaseNode* node) {
+    if (node->parent->right == node) {
+      RotateLeft(node);
+    } else {
+      RotateRight(node);
     }
-    if (node->is_red && node == base.parent) {
-      node->is_red = false;
-    } else if (node->is_red && node->parent != &base &&
-               Data(node->parent)->is_red) {  // Если требуется исправление (две
-                                        // красные вершины)
-      if (node->parent->parent != &base && node->parent->parent->left ==
-          node->parent) {  // Если родитель слева от деда
-        if (node->parent->parent->right != &base && Data(node->parent->parent->right)->is_red) {  // Случай 1 (дядя красный)
-          Data(node->parent)->is_red = false;
-          Data(node->parent->parent)->is_red = true;
-          Data(node->parent->parent->right)->is_red = false;
-          InsertRepair(Data(node->parent->parent));
-        } else {  // Случай 2 (дядя чёрный)
-          if (node->parent->left ==
-              node) {  // Случай 2.1 (node тоже слева от родителя)
-            RotateRight(node->parent);
-            Data(node->parent)->is_red = false;
-            Data(node->parent->right)->is_red = true;
-          } else {  // Случай 2.2 (node справа от родителя)
-            RotateLeft(node);
-            RotateRight(node);
-            node->is_red = false;
-            Data(node->right)->is_red = true;
-          }
-        }
-      } else if (node->parent->parent != &base) {  // Родитель справа от деда
-        if (node->parent->parent->left != &base && Data(node->parent->parent->left)->is_red) {  // Случай 1 (дядя красный)
-          Data(node->parent)->is_red = false;
-          Data(node->parent->parent)->is_red = true;
-          Data(node->parent->parent->left)->is_red = false;
-          InsertRepair(Data(node->parent->parent));
-        } else {  // Случай 2 (дядя чёрный)
-          if (node->parent->right ==
-              node) {  // Случай 2.1 (node тоже справа от родителя)
-            RotateLeft(node->parent);
-            Data(node->parent)->is_red = false;
-            Data(node->parent->left)->is_red = true;
-          } else {  // Случай 2.2 (node слева от родителя)
-            RotateRight(node);
-            RotateLeft(node);
-            node->is_red = false;
-            Data(node->left)->is_red = true;
-          }
-        }
+  }
+
+  // Weak AVL repair of node, a 0-child after it was inserted or promoted: its rank and its
+  // parent's differ by 0 or 1, so equal parities mean 0
+  void RankInsertRepair(BaseNode* node) {
+    std::uint64_t promotions = 0;
+    while (node->parent != nullptr && OddRank(node) == OddRank(node->parent)) {
+      BaseNode* parent = node->parent;
+      bool right = parent->right == node;
+      if (RankDifference(parent, ChildLink(parent, !right)) == 1) { // the parent is 0,1: promote it
+        StepRank(parent);
+        node = parent;
+        ++promotions;
+        continue;
+      }
+      BaseNode* inner = ChildLink(node, !right);
+      if (RankDifference(node, inner) == 2) { // the parent is 0,2 and node 1,2 facing away
+        RotateUp(node);
+        StepRank(parent);
+      } else if (RankDifference(node, ChildLink(node, right)) == 2) { // node is 2,1 facing the sibling
+        RotateUp(inner);
+        RotateUp(inner);
+        StepRank(inner);
+        StepRank(node);
+        StepRank(parent);
+      } else { // node is 1,1, only after a join: it climbs a level and may be a 0-child again
+        RotateUp(node);
+        StepRank(node);
+        ++promotions;
+        continue;
       }
+      break;
     }
+    CountWalk(&TreeStats::insert_repairs, &TreeStats::recolor_steps, &TreeStats::longest_recolor_cascade, promotions);
+  }
+
+  template <typename V>
+  static const V& InsertedValue(const V& value) {
+    return value;
+  }
+
+  static const ValueType& InsertedValue(const Detached& detached) {
+    return detached.node->value;
   }
 
   template <typename V>
-  std::pair<iterator, bool> InsertImpl(Node* node, V&& value) {
-    if (compare(node->value, value)) {
-      if (node->right == &base) {
-        node->right = CreateNode(node, &base, &base, std::forward<V>(value));
-        if (base.right == node) {
-          base.right = node->right;
+  std::pair<iterator, bool> InsertImpl(Node* node, V&& inserted) {
+    const auto& value = InsertedValue(inserted);
+    while (true) {
+      if (Less(node->value, value) || (kMulti && !Less(value, node->value))) { // equal ones go right
+        if (node->right == nullptr) {
+          return {AttachLeaf(node, false, std::forward<V>(inserted)), true};
+        }
+        node = Data(node->right);
+      } else if (Less(value, node->value)) {
+        if (node->left == nullptr) {
+          return {AttachLeaf(node, true, std::forward<V>(inserted)), true};
         }
-        iterator inserted(node->right, &base);
-        SizeUpdate(node->right);
-        InsertRepair(Data(node->right));
-        return {inserted, true};
-      }
-      return InsertImpl(Data(node->right), value);
-    }
-    if (compare(value, node->value)) {
-      if (node->left == &base) {
-        node->left = CreateNode(node, &base, &base, std::forward<V>(value));
-        if (base.left == node) {
-          base.left = node->left;
+        node = Data(node->left);
+      } else if constexpr (kCounted) {
+        if constexpr (std::is_same_v<std::remove_cvref_t<V>, Detached>) {
+          return {AddCopy(node, inserted.node->copies), true};
+        } else {
+          return {AddCopy(node), true};
         }
-        iterator inserted(node->left, &base);
-        SizeUpdate(node->left);
-        InsertRepair(Data(node->left));
-        return {inserted, true};
+      } else {
+        return {iterator(node, base), false};
       }
-      return InsertImpl(Data(node->left), value);
     }
-    return {iterator(node, &base), false};
   }
 
+  iterator AddCopy(Node* node, std::size_t copies = 1) requires kCounted {
+    if (max_size() - size() < copies) {
+      throw std::length_error("RedBlackTree: subtree_size type is too narrow");
+    }
+    node->copies += static_cast<SizeType>(copies);
+    SizeUpdate(node);
+    return iterator(node, base);
+  }
+
+  // A new leaf under parent, red or of rank 0: value in a new node, or the node of a handle
   template <typename V>
-  iterator FindImpl(Node* node, V&& value) {
-    if (node == &base) {
-      return end();
+  Node* NewLeaf(BaseNode* parent, V&& value) {
+    Node* node;
+    if constexpr (std::is_same_v<std::remove_cvref_t<V>, Detached>) {
+      if (max_size() - size() < Copies(value.node)) {
+        throw std::length_error("RedBlackTree: subtree_size type is too narrow");
+      }
+      node = value.node;
+      node->parent = parent;
+      node->left = nullptr;
+      node->right = nullptr;
+      SetSubtreeSize(node, Copies(node));
+    } else {
+      node = CreateNode(parent, nullptr, nullptr, std::forward<V>(value));
+    }
+    SetRed(node, !kWeakAvl);
+    return node;
+  }
+
+  template <typename V> // the chosen child of parent must be empty
+  iterator AttachLeaf(BaseNode* parent, bool as_left, V&& value) {
+    Node* node = NewLeaf(parent, std::forward<V>(value));
+    if constexpr (kLinked) { // between parent and its neighbour on that side
+      if (as_left) {
+        Link(parent->links.prev, node);
+        Link(node, parent);
+      } else {
+        Link(node, parent->links.next);
+        Link(parent, node);
+      }
+    }
+    if (as_left) {
+      parent->left = node;
+      if (base->left == parent) {
+        base->left = node;
+      }
+    } else {
+      parent->right = node;
+      if (base->right == parent) {
+        base->right = node;
+      }
+    }
+    SizeUpdate(node);
+    if constexpr (kWeakAvl) {
+      RankInsertRepair(node);
+    } else {
+      InsertRepair(node);
+    }
+    return iterator(node, base);
+  }
+
+  static constexpr bool kTransparent = requires { typename Compare::is_transparent; };
+
+  // A Compare that is not transparent may still order values against one key type, named
+  // by Compare::key_type (RedBlackTreeMap's does); other keys are converted to that type
+  template <typename C>
+  struct LookupTypeOf {
+    using type = ValueType;
+  };
+
+  template <typename C>
+    requires requires { typename C::key_type; }
+  struct LookupTypeOf<C> {
+    using type = typename C::key_type;
+  };
+
+  using LookupType = typename LookupTypeOf<Compare>::type;
+
+  // Without a transparent Compare every comparison would convert a value of another type
+  // to ValueType, so insert() converts it once before the descent
+  template <typename V>
+  static constexpr bool kConvertOnInsert = !kTransparent && !std::is_same_v<std::remove_cvref_t<V>, ValueType> &&
+                                           !std::is_same_v<std::remove_cvref_t<V>, Detached>;
+
+  template <typename K>
+  static decltype(auto) LookupKey(const K& key) {
+    if constexpr (kTransparent || std::is_same_v<K, ValueType> || std::is_same_v<K, LookupType>) {
+      return (key);
+    } else {
+      return LookupType(key);
     }
-    if (compare(node->value, value)) {
-      return FindImpl(Data(node->right), std::forward<V>(value));
+  }
+
+  // The bound searches make one comparison per level
+
+  template <typename K>
+  BaseNode* LowerBoundImpl(const K& key) {
+    BaseNode* bound = base;
+    for (BaseNode* node = base->parent; node != nullptr;) {
+      if (Less(Data(node)->value, key)) {
+        node = node->right;
+      } else {
+        bound = node;
+        node = node->left;
+      }
+    }
+    return bound;
+  }
+
+  template <typename K>
+  BaseNode* UpperBoundImpl(const K& key) {
+    BaseNode* bound = base;
+    for (BaseNode* node = base->parent; node != nullptr;) {
+      if (Less(key, Data(node)->value)) {
+        bound = node;
+        node = node->left;
+      } else {
+        node = node->right;
+      }
+    }
+    return bound;
+  }
+
+  template <typename K> // last element less than key
+  BaseNode* LessThanImpl(const K& key) {
+    BaseNode* bound = base;
+    for (BaseNode* node = base->parent; node != nullptr;) {
+      if (Less(Data(node)->value, key)) {
+        bound = node;
+        node = node->right;
+      } else {
+        node = node->left;
+      }
     }
-    if (compare(value, node->value)) {
-      return FindImpl(Data(node->left), std::forward<V>(value));
+    return bound;
+  }
+
+  template <typename K>
+  iterator FindImpl(const K& key) {
+    BaseNode* bound = LowerBoundImpl(key);
+    if (bound != base && Less(key, Data(bound)->value)) {
+      bound = base;
     }
-    return iterator(node, &base);
+    return iterator(bound, base);
   }
 
   void CaseRedParent(Node* node) {
     if (node->parent->left != node) {
       // Случай 2.1.1.L (У левого ребёнка корня есть красный сын)
-      if (node->parent->left->right != &base && Data(node->parent->left->right)->is_red) {
+      if (IsRed(node->parent->left->right)) {
         RotateLeft(node->parent->left->right);
         RotateRight(node->parent->left);
-        Data(node->parent)->is_red = false;
-      } else if (node->parent->left->left != &base && Data(node->parent->left->left)->is_red) {
+        SetRed(node->parent, false);
+      } else if (IsRed(node->parent->left->left)) {
         RotateRight(node->parent->left);
       } else {  // Случай 2.1.2.L (у левого ребёнка корня нет красных сыновей)
-        Data(node->parent)->is_red = false;
-        Data(node->parent->left)->is_red = true;
+        SetRed(node->parent, false);
+        SetRed(node->parent->left, true);
       }
     } else {  // Случай 2.1.1.R (У правого ребёнка корня есть красный сын)
-      if (node->parent->right->left != &base && Data(node->parent->right->left)->is_red) {
+      if (IsRed(node->parent->right->left)) {
         RotateRight(node->parent->right->left);
         RotateLeft(node->parent->right);
-        Data(node->parent)->is_red = false;
-      } else if (node->parent->right->right != &base && Data(node->parent->right->right)->is_red) {
+        SetRed(node->parent, false);
+      } else if (IsRed(node->parent->right->right)) {
         RotateLeft(node->parent->right);
       } else {  // Случай 2.1.2.R (у правого ребёнка корня нет красных
                 // сыновей)
-        Data(node->parent)->is_red = false;
-        Data(node->parent->right)->is_red = true;
+        SetRed(node->parent, false);
+        SetRed(node->parent->right, true);
       }
     }
   }
 
-  void CaseBlackParent(Node* node) {
+  Node* CaseBlackParent(Node* node) { // returns the node that still lacks black depth, if any
     if (node->parent->left != node) {  // Случай 2.2.L (Брат слева)
-      if (node->parent->left != &base && Data(node->parent->left)->is_red) {  // Случай 2.2.L.1 (Брат красный)
+      if (IsRed(node->parent->left)) {  // Случай 2.2.L.1 (Брат красный)
         // Cлучай 2.2.L.1.1 (У сына брата есть красный сын)
-        if (node->parent->left->right->left != &base && Data(node->parent->left->right->left)->is_red ||
-            node->parent->left->right->right != &base && Data(node->parent->left->right->right)->is_red) {
-          if (node->parent->left->right->right != &base && Data(node->parent->left->right->right)->is_red) {
+        if (IsRed(node->parent->left->right->left) ||
+            IsRed(node->parent->left->right->right)) {
+          if (IsRed(node->parent->left->right->right)) {
             RotateLeft(node->parent->left->right->right);
-            Data(node->parent->left->right)->is_red = false;
-            Data(node->parent->left->right->left)->is_red = true;
+            SetRed(node->parent->left->right, false);
+            SetRed(node->parent->left->right->left, true);
           }
           RotateLeft(node->parent->left->right);
           RotateRight(node->parent->left);
-          Data(node->parent->parent->left->right)->is_red = false;
+          SetRed(node->parent->parent->left->right, false);
         } else {  // Случай 2.2.L.1.2 (У сына брата нет красных сыновей)
           RotateRight(node->parent->left);
-          Data(node->parent->left)->is_red = true;
-          Data(node->parent->parent)->is_red = false;
+          SetRed(node->parent->left, true);
+          SetRed(node->parent->parent, false);
         }
       } else {  // Случай 2.2.L.2 (Брат чёрный)
         // Случай 2.2.L.2.1 (У брата есть красные сыновья)
-        if (node->parent->left->left != &base && Data(node->parent->left->left)->is_red) {
+        if (IsRed(node->parent->left->left)) {
           RotateRight(node->parent->left);
-          Data(node->parent->parent->left)->is_red = false;
-        } else if (node->parent->left->right != &base && Data(node->parent->left->right)->is_red) {
+          SetRed(node->parent->parent->left, false);
+        } else if (IsRed(node->parent->left->right)) {
           RotateLeft(node->parent->left->right);
           RotateRight(node->parent->left);
-          Data(node->parent->parent)->is_red = false;
+          SetRed(node->parent->parent, false);
         } else {  // Случай 2.2.L.2.2 (У брата нет красных сыновей)
-          Data(node->parent->left)->is_red = true;
-          Case2(Data(node->parent));
+          SetRed(node->parent->left, true);
+          return Data(node->parent);
         }
       }
     } else {  // Случай 2.2.R (Брат справа)
-      if (node->parent->right != &base && Data(node->parent->right)->is_red) {  // Случай 2.2.R.1 (Брат красный)
+      if (IsRed(node->parent->right)) {  // Случай 2.2.R.1 (Брат красный)
         // Cлучай 2.2.R.1.1 (У сына брата есть красный сын)
-        if (node->parent->right->left->left != &base && Data(node->parent->right->left->left)->is_red ||
-            node->parent->right->left->right != &base && Data(node->parent->right->left->right)->is_red) {
-          if (node->parent->right->left->left != &base && Data(node->parent->right->left->left)->is_red) {
+        if (IsRed(node->parent->right->left->left) ||
+            IsRed(node->parent->right->left->right)) {
+          if (IsRed(node->parent->right->left->left)) {
             RotateRight(node->parent->right->left->left);
-            Data(node->parent->right->left)->is_red = false;
-            Data(node->parent->right->left->right)->is_red = true;
+            SetRed(node->parent->right->left, false);
+            SetRed(node->parent->right->left->right, true);
           }
           RotateRight(node->parent->right->left);
           RotateLeft(node->parent->right);
-          Data(node->parent->parent->right->left)->is_red = false;
+          SetRed(node->parent->parent->right->left, false);
         } else {  // Случай 2.2.R.1.2 (У сына брата нет красных сыновей)
           RotateLeft(node->parent->right);
-          Data(node->parent->right)->is_red = true;
-          Data(node->parent->parent)->is_red = false;
+          SetRed(node->parent->right, true);
+          SetRed(node->parent->parent, false);
         }
       } else {  // Случай 2.2.R.2 (Брат чёрный)
         // Случай 2.2.R.2.1 (У брата есть красные сыновья)
-        if (node->parent->right->right != &base && Data(node->parent->right->right)->is_red) {
+        if (IsRed(node->parent->right->right)) {
           RotateLeft(node->parent->right);
-          Data(node->parent->parent->right)->is_red = false;
-        } else if (node->parent->right->left != &base && Data(node->parent->right->left)->is_red) {
+          SetRed(node->parent->parent->right, false);
+        } else if (IsRed(node->parent->right->left)) {
           RotateRight(node->parent->right->left);
           RotateLeft(node->parent->right);
-          Data(node->parent->parent)->is_red = false;
+          SetRed(node->parent->parent, false);
         } else {  // Случай 2.2.R.2.2 (У брата нет красных сыновей)
-          Data(node->parent->right)->is_red = true;
-          Case2(Data(node->parent));
+          SetRed(node->parent->right, true);
+          return Data(node->parent);
         }
       }
     }
+    return nullptr;
   }
 
   void Case2(Node* node) {  // Починка чёрной глубины
-    if (node->parent == &base) {
-      return;
+    std::uint64_t depth = 0;
+    for (; node != nullptr && node->parent != nullptr; ++depth) {
+      if (IsRed(node->parent)) {  // Случай 2.1 (родитель красный)
+        CaseRedParent(node);
+        ++depth;
+        break;
+      }
+      node = CaseBlackParent(node);  // Cлучай 2.2 (родитель чёрный)
+    }
+    CountWalk(&TreeStats::delete_repairs, &TreeStats::delete_repair_steps, &TreeStats::deepest_delete_repair, depth);
+  }
+
+  // Puts successor, the leftmost node of the right subtree of node, in the place of node and
+  // node in its place. The color, subtree_size and aggregate stay with the places; those
+  // between them are stale until the path is updated. Values don't move.
+  void SwapWithSuccessor(Node* node, Node* successor) {
+    BaseNode* parent = node->parent;
+    BaseNode* successor_parent = successor->parent;
+    BaseNode* successor_right = successor->right;
+    if (parent == nullptr) {
+      base->parent = successor;
+    } else {
+      ChildLink(parent, parent->right == node) = successor;
+    }
+    successor->parent = parent;
+    successor->left = node->left;
+    successor->left->parent = successor;
+    if (successor_parent == node) {
+      successor->right = node;
+      node->parent = successor;
+    } else {
+      successor->right = node->right;
+      successor->right->parent = successor;
+      successor_parent->left = node;
+      node->parent = successor_parent;
     }
-    if (Data(node->parent)->is_red) {  // Случай 2.1 (родитель красный)
-      CaseRedParent(node);
-    } else {  // Cлучай 2.2 (родитель чёрный)
-      CaseBlackParent(node);
+    node->left = nullptr;
+    node->right = successor_right;
+    if (successor_right != nullptr) {
+      successor_right->parent = node;
     }
+    std::swap(node->subtree_size, successor->subtree_size);
+    std::swap(node->color, successor->color);
+    std::swap(node->aggregate, successor->aggregate);
   }
 
   void DeleteLogic(Node* node) {
-    if (node->left == &base && node->right == &base) {  // Оба сына пустые
-      if (!node->is_red) {
-        Case2(node);
-      }
-      BaseNode* parent = node->parent;
-      RemoveNode(node);
-      SizeUpdate(parent);
-    } else if (node->left == &base ||
-               node->right == &base) {  // Случай 3 (только один обычный сын)
-      if (node->left != &base && Data(node->left)->is_red) {
-        RotateRight(node->left);
-        node->is_red = true;
-        Data(node->parent)->is_red = false;
-        DeleteLogic(node);
-      } else {
-        RotateLeft(node->right);
-        node->is_red = true;
-        Data(node->parent)->is_red = false;
-        DeleteLogic(node);
+    DetachNode(node);
+    DestroyNode(node);
+  }
+
+  // Unlinks node from the tree and rebalances it; the other nodes keep their values
+  void DetachNode(Node* node) {
+    if constexpr (kWeakAvl) {
+      RankDetach(node);
+      return;
+    }
+    while (node->left != nullptr || node->right != nullptr) {
+      if (node->left == nullptr ||
+          node->right == nullptr) {  // Случай 3 (только один обычный сын)
+        if (IsRed(node->left)) {
+          RotateRight(node->left);
+        } else {
+          RotateLeft(node->right);
+        }
+        SetRed(node, true);
+        SetRed(node->parent, false);
+      } else {  // Оба сына обычные
+        BaseNode* right_min = node->right;
+        while (right_min->left != nullptr) {
+          right_min = right_min->left;
+        }
+        SwapWithSuccessor(node, Data(right_min));
       }
-    } else {  // Оба сына обычные
+    }
+    // Оба сына пустые
+    if (!IsRed(node)) {
+      Case2(node);
+    }
+    BaseNode* parent = node->parent;
+    DetachLeaf(node);
+    SizeUpdate(parent);
+  }
+
+  // Weak AVL removal: node loses its place to its only child, if any, and the ranks are
+  // repaired upwards from its parent by demotions and at most two rotations
+  void RankDetach(Node* node) {
+    if (node->left != nullptr && node->right != nullptr) {
       BaseNode* right_min = node->right;
-      while (right_min->left != &base) {
+      while (right_min->left != nullptr) {
         right_min = right_min->left;
       }
-      std::swap(Data(right_min)->value, node->value);
-      DeleteLogic(Data(right_min));
+      SwapWithSuccessor(node, Data(right_min));
+    }
+    if constexpr (kLinked) {
+      Link(node->links.prev, node->links.next);
+    }
+    BaseNode* child = node->left != nullptr ? node->left : node->right; // a leaf if any
+    BaseNode* parent = node->parent;
+    bool right = parent != nullptr && parent->right == node;
+    if (child != nullptr) {
+      child->parent = parent;
+    }
+    if (parent == nullptr) {
+      base->parent = child;
+    } else {
+      ChildLink(parent, right) = child;
+    }
+    BaseNode* replacement = child != nullptr ? child : parent != nullptr ? parent : base;
+    if (base->left == node) {
+      base->left = replacement;
+    }
+    if (base->right == node) {
+      base->right = replacement;
+    }
+    SizeUpdate(parent);
+
+    // The empty or shrunk side is now a 2- or 3-child; equal parities mean 2
+    std::uint64_t demotions = 0;
+    if (parent != nullptr && parent->left == nullptr && parent->right == nullptr) { // a leaf of rank 1
+      StepRank(parent);
+      ++demotions;
+      child = parent;
+      parent = child->parent;
+      right = parent != nullptr && parent->right == child;
+    }
+    while (parent != nullptr && OddRank(parent) != OddRank(child)) {
+      BaseNode* sibling = ChildLink(parent, !right);
+      bool climb = true;
+      if (RankDifference(parent, sibling) == 2) { // the parent is 3,2: demote it
+        StepRank(parent);
+      } else {
+        BaseNode* outer = ChildLink(sibling, !right);
+        BaseNode* inner = ChildLink(sibling, right);
+        if (RankDifference(sibling, outer) == 2 && RankDifference(sibling, inner) == 2) { // demote both
+          StepRank(parent);
+          StepRank(sibling);
+        } else if (RankDifference(sibling, outer) == 1) {
+          RotateUp(sibling);
+          StepRank(sibling);
+          if (parent->left != nullptr || parent->right != nullptr) { // otherwise demoted twice to a leaf
+            StepRank(parent);
+          }
+          climb = false;
+        } else { // promoted twice, the others demoted once and twice
+          RotateUp(inner);
+          RotateUp(inner);
+          StepRank(sibling);
+          climb = false;
+        }
+      }
+      if (!climb) {
+        break;
+      }
+      ++demotions;
+      child = parent;
+      parent = child->parent;
+      right = parent != nullptr && parent->right == child;
     }
+    CountWalk(&TreeStats::delete_repairs, &TreeStats::delete_repair_steps, &TreeStats::deepest_delete_repair, demotions);
   }
 
-  template <typename V>
-  std::size_t EraseImpl(Node* node, V&& value) {
-    if (node == &base) {
+  template <typename K>
+  std::size_t EraseImpl(const K& key) {
+    if constexpr (kMulti) {
+      iterator first(LowerBoundImpl(key), base);
+      iterator last(UpperBoundImpl(key), base);
+      std::size_t erased = rank(last) - rank(first);
+      if (erased == 1) {
+        DeleteLogic(Data(first.node));
+      } else if (erased > 1) {
+        erase(first, last);
+      }
+      return erased;
+    }
+    iterator found = FindImpl(key);
+    if (found == end()) {
       return 0;
     }
-    if (compare(node->value, value)) {
-      return EraseImpl(Data(node->right), std::forward<V>(value));
+    std::size_t erased = Copies(found.node);
+    DeleteLogic(Data(found.node));
+    return erased;
+  }
+
+  // Split and join work on detached subtrees ("pieces") with black roots (in a weak AVL tree
+  // any root). base->parent is null meanwhile, so rotations and the insert repairs leave base
+  // alone and a red root stays red.
+  struct Piece {
+    BaseNode* root = nullptr;
+    std::size_t height = 0; // black nodes on a path from root down to an empty child, or rank + 1
+  };
+
+  struct SplitResult {
+    Piece lower;
+    BaseNode* equal = nullptr; // detached node equal to the key, if any
+    Piece upper;
+  };
+
+  static std::size_t BlackHeight(const BaseNode* node) {
+    std::size_t height = 0;
+    for (; node != nullptr; node = node->left) {
+      height += IsRed(node) ? 0 : 1;
+    }
+    return height;
+  }
+
+  static std::size_t RankHeight(const BaseNode* node) { // rank + 1, 0 for an empty tree
+    std::size_t height = 0;
+    for (; node != nullptr; node = node->left) {
+      height += RankDifference(node, node->left);
+    }
+    return height;
+  }
+
+  static BaseNode*& ChildLink(BaseNode* node, bool right) {
+    return right ? node->right : node->left;
+  }
+
+  // Child of the root of a piece with the given height, detached as a piece
+  static Piece DetachChild(BaseNode* parent, BaseNode* child, std::size_t height) {
+    if constexpr (kWeakAvl) {
+      if (child != nullptr) {
+        child->parent = nullptr;
+      }
+      return {child, height - RankDifference(parent, child)};
+    }
+    if (child == nullptr) {
+      return {nullptr, height - 1};
     }
-    if (compare(value, node->value)) {
-      return EraseImpl(Data(node->left), std::forward<V>(value));
+    child->parent = nullptr;
+    if (IsRed(child)) {
+      SetRed(child, false);
+      return {child, height};
     }
-    
-    DeleteLogic(node);
-    return 1;
+    return {child, height - 1};
+  }
+
+  Piece TakeRoot() {
+    BaseNode* root = base->parent;
+    *base = {nullptr, base, base, base};
+    if constexpr (kWeakAvl) {
+      return {root, RankHeight(root)};
+    }
+    if (root != nullptr) {
+      SetRed(root, false);
+    }
+    return {root, BlackHeight(root)};
+  }
+
+  // Links lower < middle < upper into one piece in O(|difference of black heights| + 1):
+  // middle is hung red on the spine of the taller piece where black heights match
+  Piece Join(Piece lower, BaseNode* middle, Piece upper) {
+    if constexpr (kWeakAvl) {
+      return RankJoin(lower, middle, upper);
+    }
+    bool descend_right = lower.height >= upper.height;
+    Piece tall = descend_right ? lower : upper;
+    Piece low = descend_right ? upper : lower;
+    BaseNode* parent = nullptr;
+    BaseNode* node = tall.root;
+    std::size_t height = tall.height;
+    while (IsRed(node) || height > low.height) {
+      height -= IsRed(node) ? 0 : 1;
+      parent = node;
+      node = ChildLink(node, descend_right);
+    }
+    ChildLink(middle, !descend_right) = node;
+    ChildLink(middle, descend_right) = low.root;
+    middle->parent = parent;
+    if (node != nullptr) {
+      node->parent = middle;
+    }
+    if (low.root != nullptr) {
+      low.root->parent = middle;
+    }
+    UpdateSize(middle);
+    if (parent == nullptr) {
+      SetRed(middle, false);
+      return {middle, height + 1};
+    }
+    ChildLink(parent, descend_right) = middle;
+    SetRed(middle, true);
+    SizeUpdate(parent);
+    InsertRepair(Data(middle));
+    BaseNode* root = tall.root;
+    while (root->parent != nullptr) {
+      root = root->parent;
+    }
+    if (IsRed(root)) { // recolored by InsertRepair, the tree grew by a black level
+      SetRed(root, false);
+      return {root, tall.height + 1};
+    }
+    return {root, tall.height};
+  }
+
+  // Weak AVL join: middle goes on the spine of the taller piece above the first node at most
+  // one rank above the lower piece, with a rank that makes both its children 1- or 2-children
+  Piece RankJoin(Piece lower, BaseNode* middle, Piece upper) {
+    bool descend_right = lower.height >= upper.height;
+    Piece tall = descend_right ? lower : upper;
+    Piece low = descend_right ? upper : lower;
+    BaseNode* parent = nullptr;
+    BaseNode* node = tall.root;
+    std::size_t height = tall.height;
+    while (height > low.height + 1) {
+      parent = node;
+      node = ChildLink(node, descend_right);
+      height -= RankDifference(parent, node);
+    }
+    ChildLink(middle, !descend_right) = node;
+    ChildLink(middle, descend_right) = low.root;
+    middle->parent = parent;
+    if (node != nullptr) {
+      node->parent = middle;
+    }
+    if (low.root != nullptr) {
+      low.root->parent = middle;
+    }
+    std::size_t middle_height = std::max(height, low.height) + 1;
+    SetRed(middle, middle_height % 2 == 0);
+    UpdateSize(middle);
+    if (parent == nullptr) {
+      return {middle, middle_height};
+    }
+    ChildLink(parent, descend_right) = middle;
+    SizeUpdate(parent);
+    RankInsertRepair(middle);
+    BaseNode* root = tall.root;
+    while (root->parent != nullptr) {
+      root = root->parent;
+    }
+    // The repair raises the rank of the top by one at most; parity tells if it did
+    return {root, OddRank(root) == (tall.height % 2 == 0) ? tall.height : tall.height + 1};
+  }
+
+  Piece Join(Piece lower, Piece upper) {
+    if (lower.root == nullptr) {
+      return upper;
+    }
+    if (upper.root == nullptr) {
+      return lower;
+    }
+    auto [first, rest] = SplitFirst(upper);
+    return Join(lower, first, rest);
   }
 
-  BaseNode* ChoiceLessOrGreater(BaseNode* prev_node, BaseNode* new_node, bool greater) const {
-    if (prev_node == &base) {
-      return new_node;
+  std::pair<BaseNode*, Piece> SplitFirst(Piece piece) {
+    BaseNode* root = piece.root;
+    Piece left = DetachChild(root, root->left, piece.height);
+    Piece right = DetachChild(root, root->right, piece.height);
+    if (left.root == nullptr) {
+      return {root, right};
     }
-    if (compare(Data(prev_node)->value, Data(new_node)->value)) {
-      if (greater) {
-        return prev_node;
+    auto [first, rest] = SplitFirst(left);
+    return {first, Join(rest, root, right)};
+  }
+
+  // The turns of a search for a key from the root of a piece. All comparisons are made
+  // before anything is cut, so a throwing Compare leaves the piece whole.
+  struct SplitPath {
+    std::bitset<2 * std::numeric_limits<std::size_t>::digits> right; // at each depth, the key is greater
+    std::size_t depth = 0; // where the search ends, at a node equal to the key or an empty child
+  };
+
+  template <typename K>
+  SplitPath FindSplit(BaseNode* node, const K& key) {
+    SplitPath path;
+    while (node != nullptr) {
+      bool right = Less(Data(node)->value, key);
+      if (!right && !Less(key, Data(node)->value)) {
+        break;
       }
-      return new_node;
+      path.right[path.depth++] = right;
+      node = right ? node->right : node->left;
+    }
+    return path;
+  }
+
+  template <typename K>
+  SplitResult Split(Piece piece, const K& key) {
+    SplitPath path = FindSplit(piece.root, key);
+    return SplitAlong(piece, path);
+  }
+
+  // Every join on the way up costs the difference of neighbouring black heights, O(log n) in total
+  SplitResult SplitAlong(Piece piece, const SplitPath& path, std::size_t depth = 0) {
+    BaseNode* root = piece.root;
+    if (root == nullptr) {
+      return {};
+    }
+    Piece left = DetachChild(root, root->left, piece.height);
+    Piece right = DetachChild(root, root->right, piece.height);
+    if (depth == path.depth) {
+      return {left, root, right};
     }
-    if (greater) {
-      return new_node;
+    if (path.right[depth]) {
+      SplitResult result = SplitAlong(right, path, depth + 1);
+      result.lower = Join(left, root, result.lower);
+      return result;
     }
-    return prev_node;
+    SplitResult result = SplitAlong(left, path, depth + 1);
+    result.upper = Join(result.upper, root, right);
+    return result;
   }
 
-  template <typename V>
-  iterator FindLessOrGreaterImpl(BaseNode* node, V&& value, BaseNode* best_found, bool greater) {
-    if (node == &base) {
-      return iterator(best_found, &base);
+  // Split by position instead of key, for multisets whose equal nodes keys can't separate.
+  // The node holding the element at position is cut out with all its counted copies.
+  SplitResult SplitAt(Piece piece, std::size_t position) {
+    BaseNode* root = piece.root;
+    if (root == nullptr) {
+      return {};
+    }
+    std::size_t left_size = SubtreeSize(root->left);
+    std::size_t copies = Copies(root);
+    Piece left = DetachChild(root, root->left, piece.height);
+    Piece right = DetachChild(root, root->right, piece.height);
+    if (left_size + copies <= position) {
+      SplitResult result = SplitAt(right, position - left_size - copies);
+      result.lower = Join(left, root, result.lower);
+      return result;
     }
-    if (compare(Data(node)->value, value)) {
-      if (greater) {
-        return FindLessOrGreaterImpl(node->right, std::forward<V>(value), best_found, greater);
+    if (position < left_size) {
+      SplitResult result = SplitAt(left, position);
+      result.upper = Join(result.upper, root, right);
+      return result;
+    }
+    return {left, root, right};
+  }
+
+  enum SetOperation { kUnion, kIntersection, kDifference };
+
+  // Subtrees dropped by a set operation, chained through parent. They are freed after the
+  // operation on the calling thread, so the allocator is never used concurrently.
+  struct DropList {
+    BaseNode* head = nullptr;
+    BaseNode* tail = nullptr;
+
+    void Push(BaseNode* subtree) {
+      if (subtree == nullptr) {
+        return;
+      }
+      subtree->parent = nullptr;
+      if (tail == nullptr) {
+        head = subtree;
+      } else {
+        tail->parent = subtree;
       }
-      return FindLessOrGreaterImpl(node->right, std::forward<V>(value), ChoiceLessOrGreater(best_found, node, greater), greater);
+      tail = subtree;
     }
-    if (compare(value, Data(node)->value)) {
-      if (greater) {
-        return FindLessOrGreaterImpl(node->left, std::forward<V>(value), ChoiceLessOrGreater(best_found, node, greater), greater);
+
+    void Append(const DropList& other) {
+      if (other.head == nullptr) {
+        return;
+      }
+      if (tail == nullptr) {
+        head = other.head;
+      } else {
+        tail->parent = other.head;
       }
-      return FindLessOrGreaterImpl(node->left, std::forward<V>(value), best_found, greater);
+      tail = other.tail;
+    }
+  };
+
+  struct Garbage {
+    DropList ours;
+    DropList theirs;
+
+    void Append(const Garbage& other) {
+      ours.Append(other.ours);
+      theirs.Append(other.theirs);
     }
-    if (greater) {
-      return FindLessOrGreaterImpl(node->right, std::forward<V>(value), best_found, greater);
+  };
+
+  void DestroyDropped(BaseNode* subtree) {
+    while (subtree != nullptr) {
+      BaseNode* next = subtree->parent;
+      DestroySubtree(subtree);
+      subtree = next;
     }
-    return FindLessOrGreaterImpl(node->left, std::forward<V>(value), best_found, greater);
   }
 
-  iterator StatisticImpl(BaseNode* node, std::size_t stat_num) {
-    std::size_t left_subtree = SubtreeSize(node->left);
-    if (left_subtree < stat_num) { // statistic in right subtree
-      return StatisticImpl(node->right, stat_num - left_subtree - 1);
+  static constexpr std::size_t kParallelGrain = std::size_t(1) << 15; // elements in both pieces
+
+  // Exposes our root, splits the other piece by it and recurses on both sides. With a thread
+  // budget above one the upper half runs on a new thread; pieces are disjoint and nothing
+  // is allocated or freed meanwhile, so the halves don't synchronize. If Compare throws,
+  // every piece goes to the garbage and the first exception is rethrown once both halves
+  // are done.
+  template <SetOperation Operation>
+  Piece Combine(Piece ours, Piece theirs, Garbage& garbage, std::size_t threads) {
+    if (ours.root == nullptr || theirs.root == nullptr) {
+      if constexpr (Operation == kUnion) {
+        return ours.root == nullptr ? theirs : ours;
+      } else if constexpr (Operation == kIntersection) {
+        garbage.ours.Push(ours.root);
+        garbage.theirs.Push(theirs.root);
+        return {};
+      } else {
+        garbage.theirs.Push(theirs.root);
+        return ours;
+      }
+    }
+    BaseNode* root = ours.root;
+    bool fork = threads > 1 && SubtreeSize(root) + SubtreeSize(theirs.root) >= kParallelGrain;
+    Piece left = DetachChild(root, root->left, ours.height);
+    Piece right = DetachChild(root, root->right, ours.height);
+    root->left = nullptr;
+    root->right = nullptr;
+    SplitResult parts;
+    try {
+      parts = Split(theirs, Data(root)->value);
+    } catch (...) { // theirs is still whole
+      garbage.ours.Push(left.root);
+      garbage.ours.Push(right.root);
+      garbage.ours.Push(root);
+      garbage.theirs.Push(theirs.root);
+      throw;
+    }
+    if (parts.equal != nullptr) {
+      parts.equal->left = nullptr;
+      parts.equal->right = nullptr;
+    }
+    Piece lower;
+    Piece upper;
+    std::exception_ptr lower_error;
+    std::exception_ptr upper_error;
+    bool upper_done = true;
+    if (fork) {
+      Garbage upper_garbage;
+      std::thread worker;
+      try {
+        worker = std::thread([&] { upper = TryCombine<Operation>(right, parts.upper, upper_garbage, threads / 2, upper_error); });
+      } catch (const std::system_error&) { // out of threads, stay serial
+        fork = false;
+      }
+      lower = TryCombine<Operation>(left, parts.lower, garbage, fork ? threads - threads / 2 : threads, lower_error);
+      if (fork) {
+        worker.join();
+        garbage.Append(upper_garbage);
+      } else if (!lower_error) {
+        upper = TryCombine<Operation>(right, parts.upper, garbage, threads, upper_error);
+      } else {
+        upper_done = false;
+      }
+    } else {
+      lower = TryCombine<Operation>(left, parts.lower, garbage, 1, lower_error);
+      if (!lower_error) {
+        upper = TryCombine<Operation>(right, parts.upper, garbage, 1, upper_error);
+      } else {
+        upper_done = false;
+      }
+    }
+    if (lower_error || upper_error) { // a failed half has dropped its pieces, returning none
+      garbage.ours.Push(lower.root);
+      garbage.ours.Push(upper.root);
+      if (!upper_done) {
+        garbage.ours.Push(right.root);
+        garbage.theirs.Push(parts.upper.root);
+      }
+      garbage.ours.Push(root);
+      garbage.theirs.Push(parts.equal);
+      std::rethrow_exception(lower_error ? lower_error : upper_error);
     }
-    if (left_subtree > stat_num) {
-      return StatisticImpl(node->left, stat_num);
+    bool keep = Operation == kUnion || (Operation == kIntersection) == (parts.equal != nullptr);
+    garbage.theirs.Push(parts.equal);
+    if (keep) {
+      return Join(lower, root, upper);
+    }
+    garbage.ours.Push(root);
+    return Join(lower, upper);
+  }
+
+  // Combine that reports an exception in error instead of throwing it, returning no piece
+  template <SetOperation Operation>
+  Piece TryCombine(Piece ours, Piece theirs, Garbage& garbage, std::size_t threads, std::exception_ptr& error) noexcept {
+    try {
+      return Combine<Operation>(ours, theirs, garbage, threads);
+    } catch (...) {
+      error = std::current_exception();
+      return {};
+    }
+  }
+
+  // If Compare throws, both trees are left empty and their nodes freed
+  template <SetOperation Operation>
+  void CombineWith(RedBlackTree& other, std::size_t threads) {
+    Garbage garbage;
+    std::exception_ptr error;
+    Piece result = TryCombine<Operation>(TakeRoot(), other.TakeRoot(), garbage, threads, error);
+    AttachTree(result.root);
+    DestroyDropped(garbage.ours.head);
+    other.DestroyDropped(garbage.theirs.head);
+    if (error) {
+      std::rethrow_exception(error);
+    }
+  }
+
+  // Nodes change trees only if our allocator can free them, otherwise values move to new nodes
+  RedBlackTree Adopt(RedBlackTree&& other) {
+    if constexpr (!NodeAllocTraits::is_always_equal::value) {
+      if (alloc != other.alloc) {
+        RedBlackTree adopted(compare, Alloc(alloc));
+        adopted.AttachTree(adopted.template CloneSubtree<true>(other.base->parent, nullptr));
+        return adopted;
+      }
+    }
+    return std::move(other);
+  }
+
+  static std::size_t DefaultThreads() {
+    return std::max(1u, std::thread::hardware_concurrency());
+  }
+
+  // body(first, last, chunk) for at most min(threads, size()) nonempty chunks, numbered from 0;
+  // chunk 0 runs on this thread. Several bounds may fall into one counted node, which then
+  // starts a single chunk.
+  template <typename It, typename Body>
+  void VisitChunks(std::size_t threads, Body body) {
+    std::size_t planned = std::min(std::max<std::size_t>(threads, 1), size());
+    if (planned == 0) {
+      return;
+    }
+    std::vector<It> bounds;
+    bounds.reserve(planned + 1);
+    for (std::size_t chunk = 0; chunk < planned; ++chunk) {
+      It bound = statistic(size() * chunk / planned);
+      if (bounds.empty() || bounds.back() != bound) {
+        bounds.push_back(bound);
+      }
+    }
+    std::size_t chunks = bounds.size();
+    bounds.push_back(end());
+    std::vector<std::exception_ptr> errors(chunks);
+    auto run = [&](std::size_t chunk) {
+      try {
+        body(bounds[chunk], bounds[chunk + 1], chunk);
+      } catch (...) {
+        errors[chunk] = std::current_exception();
+      }
+    };
+    std::vector<std::thread> workers;
+    workers.reserve(chunks - 1);
+    for (std::size_t chunk = 1; chunk < chunks; ++chunk) {
+      try {
+        workers.emplace_back(run, chunk);
+      } catch (const std::system_error&) { // out of threads, this one takes the chunk
+        run(chunk);
+      }
+    }
+    run(0);
+    for (std::thread& worker : workers) {
+      worker.join();
+    }
+    for (std::exception_ptr& error : errors) {
+      if (error) {
+        std::rethrow_exception(error);
+      }
+    }
+  }
+
+  void CheckCombinedSize(std::size_t added) const {
+    if constexpr (sizeof(SizeType) < sizeof(std::size_t)) {
+      if (added > max_size() - size()) {
+        throw std::length_error("RedBlackTree: subtree_size type is too narrow");
+      }
+    }
+  }
+
+  static constexpr std::size_t kBatchGroup = 16;
+
+  enum BoundKind { kFindBound, kUpperBound, kLessThanBound };
+
+  struct BatchLane {
+    BaseNode* node;
+    BaseNode* bound;
+    std::size_t skipped; // elements left of the subtree of node, for statistic_batch
+  };
+
+  static void Prefetch(BaseNode* node) {
+#if defined(__GNUC__) || defined(__clang__)
+    __builtin_prefetch(node);
+    __builtin_prefetch(&Data(node)->value);
+#endif
+  }
+
+  // step(i, lane) moves lane.node one level down (nullptr when done), finish(i, lane) stores the answer
+  template <typename Step, typename Finish>
+  void BatchDescend(std::size_t count, Step step, Finish finish) {
+    BatchLane lanes[kBatchGroup];
+    for (std::size_t first = 0; first < count; first += kBatchGroup) {
+      std::size_t width = std::min(kBatchGroup, count - first);
+      for (std::size_t lane = 0; lane < width; ++lane) {
+        lanes[lane] = {base->parent, base, 0};
+      }
+      for (bool active = base->parent != nullptr; active;) {
+        active = false;
+        for (std::size_t lane = 0; lane < width; ++lane) {
+          if (lanes[lane].node != nullptr) {
+            step(first + lane, lanes[lane]);
+            if (lanes[lane].node != nullptr) {
+              Prefetch(lanes[lane].node);
+              active = true;
+            }
+          }
+        }
+      }
+      for (std::size_t lane = 0; lane < width; ++lane) {
+        finish(first + lane, lanes[lane]);
+      }
+    }
+  }
+
+  template <BoundKind Kind, typename K, std::size_t Extent, typename Out>
+  void BoundBatch(std::span<K, Extent> keys, Out* out) {
+    if constexpr (!kTransparent && !std::is_same_v<std::remove_const_t<K>, ValueType> &&
+                  !std::is_same_v<std::remove_const_t<K>, LookupType>) {
+      std::vector<LookupType> converted(keys.begin(), keys.end());
+      BoundBatch<Kind>(std::span<const LookupType>(converted), out);
+    } else {
+      BatchDescend(keys.size(), [&](std::size_t i, BatchLane& lane) {
+        if constexpr (Kind == kUpperBound) {
+          if (Less(keys[i], Data(lane.node)->value)) {
+            lane.bound = lane.node;
+            lane.node = lane.node->left;
+          } else {
+            lane.node = lane.node->right;
+          }
+        } else if constexpr (Kind == kLessThanBound) {
+          if (Less(Data(lane.node)->value, keys[i])) {
+            lane.bound = lane.node;
+            lane.node = lane.node->right;
+          } else {
+            lane.node = lane.node->left;
+          }
+        } else { // lower bound
+          if (Less(Data(lane.node)->value, keys[i])) {
+            lane.node = lane.node->right;
+          } else {
+            lane.bound = lane.node;
+            lane.node = lane.node->left;
+          }
+        }
+      }, [&](std::size_t i, const BatchLane& lane) {
+        BaseNode* bound = lane.bound;
+        if (Kind == kFindBound && bound != base && Less(keys[i], Data(bound)->value)) {
+          bound = base;
+        }
+        out[i] = Out(bound, base);
+      });
+    }
+  }
+
+  template <typename Out>
+  void StatisticBatch(std::span<const std::size_t> stat_nums, Out* out) {
+    BatchDescend(stat_nums.size(), [&](std::size_t i, BatchLane& lane) {
+      std::size_t position = lane.skipped + SubtreeSize(lane.node->left);
+      if (position + Copies(lane.node) <= stat_nums[i]) {
+        lane.skipped = position + Copies(lane.node);
+        lane.node = lane.node->right;
+      } else if (position > stat_nums[i]) {
+        lane.node = lane.node->left;
+      } else {
+        lane.bound = lane.node;
+        lane.node = nullptr;
+      }
+    }, [&](std::size_t i, const BatchLane& lane) {
+      out[i] = Out(lane.bound, base);
+    });
+  }
+
+  iterator StatisticImpl(BaseNode* node, std::size_t stat_num) {
+    while (true) {
+      std::size_t left_subtree = SubtreeSize(node->left);
+      if (left_subtree + Copies(node) <= stat_num) { // statistic in right subtree
+        stat_num -= left_subtree + Copies(node);
+        node = node->right;
+      } else if (left_subtree > stat_num) {
+        node = node->left;
+      } else {
+        return iterator(node, base);
+      }
     }
-    return iterator(node, &base);
   }
 };
 
@@ -0,0 +1,287 @@
+#pragma once
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <ostream>
+#include <stdexcept>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#if __has_include(<sys/mman.h>)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define NENIY_REDBLACKTREEIMAGE_MMAP 1
+#endif
+
+#ifndef NENIY_REDBLACKTREEIMAGE
+#define NENIY_REDBLACKTREEIMAGE
+
+// Read-only, position-independent image of a sorted set of trivially copyable values: the
+// nodes of a balanced red-black tree in level order, children as node indices, each with
+// its color and subtree size. It can be written to a file, mapped at any address and
+// queried in place without deserialization. Lookups trust the child indices, so only
+// images made by write() should be opened.
+template <typename ValueType, typename Compare = std::less<ValueType>>
+requires std::is_trivially_copyable_v<ValueType>
+class RedBlackTreeImage {
+ public:
+  static constexpr std::uint64_t kNone = ~std::uint64_t(0);
+  static constexpr std::uint64_t kRedBit = std::uint64_t(1) << 63;
+
+  struct Node {
+    std::uint64_t left;         // index of the child, kNone if empty
+    std::uint64_t right;
+    std::uint64_t subtree_size; // the top bit is the color
+    ValueType value;
+  };
+
+  struct Header {
+    char magic[8];
+    std::uint32_t node_bytes;
+    std::uint32_t value_bytes;
+    std::uint64_t count;
+  };
+
+  // Nodes start at the first offset after the header aligned for Node
+  static constexpr std::size_t kNodesOffset = (sizeof(Header) + alignof(Node) - 1) / alignof(Node) * alignof(Node);
+
+  // Writes the elements of a strictly increasing range, for example a RedBlackTree
+  template <std::input_iterator InputIt>
+  static void write(InputIt first, InputIt last, std::ostream& out) {
+    std::vector<ValueType> values(first, last);
+    Header header{};
+    std::memcpy(header.magic, kMagic, sizeof(header.magic));
+    header.node_bytes = sizeof(Node);
+    header.value_bytes = sizeof(ValueType);
+    header.count = values.size();
+    char padding[kNodesOffset - sizeof(Header) + 1] = {};
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(padding, kNodesOffset - sizeof(Header));
+
+    // The shape of RedBlackTree's balanced build: the left part of [first, first + count)
+    // gets (count - 1) / 2 elements, the incomplete last level is red
+    struct Range {
+      std::uint64_t first;
+      std::uint64_t count;
+      std::uint64_t level;
+    };
+    std::uint64_t red_level = 0;
+    for (std::uint64_t m = values.size(); m > 0; m = (m - 1) / 2) {
+      ++red_level;
+    }
+    std::vector<Range> queue;
+    queue.reserve(values.size());
+    if (!values.empty()) {
+      queue.push_back({0, values.size(), 0});
+    }
+    for (std::size_t index = 0; index < queue.size(); ++index) {
+      Range range = queue[index];
+      std::uint64_t left_count = (range.count - 1) / 2;
+      std::uint64_t right_count = range.count - left_count - 1;
+      Node node{kNone, kNone, range.count | (range.level == red_level ? kRedBit : 0), values[range.first + left_count]};
+      if (left_count > 0) {
+        node.left = queue.size();
+        queue.push_back({range.first, left_count, range.level + 1});
+      }
+      if (right_count > 0) {
+        node.right = queue.size();
+        queue.push_back({range.first + left_count + 1, right_count, range.level + 1});
+      }
+      out.write(reinterpret_cast<const char*>(&node), sizeof(node));
+    }
+    if (!out) {
+      throw std::runtime_error("RedBlackTreeImage::write: write failed");
+    }
+  }
+
+  template <typename Tree>
+  static void write(const Tree& tree, std::ostream& out) {
+    write(tree.begin(), tree.end(), out);
+  }
+
+  // A view of an image in memory, which must stay mapped while the view is used
+  RedBlackTreeImage(const void* data, std::size_t bytes, const Compare& compare = Compare()) : compare(compare) {
+    Header header{};
+    if (bytes < kNodesOffset || reinterpret_cast<std::uintptr_t>(data) % alignof(Node) != 0) {
+      throw std::runtime_error("RedBlackTreeImage: truncated or misaligned image");
+    }
+    std::memcpy(&header, data, sizeof(header));
+    if (std::memcmp(header.magic, kMagic, sizeof(header.magic)) != 0 || header.node_bytes != sizeof(Node) ||
+        header.value_bytes != sizeof(ValueType) || header.count > (bytes - kNodesOffset) / sizeof(Node)) {
+      throw std::runtime_error("RedBlackTreeImage: not an image of this value type");
+    }
+    nodes = reinterpret_cast<const Node*>(static_cast<const std::byte*>(data) + kNodesOffset);
+    count = header.count;
+  }
+
+  std::size_t size() const noexcept { return count; }
+
+  bool empty() const noexcept { return count == 0; }
+
+  // Lookups return a pointer into the image, nullptr if there is no such element
+
+  template <typename K>
+  const ValueType* find(const K& key) const {
+    const ValueType* found = lower_bound(key);
+    return found != nullptr && !compare(key, *found) ? found : nullptr;
+  }
+
+  template <typename K> // first element not less than key
+  const ValueType* lower_bound(const K& key) const {
+    const ValueType* bound = nullptr;
+    for (std::uint64_t index = Root(); index != kNone;) {
+      const Node& node = nodes[index];
+      if (compare(node.value, key)) {
+        index = node.right;
+      } else {
+        bound = &node.value;
+        index = node.left;
+      }
+    }
+    return bound;
+  }
+
+  template <typename K> // first element greater than key
+  const ValueType* upper_bound(const K& key) const {
+    const ValueType* bound = nullptr;
+    for (std::uint64_t index = Root(); index != kNone;) {
+      const Node& node = nodes[index];
+      if (compare(key, node.value)) {
+        bound = &node.value;
+        index = node.left;
+      } else {
+        index = node.right;
+      }
+    }
+    return bound;
+  }
+
+  template <typename K>
+  const ValueType* find_greater_than(const K& key) const { return upper_bound(key); }
+
+  template <typename K> // last element less than key
+  const ValueType* find_less_than(const K& key) const {
+    const ValueType* bound = nullptr;
+    for (std::uint64_t index = Root(); index != kNone;) {
+      const Node& node = nodes[index];
+      if (compare(node.value, key)) {
+        bound = &node.value;
+        index = node.right;
+      } else {
+        index = node.left;
+      }
+    }
+    return bound;
+  }
+
+  const ValueType* statistic(std::size_t stat_num) const {
+    if (stat_num >= count) {
+      return nullptr;
+    }
+    std::uint64_t index = Root();
+    while (true) {
+      const Node& node = nodes[index];
+      std::uint64_t left_subtree = SubtreeSize(node.left);
+      if (left_subtree < stat_num) {
+        stat_num -= left_subtree + 1;
+        index = node.right;
+      } else if (left_subtree > stat_num) {
+        index = node.left;
+      } else {
+        return &node.value;
+      }
+    }
+  }
+
+  template <typename K> // count of elements less than key
+  std::size_t rank(const K& key) const {
+    std::size_t less = 0;
+    for (std::uint64_t index = Root(); index != kNone;) {
+      const Node& node = nodes[index];
+      if (compare(node.value, key)) {
+        less += SubtreeSize(node.left) + 1;
+        index = node.right;
+      } else {
+        index = node.left;
+      }
+    }
+    return less;
+  }
+
+ private:
+  static constexpr char kMagic[8] = {'R', 'B', 'T', 'I', 'M', 'G', '1', '\0'};
+
+  std::uint64_t Root() const { return count == 0 ? kNone : 0; }
+
+  std::uint64_t SubtreeSize(std::uint64_t index) const {
+    return index == kNone ? 0 : nodes[index].subtree_size & ~kRedBit;
+  }
+
+  const Node* nodes = nullptr;
+  std::uint64_t count = 0;
+  [[no_unique_address]] Compare compare;
+};
+
+#ifdef NENIY_REDBLACKTREEIMAGE_MMAP
+// Read-only mapping of a whole file, e.g. a RedBlackTreeImage:
+//   MappedFile file("keys.img");
+//   RedBlackTreeImage<std::uint64_t> image(file.data(), file.size());
+class MappedFile {
+ public:
+  explicit MappedFile(const char* path) {
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0) {
+      throw std::system_error(errno, std::generic_category(), "MappedFile: open");
+    }
+    struct stat status {};
+    if (::fstat(fd, &status) != 0) {
+      int error = errno;
+      ::close(fd);
+      throw std::system_error(error, std::generic_category(), "MappedFile: fstat");
+    }
+    bytes = static_cast<std::size_t>(status.st_size);
+    if (bytes > 0) {
+      void* mapped = ::mmap(nullptr, bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (mapped == MAP_FAILED) {
+        int error = errno;
+        ::close(fd);
+        throw std::system_error(error, std::generic_category(), "MappedFile: mmap");
+      }
+      address = mapped;
+    }
+    ::close(fd);
+  }
+
+  MappedFile(MappedFile&& other) noexcept
+      : address(std::exchange(other.address, nullptr)), bytes(std::exchange(other.bytes, 0)) {}
+
+  MappedFile& operator=(MappedFile&& other) noexcept {
+    std::swap(address, other.address);
+    std::swap(bytes, other.bytes);
+    return *this;
+  }
+
+  ~MappedFile() {
+    if (address != nullptr) {
+      ::munmap(address, bytes);
+    }
+  }
+
+  const void* data() const noexcept { return address; }
+
+  std::size_t size() const noexcept { return bytes; }
+
+ private:
+  void* address = nullptr;
+  std::size_t bytes = 0;
+};
+#endif
+
+#endif // NENIY_REDBLACKTREEIMAGE
@@ -0,0 +1,130 @@
+#pragma once
+#include "RedBlackTree.h"
+
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#ifndef NENIY_REDBLACKTREEMAP
+#define NENIY_REDBLACKTREEMAP
+
+// Declares is_transparent for MapKeyCompare only when the key comparator has it
+template <typename Compare>
+struct MapKeyTransparency {};
+
+template <typename Compare>
+  requires requires { typename Compare::is_transparent; }
+struct MapKeyTransparency<Compare> {
+  using is_transparent = void;
+};
+
+// Orders key-value pairs by key. Lookups take a bare key: any key when Compare is
+// transparent, otherwise one converted to Key once per call, see key_type.
+template <typename Key, typename Compare>
+struct MapKeyCompare : MapKeyTransparency<Compare> {
+  using key_type = Key;
+
+  template <typename K>
+  static const K& KeyOf(const K& key) {
+    return key;
+  }
+
+  template <typename Mapped>
+  static const Key& KeyOf(const std::pair<const Key, Mapped>& element) {
+    return element.first;
+  }
+
+  template <typename Mapped>
+  static const Key& KeyOf(const std::pair<Key, Mapped>& element) {
+    return element.first;
+  }
+
+  template <typename L, typename R>
+  bool operator()(const L& lhs, const R& rhs) const {
+    return compare(KeyOf(lhs), KeyOf(rhs));
+  }
+
+  [[no_unique_address]] Compare compare;
+};
+
+// RedBlackTree of std::pair<const Key, Mapped> ordered by key, with the whole tree API
+// (order statistics, split/join, set operations by key...) plus the map members below.
+// MultiTreePolicy gives a multimap; operator[], at, try_emplace and insert_or_assign need
+// unique keys.
+template <typename Key, typename Mapped, typename Compare = std::less<Key>,
+          typename Alloc = std::allocator<std::pair<const Key, Mapped>>, typename Policy = DefaultTreePolicy>
+class RedBlackTreeMap : public RedBlackTree<std::pair<const Key, Mapped>, MapKeyCompare<Key, Compare>, Alloc, Policy> {
+  static_assert(Policy::duplicates != DuplicateKeys::kCounted, "RedBlackTreeMap: copies of a key would share one mapped value");
+
+  static constexpr bool kUnique = Policy::duplicates == DuplicateKeys::kRejected;
+  static constexpr bool kTransparent = requires { typename Compare::is_transparent; };
+
+ public:
+  using Tree = RedBlackTree<std::pair<const Key, Mapped>, MapKeyCompare<Key, Compare>, Alloc, Policy>;
+  using key_type = Key;
+  using mapped_type = Mapped;
+  using value_type = std::pair<const Key, Mapped>;
+  using typename Tree::iterator;
+  using typename Tree::const_iterator;
+
+  using Tree::Tree;
+  using Tree::insert;
+
+  RedBlackTreeMap() = default;
+
+  explicit RedBlackTreeMap(Tree tree) : Tree(std::move(tree)) {}
+
+  // Lets insert({key, mapped}) pick the element type
+  std::pair<iterator, bool> insert(value_type&& value) { return Tree::insert(std::move(value)); }
+
+  // Constructs the mapped value from args only if key is absent; one descent either way
+  template <typename K, typename... Args>
+  std::pair<iterator, bool> try_emplace(K&& key, Args&&... args) requires kUnique {
+    if constexpr (!kTransparent && !std::is_same_v<std::remove_cvref_t<K>, Key>) { // convert once
+      return try_emplace(Key(std::forward<K>(key)), std::forward<Args>(args)...);
+    } else {
+      iterator bound = this->lower_bound(key);
+      if (bound != this->end() && !this->key_comp()(key, bound->first)) {
+        return {bound, false};
+      }
+      return {this->insert(const_iterator(bound), value_type(std::piecewise_construct, std::forward_as_tuple(std::forward<K>(key)),
+                                                             std::forward_as_tuple(std::forward<Args>(args)...))),
+              true};
+    }
+  }
+
+  template <typename K, typename M>
+  std::pair<iterator, bool> insert_or_assign(K&& key, M&& mapped) requires kUnique {
+    auto [where, inserted] = try_emplace(std::forward<K>(key), std::forward<M>(mapped));
+    if (!inserted) {
+      where->second = std::forward<M>(mapped);
+    }
+    return {where, inserted};
+  }
+
+  Mapped& operator[](const Key& key) requires kUnique { return try_emplace(key).first->second; }
+
+  Mapped& operator[](Key&& key) requires kUnique { return try_emplace(std::move(key)).first->second; }
+
+  template <typename K>
+  Mapped& at(const K& key) requires kUnique {
+    iterator found = this->find(key);
+    if (found == this->end()) {
+      throw std::out_of_range("RedBlackTreeMap::at: no such key");
+    }
+    return found->second;
+  }
+
+  template <typename K>
+  const Mapped& at(const K& key) const requires kUnique {
+    return const_cast<RedBlackTreeMap&>(*this).at(key);
+  }
+
+  template <typename K>
+  bool contains(const K& key) const { return this->find(key) != this->end(); }
+};
+
+#endif // NENIY_REDBLACKTREEMAP
@@ -0,0 +1,815 @@
+#pragma once
+#include "RedBlackTree.h"
+
+#include <algorithm>
+#include <bit>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+#if defined(__AVX2__) || defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
+#ifndef NENIY_SIMDBTREE
+#define NENIY_SIMDBTREE
+
+// Ordered set of arithmetic keys under std::less with the lookup and order statistic API of
+// RedBlackTree, stored as a B+ tree: up to 16 sorted keys per node, so a lookup touches
+// a few cache lines per level instead of one per binary level. Inner nodes keep the element
+// count of every child for statistic() and rank(); leaves are linked for iteration. A node
+// is searched with AVX2 or SSE2 comparisons of all its keys at once where the key type
+// allows it, with a scalar loop otherwise. Nodes link to their parents, so erasing through
+// an iterator needs no search. Insert and erase invalidate all iterators.
+// Keys must be totally ordered by <, so no NaN.
+template <typename Key, typename Alloc = std::allocator<Key>>
+requires std::is_arithmetic_v<Key>
+class SimdBTree {
+ private:
+  static constexpr int kNodeKeys = 16; // keys of a leaf, children of an inner node
+  static constexpr int kMinKeys = kNodeKeys / 2; // except in the root
+  static constexpr int kMaxHeight = 32; // every node but the root has kMinKeys children or more
+
+  struct Inner;
+
+  struct alignas(64) Node {
+    Key keys[kNodeKeys]{}; // an inner node uses count - 1 keys, keys[i] separates its children i and i + 1
+    int count = 0; // keys of a leaf, children of an inner node
+    Inner* parent = nullptr; // fits in the padding, nullptr for the root
+  };
+
+  struct Leaf : Node {
+    Leaf* prev = nullptr;
+    Leaf* next = nullptr;
+  };
+
+  // Every key of children[i] is less than keys[i], every key of children[i + 1] is not
+  struct Inner : Node {
+    Node* children[kNodeKeys]{};
+    std::size_t sizes[kNodeKeys]{}; // elements under each child
+  };
+
+  using LeafAlloc = typename std::allocator_traits<Alloc>::template rebind_alloc<Leaf>;
+  using LeafAllocTraits = std::allocator_traits<LeafAlloc>;
+  using InnerAlloc = typename std::allocator_traits<Alloc>::template rebind_alloc<Inner>;
+  using InnerAllocTraits = std::allocator_traits<InnerAlloc>;
+
+ public:
+  class const_iterator {
+   public:
+    using value_type = Key;
+    using iterator_category = std::bidirectional_iterator_tag;
+    using pointer = const value_type*;
+    using reference = const value_type&;
+    using difference_type = std::ptrdiff_t;
+
+    const_iterator() = default;
+
+    bool operator==(const const_iterator& other) const { return leaf == other.leaf && slot == other.slot; }
+
+    bool operator!=(const const_iterator& other) const { return !(*this == other); }
+
+    const_iterator& operator++() {
+      if (++slot == leaf->count) {
+        leaf = leaf->next;
+        slot = 0;
+      }
+      return *this;
+    }
+
+    const_iterator& operator--() {
+      if (leaf == nullptr) {
+        leaf = tree->last;
+        slot = leaf->count - 1;
+      } else if (slot == 0) {
+        leaf = leaf->prev;
+        slot = leaf->count - 1;
+      } else {
+        --slot;
+      }
+      return *this;
+    }
+
+    const_iterator operator++(int) {
+      const_iterator copy = *this;
+      ++*this;
+      return copy;
+    }
+
+    const_iterator operator--(int) {
+      const_iterator copy = *this;
+      --*this;
+      return copy;
+    }
+
+    reference operator*() const { return leaf->keys[slot]; }
+
+    pointer operator->() const { return &**this; }
+
+    friend class SimdBTree;
+
+   private:
+    const_iterator(const Leaf* leaf, int slot, const SimdBTree* tree) : leaf(leaf), slot(slot), tree(tree) {}
+
+    const Leaf* leaf = nullptr; // nullptr for end()
+    int slot = 0;
+    const SimdBTree* tree = nullptr;
+  };
+
+  using iterator = const_iterator;
+  using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+  using reverse_iterator = const_reverse_iterator;
+
+  SimdBTree() = default;
+
+  explicit SimdBTree(const Alloc& alloc) noexcept : leaf_alloc(alloc), inner_alloc(alloc) {}
+
+  template <std::input_iterator InputIt>
+  SimdBTree(InputIt first, InputIt last, const Alloc& alloc = Alloc()) : SimdBTree(alloc) {
+    for (; first != last; ++first) {
+      insert(*first);
+    }
+  }
+
+  SimdBTree(const SimdBTree& other)
+      : leaf_alloc(LeafAllocTraits::select_on_container_copy_construction(other.leaf_alloc)),
+        inner_alloc(InnerAllocTraits::select_on_container_copy_construction(other.inner_alloc)) {
+    if (other.root != nullptr) {
+      Leaf* previous = nullptr;
+      root = CloneSubtree(other.root, other.height, previous);
+      height = other.height;
+      count = other.count;
+      last = previous;
+    }
+  }
+
+  SimdBTree(SimdBTree&& other) noexcept
+      : root(std::exchange(other.root, nullptr)), first(std::exchange(other.first, nullptr)),
+        last(std::exchange(other.last, nullptr)), height(std::exchange(other.height, 0)),
+        count(std::exchange(other.count, 0)), leaf_alloc(std::move(other.leaf_alloc)),
+        inner_alloc(std::move(other.inner_alloc)) {}
+
+  SimdBTree& operator=(SimdBTree other) noexcept {
+    swap(other);
+    return *this;
+  }
+
+  ~SimdBTree() { clear(); }
+
+  void swap(SimdBTree& other) noexcept {
+    using std::swap;
+    swap(root, other.root);
+    swap(first, other.first);
+    swap(last, other.last);
+    swap(height, other.height);
+    swap(count, other.count);
+    swap(leaf_alloc, other.leaf_alloc);
+    swap(inner_alloc, other.inner_alloc);
+  }
+
+  friend void swap(SimdBTree& lhs, SimdBTree& rhs) noexcept { lhs.swap(rhs); }
+
+  std::size_t size() const noexcept { return count; }
+
+  bool empty() const noexcept { return count == 0; }
+
+  // Instructions the node search of Key was compiled to: "AVX2", "SSE2" or "scalar"
+  static constexpr const char* node_search() noexcept {
+#if defined(__AVX2__)
+    if constexpr (std::is_integral_v<Key> && (sizeof(Key) == 4 || sizeof(Key) == 8)) {
+      return "AVX2";
+    } else if constexpr (std::is_same_v<Key, float> || std::is_same_v<Key, double>) {
+      return "AVX2";
+    }
+#elif defined(__SSE2__) || defined(_M_X64)
+    if constexpr (std::is_integral_v<Key> && sizeof(Key) == 4) {
+      return "SSE2";
+    } else if constexpr (std::is_same_v<Key, float> || std::is_same_v<Key, double>) {
+      return "SSE2";
+    }
+#endif
+    return "scalar";
+  }
+
+  const_iterator begin() const { return const_iterator(first, 0, this); }
+
+  const_iterator end() const { return const_iterator(nullptr, 0, this); }
+
+  const_iterator cbegin() const { return begin(); }
+
+  const_iterator cend() const { return end(); }
+
+  const_reverse_iterator rbegin() const { return const_reverse_iterator(end()); }
+
+  const_reverse_iterator rend() const { return const_reverse_iterator(begin()); }
+
+  std::pair<iterator, bool> insert(Key key) {
+    if (root == nullptr) {
+      Leaf* leaf = NewLeaf();
+      leaf->keys[0] = key;
+      leaf->count = 1;
+      root = first = last = leaf;
+      height = 1;
+      count = 1;
+      return {const_iterator(leaf, 0, this), true};
+    }
+    Path path;
+    Leaf* leaf = Descend(key, &path);
+    int slot = CountLess(leaf->keys, leaf->count, key);
+    if (slot < leaf->count && !(key < leaf->keys[slot])) {
+      return {const_iterator(leaf, slot, this), false};
+    }
+
+    // Full nodes from the leaf up are split; the new nodes are allocated first, so nothing
+    // changes if an allocation throws
+    int splits = 0;
+    if (leaf->count == kNodeKeys) {
+      splits = 1;
+      while (splits < static_cast<int>(height) && path.nodes[height - 1 - splits]->count == kNodeKeys) {
+        ++splits;
+      }
+    }
+    Node* spares[kMaxHeight + 1];
+    int spare_count = 0;
+    try {
+      for (; spare_count < splits + (splits == static_cast<int>(height)); ++spare_count) {
+        spares[spare_count] = spare_count == 0 ? static_cast<Node*>(NewLeaf()) : NewInner();
+      }
+    } catch (...) {
+      for (int i = 0; i < spare_count; ++i) {
+        i == 0 ? DeleteLeaf(static_cast<Leaf*>(spares[i])) : DeleteInner(static_cast<Inner*>(spares[i]));
+      }
+      throw;
+    }
+
+    ++count;
+    for (std::size_t level = 0; level + 1 < height; ++level) {
+      ++path.nodes[level]->sizes[path.index[level]];
+    }
+    if (splits == 0) {
+      InsertKey(leaf, slot, key);
+      return {const_iterator(leaf, slot, this), true};
+    }
+
+    Leaf* right = static_cast<Leaf*>(spares[0]);
+    SplitLeaf(leaf, right);
+    iterator inserted = slot <= kMinKeys ? const_iterator(leaf, slot, this)
+                                         : const_iterator(right, slot - kMinKeys, this);
+    InsertKey(slot <= kMinKeys ? leaf : right, slot <= kMinKeys ? slot : slot - kMinKeys, key);
+
+    Key separator = right->keys[0];
+    Node* new_child = right;
+    std::size_t left_size = leaf->count;
+    std::size_t right_size = right->count;
+    for (int level = static_cast<int>(height) - 2; level >= 0; --level) {
+      Inner* parent = path.nodes[level];
+      int index = path.index[level];
+      parent->sizes[index] = left_size;
+      if (parent->count < kNodeKeys) {
+        InsertChild(parent, index, separator, new_child, right_size);
+        return {inserted, true};
+      }
+      Inner* sibling = static_cast<Inner*>(spares[height - 1 - level]);
+      SplitInner(parent, sibling, index, separator, new_child, right_size);
+      new_child = sibling;
+      left_size = Total(parent);
+      right_size = Total(sibling);
+    }
+    Inner* new_root = static_cast<Inner*>(spares[splits]);
+    new_root->count = 2;
+    new_root->keys[0] = separator;
+    new_root->children[0] = root;
+    new_root->children[1] = new_child;
+    root->parent = new_root;
+    new_child->parent = new_root;
+    new_root->sizes[0] = left_size;
+    new_root->sizes[1] = right_size;
+    root = new_root;
+    ++height;
+    return {inserted, true};
+  }
+
+  std::size_t erase(Key key) { // count of deleted elements
+    if (root == nullptr) {
+      return 0;
+    }
+    Path path;
+    Leaf* leaf = Descend(key, &path);
+    int slot = CountLess(leaf->keys, leaf->count, key);
+    if (slot == leaf->count || key < leaf->keys[slot]) {
+      return 0;
+    }
+    EraseAt(leaf, slot, path);
+    return 1;
+  }
+
+  // Removes the element in place, with the path climbed through the parent links instead
+  // of a descent by key
+  iterator erase(const_iterator where) {
+    Leaf* leaf = const_cast<Leaf*>(where.leaf);
+    Path path;
+    const Node* node = leaf;
+    for (int level = static_cast<int>(height) - 2; level >= 0; --level) {
+      Inner* parent = node->parent;
+      path.nodes[level] = parent;
+      path.index[level] = static_cast<int>(std::find(parent->children, parent->children + parent->count, node) - parent->children);
+      node = parent;
+    }
+    return EraseAt(leaf, where.slot, path);
+  }
+
+  void clear() noexcept {
+    if (root != nullptr) {
+      DestroySubtree(root, height);
+    }
+    root = nullptr;
+    first = last = nullptr;
+    height = 0;
+    count = 0;
+  }
+
+  const_iterator find(Key key) const {
+    const_iterator found = lower_bound(key);
+    return found != end() && !(key < *found) ? found : end();
+  }
+
+  bool contains(Key key) const { return find(key) != end(); }
+
+  const_iterator lower_bound(Key key) const { // first element not less than key
+    if (root == nullptr) {
+      return end();
+    }
+    const Leaf* leaf = Descend(key, nullptr);
+    return At(leaf, CountLess(leaf->keys, leaf->count, key));
+  }
+
+  const_iterator upper_bound(Key key) const { // first element greater than key
+    if (root == nullptr) {
+      return end();
+    }
+    const Leaf* leaf = Descend(key, nullptr);
+    return At(leaf, CountNotGreater(leaf->keys, leaf->count, key));
+  }
+
+  const_iterator find_greater_than(Key key) const { return upper_bound(key); }
+
+  const_iterator find_less_than(Key key) const { // last element less than key
+    const_iterator bound = lower_bound(key);
+    return bound == begin() ? end() : --bound;
+  }
+
+  const_iterator statistic(std::size_t stat_num) const {
+    if (stat_num >= count) {
+      return end();
+    }
+    const Node* node = root;
+    for (std::size_t level = 1; level < height; ++level) {
+      const Inner* inner = static_cast<const Inner*>(node);
+      int child = 0;
+      while (stat_num >= inner->sizes[child]) {
+        stat_num -= inner->sizes[child++];
+      }
+      node = inner->children[child];
+    }
+    return const_iterator(static_cast<const Leaf*>(node), static_cast<int>(stat_num), this);
+  }
+
+  std::size_t rank(Key key) const { // count of elements less than key
+    if (root == nullptr) {
+      return 0;
+    }
+    std::size_t less = 0;
+    const Node* node = root;
+    for (std::size_t level = 1; level < height; ++level) {
+      const Inner* inner = static_cast<const Inner*>(node);
+      int child = CountNotGreater(inner->keys, inner->count - 1, key);
+      for (int i = 0; i < child; ++i) {
+        less += inner->sizes[i];
+      }
+      node = inner->children[child];
+    }
+    return less + CountLess(node->keys, node->count, key);
+  }
+
+ private:
+  struct Path {
+    Inner* nodes[kMaxHeight]; // nodes[0] is the root
+    int index[kMaxHeight]; // child taken at each node
+  };
+
+  // Bit i is set if key < keys[i] (KeyFirst) or keys[i] < key, for all kNodeKeys slots
+  template <bool KeyFirst>
+  static unsigned CompareMask(const Key* keys, Key key) {
+#if defined(__AVX2__)
+    if constexpr (std::is_integral_v<Key> && sizeof(Key) == 4) { // signed compares, unsigned keys are biased
+      __m256i bias = _mm256_set1_epi32(std::is_signed_v<Key> ? 0 : INT32_MIN);
+      __m256i x = _mm256_xor_si256(_mm256_set1_epi32(static_cast<std::int32_t>(key)), bias);
+      unsigned mask = 0;
+      for (int i = 0; i < kNodeKeys; i += 8) {
+        __m256i a = _mm256_xor_si256(_mm256_load_si256(reinterpret_cast<const __m256i*>(keys + i)), bias);
+        __m256i less = KeyFirst ? _mm256_cmpgt_epi32(a, x) : _mm256_cmpgt_epi32(x, a);
+        mask |= static_cast<unsigned>(_mm256_movemask_ps(_mm256_castsi256_ps(less))) << i;
+      }
+      return mask;
+    } else if constexpr (std::is_integral_v<Key> && sizeof(Key) == 8) {
+      __m256i bias = _mm256_set1_epi64x(std::is_signed_v<Key> ? 0 : INT64_MIN);
+      __m256i x = _mm256_xor_si256(_mm256_set1_epi64x(static_cast<std::int64_t>(key)), bias);
+      unsigned mask = 0;
+      for (int i = 0; i < kNodeKeys; i += 4) {
+        __m256i a = _mm256_xor_si256(_mm256_load_si256(reinterpret_cast<const __m256i*>(keys + i)), bias);
+        __m256i less = KeyFirst ? _mm256_cmpgt_epi64(a, x) : _mm256_cmpgt_epi64(x, a);
+        mask |= static_cast<unsigned>(_mm256_movemask_pd(_mm256_castsi256_pd(less))) << i;
+      }
+      return mask;
+    } else if constexpr (std::is_same_v<Key, float>) {
+      __m256 x = _mm256_set1_ps(key);
+      unsigned mask = 0;
+      for (int i = 0; i < kNodeKeys; i += 8) {
+        __m256 a = _mm256_load_ps(keys + i);
+        __m256 less = KeyFirst ? _mm256_cmp_ps(x, a, _CMP_LT_OQ) : _mm256_cmp_ps(a, x, _CMP_LT_OQ);
+        mask |= static_cast<unsigned>(_mm256_movemask_ps(less)) << i;
+      }
+      return mask;
+    } else if constexpr (std::is_same_v<Key, double>) {
+      __m256d x = _mm256_set1_pd(key);
+      unsigned mask = 0;
+      for (int i = 0; i < kNodeKeys; i += 4) {
+        __m256d a = _mm256_load_pd(keys + i);
+        __m256d less = KeyFirst ? _mm256_cmp_pd(x, a, _CMP_LT_OQ) : _mm256_cmp_pd(a, x, _CMP_LT_OQ);
+        mask |= static_cast<unsigned>(_mm256_movemask_pd(less)) << i;
+      }
+      return mask;
+    }
+#elif defined(__SSE2__) || defined(_M_X64)
+    if constexpr (std::is_integral_v<Key> && sizeof(Key) == 4) { // SSE2 has no 64-bit integer compare
+      __m128i bias = _mm_set1_epi32(std::is_signed_v<Key> ? 0 : INT32_MIN);
+      __m128i x = _mm_xor_si128(_mm_set1_epi32(static_cast<std::int32_t>(key)), bias);
+      unsigned mask = 0;
+      for (int i = 0; i < kNodeKeys; i += 4) {
+        __m128i a = _mm_xor_si128(_mm_load_si128(reinterpret_cast<const __m128i*>(keys + i)), bias);
+        __m128i less = KeyFirst ? _mm_cmpgt_epi32(a, x) : _mm_cmpgt_epi32(x, a);
+        mask |= static_cast<unsigned>(_mm_movemask_ps(_mm_castsi128_ps(less))) << i;
+      }
+      return mask;
+    } else if constexpr (std::is_same_v<Key, float>) {
+      __m128 x = _mm_set1_ps(key);
+      unsigned mask = 0;
+      for (int i = 0; i < kNodeKeys; i += 4) {
+        __m128 a = _mm_load_ps(keys + i);
+        __m128 less = KeyFirst ? _mm_cmplt_ps(x, a) : _mm_cmplt_ps(a, x);
+        mask |= static_cast<unsigned>(_mm_movemask_ps(less)) << i;
+      }
+      return mask;
+    } else if constexpr (std::is_same_v<Key, double>) {
+      __m128d x = _mm_set1_pd(key);
+      unsigned mask = 0;
+      for (int i = 0; i < kNodeKeys; i += 2) {
+        __m128d a = _mm_load_pd(keys + i);
+        __m128d less = KeyFirst ? _mm_cmplt_pd(x, a) : _mm_cmplt_pd(a, x);
+        mask |= static_cast<unsigned>(_mm_movemask_pd(less)) << i;
+      }
+      return mask;
+    }
+#endif
+    unsigned mask = 0;
+    for (int i = 0; i < kNodeKeys; ++i) {
+      mask |= static_cast<unsigned>(KeyFirst ? key < keys[i] : keys[i] < key) << i;
+    }
+    return mask;
+  }
+
+  // The keys are sorted, so counts are positions
+
+  static int CountLess(const Key* keys, int used, Key key) {
+    return std::popcount(CompareMask<false>(keys, key) & ((1u << used) - 1));
+  }
+
+  static int CountNotGreater(const Key* keys, int used, Key key) {
+    return std::popcount(~CompareMask<true>(keys, key) & ((1u << used) - 1));
+  }
+
+  Leaf* Descend(Key key, Path* path) const {
+    Node* node = root;
+    for (std::size_t level = 0; level + 1 < height; ++level) {
+      Inner* inner = static_cast<Inner*>(node);
+      int child = CountNotGreater(inner->keys, inner->count - 1, key);
+      if (path != nullptr) {
+        path->nodes[level] = inner;
+        path->index[level] = child;
+      }
+      node = inner->children[child];
+    }
+    return static_cast<Leaf*>(node);
+  }
+
+  // Slot may be one past the last key of the leaf, which is the first key of the next one
+  const_iterator At(const Leaf* leaf, int slot) const {
+    if (slot == leaf->count) {
+      return const_iterator(leaf->next, 0, this);
+    }
+    return const_iterator(leaf, slot, this);
+  }
+
+  // Removes keys[slot] of the leaf reached through path; returns the element that followed
+  const_iterator EraseAt(Leaf* leaf, int slot, Path& path) {
+    --count;
+    for (std::size_t level = 0; level + 1 < height; ++level) {
+      --path.nodes[level]->sizes[path.index[level]];
+    }
+    std::copy(leaf->keys + slot + 1, leaf->keys + leaf->count, leaf->keys + slot);
+    --leaf->count;
+    leaf = Rebalance(leaf, path, slot);
+    return leaf == nullptr ? end() : At(leaf, slot);
+  }
+
+  static std::size_t Total(const Inner* inner) {
+    std::size_t total = 0;
+    for (int i = 0; i < inner->count; ++i) {
+      total += inner->sizes[i];
+    }
+    return total;
+  }
+
+  static void InsertKey(Leaf* leaf, int slot, Key key) {
+    std::copy_backward(leaf->keys + slot, leaf->keys + leaf->count, leaf->keys + leaf->count + 1);
+    leaf->keys[slot] = key;
+    ++leaf->count;
+  }
+
+  // Moves the upper half of a full leaf to the empty right
+  void SplitLeaf(Leaf* leaf, Leaf* right) {
+    std::copy(leaf->keys + kMinKeys, leaf->keys + kNodeKeys, right->keys);
+    right->count = kNodeKeys - kMinKeys;
+    leaf->count = kMinKeys;
+    right->prev = leaf;
+    right->next = leaf->next;
+    (leaf->next != nullptr ? leaf->next->prev : last) = right;
+    leaf->next = right;
+  }
+
+  // child goes right after children[index]
+  static void InsertChild(Inner* inner, int index, Key separator, Node* child, std::size_t size) {
+    std::copy_backward(inner->keys + index, inner->keys + inner->count - 1, inner->keys + inner->count);
+    std::copy_backward(inner->children + index + 1, inner->children + inner->count, inner->children + inner->count + 1);
+    std::copy_backward(inner->sizes + index + 1, inner->sizes + inner->count, inner->sizes + inner->count + 1);
+    inner->keys[index] = separator;
+    inner->children[index + 1] = child;
+    inner->sizes[index + 1] = size;
+    ++inner->count;
+    child->parent = inner;
+  }
+
+  // Inserts the child into a full node and moves the upper half to the empty sibling;
+  // separator becomes the key between the two
+  static void SplitInner(Inner* inner, Inner* sibling, int index, Key& separator, Node* child, std::size_t size) {
+    Key keys[kNodeKeys];
+    Node* children[kNodeKeys + 1];
+    std::size_t sizes[kNodeKeys + 1];
+    std::copy(inner->keys, inner->keys + kNodeKeys - 1, keys);
+    std::copy(inner->children, inner->children + kNodeKeys, children);
+    std::copy(inner->sizes, inner->sizes + kNodeKeys, sizes);
+    std::copy_backward(keys + index, keys + kNodeKeys - 1, keys + kNodeKeys);
+    std::copy_backward(children + index + 1, children + kNodeKeys, children + kNodeKeys + 1);
+    std::copy_backward(sizes + index + 1, sizes + kNodeKeys, sizes + kNodeKeys + 1);
+    keys[index] = separator;
+    children[index + 1] = child;
+    sizes[index + 1] = size;
+
+    constexpr int kLeftChildren = kNodeKeys / 2 + 1;
+    std::copy(keys, keys + kLeftChildren - 1, inner->keys);
+    std::copy(children, children + kLeftChildren, inner->children);
+    std::copy(sizes, sizes + kLeftChildren, inner->sizes);
+    inner->count = kLeftChildren;
+    separator = keys[kLeftChildren - 1];
+    std::copy(keys + kLeftChildren, keys + kNodeKeys, sibling->keys);
+    std::copy(children + kLeftChildren, children + kNodeKeys + 1, sibling->children);
+    std::copy(sizes + kLeftChildren, sizes + kNodeKeys + 1, sibling->sizes);
+    sibling->count = kNodeKeys + 1 - kLeftChildren;
+    child->parent = inner; // moved to the sibling below if it went there
+    for (int i = 0; i < sibling->count; ++i) {
+      sibling->children[i]->parent = sibling;
+    }
+  }
+
+  // After an erase: an underfull node borrows from a sibling or merges with it, which may
+  // leave the parent underfull in turn. Returns the leaf now holding keys[slot] of leaf and
+  // updates slot, or nullptr if the tree became empty.
+  Leaf* Rebalance(Leaf* leaf, Path& path, int& slot) {
+    Node* node = leaf;
+    for (int level = static_cast<int>(height) - 2; level >= 0 && node->count < kMinKeys; --level) {
+      Inner* parent = path.nodes[level];
+      int index = path.index[level];
+      bool is_leaf = level == static_cast<int>(height) - 2;
+      int left = index > 0 ? index - 1 : index; // merge or borrow between children left and left + 1
+      Node* lower = parent->children[left];
+      Node* upper = parent->children[left + 1];
+      Node* sibling = left == index ? upper : lower;
+      if (sibling->count > kMinKeys) {
+        if (is_leaf) {
+          BorrowLeaf(parent, left, static_cast<Leaf*>(lower), static_cast<Leaf*>(upper), sibling == lower);
+          slot += sibling == lower; // the borrowed key went in front
+        } else {
+          BorrowInner(parent, left, static_cast<Inner*>(lower), static_cast<Inner*>(upper), sibling == lower);
+        }
+        return leaf;
+      }
+      if (is_leaf) {
+        if (leaf == upper) {
+          slot += lower->count;
+          leaf = static_cast<Leaf*>(lower);
+        }
+        MergeLeaves(static_cast<Leaf*>(lower), static_cast<Leaf*>(upper));
+      } else {
+        MergeInner(static_cast<Inner*>(lower), parent->keys[left], static_cast<Inner*>(upper));
+      }
+      parent->sizes[left] += parent->sizes[left + 1];
+      RemoveChild(parent, left + 1);
+      node = parent;
+    }
+    if (height > 1 && root->count == 1) {
+      Inner* old_root = static_cast<Inner*>(root);
+      root = old_root->children[0];
+      root->parent = nullptr;
+      --height;
+      DeleteInner(old_root);
+    } else if (height == 1 && root->count == 0) {
+      DeleteLeaf(static_cast<Leaf*>(root));
+      root = nullptr;
+      first = last = nullptr;
+      height = 0;
+      return nullptr;
+    }
+    return leaf;
+  }
+
+  // Moves one key between neighbouring leaves children[left] and children[left + 1]
+  static void BorrowLeaf(Inner* parent, int left, Leaf* lower, Leaf* upper, bool from_lower) {
+    if (from_lower) {
+      InsertKey(upper, 0, lower->keys[--lower->count]);
+      --parent->sizes[left];
+      ++parent->sizes[left + 1];
+    } else {
+      lower->keys[lower->count++] = upper->keys[0];
+      std::copy(upper->keys + 1, upper->keys + upper->count, upper->keys);
+      --upper->count;
+      ++parent->sizes[left];
+      --parent->sizes[left + 1];
+    }
+    parent->keys[left] = upper->keys[0];
+  }
+
+  // Moves one child between neighbouring inner nodes through the separator in the parent
+  static void BorrowInner(Inner* parent, int left, Inner* lower, Inner* upper, bool from_lower) {
+    std::size_t moved;
+    if (from_lower) {
+      int last_child = --lower->count;
+      moved = lower->sizes[last_child];
+      std::copy_backward(upper->keys, upper->keys + upper->count - 1, upper->keys + upper->count);
+      std::copy_backward(upper->children, upper->children + upper->count, upper->children + upper->count + 1);
+      std::copy_backward(upper->sizes, upper->sizes + upper->count, upper->sizes + upper->count + 1);
+      upper->keys[0] = parent->keys[left];
+      upper->children[0] = lower->children[last_child];
+      upper->children[0]->parent = upper;
+      upper->sizes[0] = moved;
+      ++upper->count;
+      parent->keys[left] = lower->keys[last_child - 1];
+      parent->sizes[left] -= moved;
+      parent->sizes[left + 1] += moved;
+    } else {
+      moved = upper->sizes[0];
+      lower->keys[lower->count - 1] = parent->keys[left];
+      lower->children[lower->count] = upper->children[0];
+      lower->children[lower->count]->parent = lower;
+      lower->sizes[lower->count] = moved;
+      ++lower->count;
+      parent->keys[left] = upper->keys[0];
+      std::copy(upper->keys + 1, upper->keys + upper->count - 1, upper->keys);
+      std::copy(upper->children + 1, upper->children + upper->count, upper->children);
+      std::copy(upper->sizes + 1, upper->sizes + upper->count, upper->sizes);
+      --upper->count;
+      parent->sizes[left] += moved;
+      parent->sizes[left + 1] -= moved;
+    }
+  }
+
+  // Appends upper to lower and frees it
+  void MergeLeaves(Leaf* lower, Leaf* upper) {
+    std::copy(upper->keys, upper->keys + upper->count, lower->keys + lower->count);
+    lower->count += upper->count;
+    lower->next = upper->next;
+    (upper->next != nullptr ? upper->next->prev : last) = lower;
+    DeleteLeaf(upper);
+  }
+
+  void MergeInner(Inner* lower, Key separator, Inner* upper) {
+    lower->keys[lower->count - 1] = separator;
+    std::copy(upper->keys, upper->keys + upper->count - 1, lower->keys + lower->count);
+    std::copy(upper->children, upper->children + upper->count, lower->children + lower->count);
+    std::copy(upper->sizes, upper->sizes + upper->count, lower->sizes + lower->count);
+    for (int i = 0; i < upper->count; ++i) {
+      upper->children[i]->parent = lower;
+    }
+    lower->count += upper->count;
+    DeleteInner(upper);
+  }
+
+  // Removes children[index] and the key left of it
+  static void RemoveChild(Inner* inner, int index) {
+    std::copy(inner->keys + index, inner->keys + inner->count - 1, inner->keys + index - 1);
+    std::copy(inner->children + index + 1, inner->children + inner->count, inner->children + index);
+    std::copy(inner->sizes + index + 1, inner->sizes + inner->count, inner->sizes + index);
+    --inner->count;
+  }
+
+  // Copies a subtree of the given height; previous is the last leaf copied so far
+  Node* CloneSubtree(const Node* source, std::size_t levels, Leaf*& previous) {
+    if (levels == 1) {
+      Leaf* leaf = NewLeaf();
+      std::copy(source->keys, source->keys + source->count, leaf->keys);
+      leaf->count = source->count;
+      leaf->prev = previous;
+      (previous != nullptr ? previous->next : first) = leaf;
+      previous = leaf;
+      return leaf;
+    }
+    const Inner* from = static_cast<const Inner*>(source);
+    Inner* inner = NewInner();
+    std::copy(from->keys, from->keys + from->count - 1, inner->keys);
+    std::copy(from->sizes, from->sizes + from->count, inner->sizes);
+    try {
+      for (; inner->count < from->count; ++inner->count) {
+        inner->children[inner->count] = CloneSubtree(from->children[inner->count], levels - 1, previous);
+        inner->children[inner->count]->parent = inner;
+      }
+    } catch (...) {
+      DestroySubtree(inner, levels);
+      throw;
+    }
+    return inner;
+  }
+
+  void DestroySubtree(Node* node, std::size_t levels) noexcept {
+    if (levels == 1) {
+      DeleteLeaf(static_cast<Leaf*>(node));
+      return;
+    }
+    Inner* inner = static_cast<Inner*>(node);
+    for (int i = 0; i < inner->count; ++i) {
+      DestroySubtree(inner->children[i], levels - 1);
+    }
+    DeleteInner(inner);
+  }
+
+  Leaf* NewLeaf() {
+    Leaf* leaf = LeafAllocTraits::allocate(leaf_alloc, 1);
+    LeafAllocTraits::construct(leaf_alloc, leaf);
+    return leaf;
+  }
+
+  Inner* NewInner() {
+    Inner* inner = InnerAllocTraits::allocate(inner_alloc, 1);
+    InnerAllocTraits::construct(inner_alloc, inner);
+    return inner;
+  }
+
+  void DeleteLeaf(Leaf* leaf) noexcept {
+    LeafAllocTraits::destroy(leaf_alloc, leaf);
+    LeafAllocTraits::deallocate(leaf_alloc, leaf, 1);
+  }
+
+  void DeleteInner(Inner* inner) noexcept {
+    InnerAllocTraits::destroy(inner_alloc, inner);
+    InnerAllocTraits::deallocate(inner_alloc, inner, 1);
+  }
+
+  Node* root = nullptr;
+  Leaf* first = nullptr;
+  Leaf* last = nullptr;
+  std::size_t height = 0; // levels of nodes, leaves included
+  std::size_t count = 0;
+  [[no_unique_address]] LeafAlloc leaf_alloc;
+  [[no_unique_address]] InnerAlloc inner_alloc;
+};
+
+template <typename ValueType, typename Compare, typename Alloc,
+          bool UseSimd = std::is_arithmetic_v<ValueType> && !std::is_same_v<ValueType, bool> &&
+                         std::is_same_v<Compare, std::less<ValueType>>>
+struct OrderedSetSelector {
+  using type = RedBlackTree<ValueType, Compare, Alloc>;
+};
+
+template <typename ValueType, typename Compare, typename Alloc>
+struct OrderedSetSelector<ValueType, Compare, Alloc, true> {
+  using type = SimdBTree<ValueType, Alloc>;
+};
+
+// SimdBTree for arithmetic keys under std::less, RedBlackTree for everything else
+template <typename ValueType, typename Compare = std::less<ValueType>, typename Alloc = std::allocator<ValueType>>
+using OrderedSet = typename OrderedSetSelector<ValueType, Compare, Alloc>::type;
+
+#endif // NENIY_SIMDBTREE
@@ -0,0 +1,74 @@
+// Insert/erase throughput and traversal cache misses with std::allocator and PoolAllocator
+// Build: g++ -O2 -std=c++20 allocator_benchmark.cpp -o allocator_benchmark
+// Usage: ./allocator_benchmark [count = 10000000]
+#include "../PoolAllocator.h"
+#include "../RedBlackTree.h"
+#include "perf_counters.h"
+#include "timing.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <numeric>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+template <typename Alloc>
+void Run(const std::string& name, const std::vector<int>& keys) {
+  double count = keys.size();
+  CacheMissCounter misses;
+  RedBlackTree<int, std::less<int>, Alloc> tree;
+
+  auto start = std::chrono::steady_clock::now();
+  for (int key : keys) {
+    tree.insert(key);
+  }
+  std::cout << name << " insert:   " << count / SecondsSince(start) / 1e6 << " Mops/s\n";
+
+  long long sum = 0;
+  misses.start();
+  start = std::chrono::steady_clock::now();
+  for (int value : tree) {
+    sum += value;
+  }
+  double seconds = SecondsSince(start);
+  auto traversal_misses = misses.stop();
+  std::cout << name << " traverse: " << seconds * 1e9 / count << " ns/element, cache misses/element: ";
+  if (traversal_misses) {
+    std::cout << *traversal_misses / count;
+  } else {
+    std::cout << "n/a";
+  }
+  std::cout << " (checksum " << sum << ")\n";
+
+  start = std::chrono::steady_clock::now();
+  for (std::size_t i = 0; i < keys.size(); i += 2) { // churn: erase half, insert it back
+    tree.erase(keys[i]);
+  }
+  for (std::size_t i = 0; i < keys.size(); i += 2) {
+    tree.insert(keys[i]);
+  }
+  std::cout << name << " churn:    " << count / SecondsSince(start) / 1e6 << " Mops/s\n";
+
+  start = std::chrono::steady_clock::now();
+  for (int key : keys) {
+    tree.erase(key);
+  }
+  std::cout << name << " erase:    " << count / SecondsSince(start) / 1e6 << " Mops/s\n";
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  std::size_t count = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 10'000'000;
+  std::vector<int> keys(count);
+  std::iota(keys.begin(), keys.end(), 0);
+  std::shuffle(keys.begin(), keys.end(), std::mt19937(42));
+
+  Run<std::allocator<int>>("std::allocator ", keys);
+  Run<PoolAllocator<int>>("PoolAllocator  ", keys);
+}
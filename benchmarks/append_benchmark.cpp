@@ -0,0 +1,69 @@
+// Append-heavy workloads: plain insert vs hinted insert vs insert_range
+// Build: g++ -O2 -std=c++20 append_benchmark.cpp -o append_benchmark
+// Usage: ./append_benchmark [count = 5000000]
+#include "../RedBlackTree.h"
+#include "timing.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <numeric>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+template <typename Fill>
+void Run(const std::string& name, std::size_t count, RedBlackTree<long long> tree, Fill fill) {
+  auto start = std::chrono::steady_clock::now();
+  fill(tree);
+  std::cout << name << count / SecondsSince(start) / 1e6 << " Mops/s (size " << tree.size() << ")\n";
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  std::size_t count = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 5'000'000;
+
+  // Monotonically increasing timestamps with random gaps
+  std::vector<long long> timestamps(count);
+  std::mt19937 rng(42);
+  long long now = 0;
+  for (long long& timestamp : timestamps) {
+    now += 1 + rng() % 1000;
+    timestamp = now;
+  }
+
+  Run("append, insert(value):        ", count, {}, [&](auto& tree) {
+    for (long long timestamp : timestamps) {
+      tree.insert(timestamp);
+    }
+  });
+  Run("append, insert(end(), value): ", count, {}, [&](auto& tree) {
+    for (long long timestamp : timestamps) {
+      tree.insert(tree.end(), timestamp);
+    }
+  });
+  Run("append, insert_range:         ", count, {}, [&](auto& tree) {
+    tree.insert_range(timestamps.begin(), timestamps.end());
+  });
+
+  // Sorted batch of odd keys merged into a tree of even keys
+  std::vector<long long> evens(count), batch(count);
+  std::iota(evens.begin(), evens.end(), 0);
+  for (std::size_t i = 0; i < count; ++i) {
+    evens[i] *= 2;
+    batch[i] = evens[i] + 1;
+  }
+  Run("sorted batch, insert(value):  ", count, RedBlackTree<long long>(evens.begin(), evens.end()),
+      [&](auto& tree) {
+        for (long long key : batch) {
+          tree.insert(key);
+        }
+      });
+  Run("sorted batch, insert_range:   ", count, RedBlackTree<long long>(evens.begin(), evens.end()),
+      [&](auto& tree) {
+        tree.insert_range(batch.begin(), batch.end());
+      });
+}
@@ -0,0 +1,128 @@
+// Red-black against weak AVL balancing: rotations and repair steps per operation from
+// StatsTreePolicy, node depth from shape_report() and timings of trees without counters,
+// for random and sorted insertions, lookups, an erase + insert churn and a random drain
+// Build: g++ -O2 -std=c++20 balancing_benchmark.cpp -o balancing_benchmark
+// Usage: ./balancing_benchmark [elements = 1000000] [churn operations = 2000000]
+#include "../RedBlackTree.h"
+#include "timing.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <numeric>
+#include <random>
+#include <vector>
+
+namespace {
+
+using Key = std::uint64_t;
+
+struct Workload {
+  std::vector<Key> random;   // distinct keys in random order
+  std::vector<Key> lookups;  // present keys
+  std::vector<std::size_t> churn_positions;
+  std::vector<Key> churn_keys;
+};
+
+// Runs every phase on a tree; with counters it prints rotations and repair steps per
+// operation, otherwise nanoseconds per operation
+template <typename Tree>
+void Run(const char* name, const Workload& work) {
+  constexpr bool kCounted = requires(Tree tree) { tree.stats(); };
+  Tree tree;
+  std::size_t operations = 0;
+  Key checksum = 0;
+  auto start = std::chrono::steady_clock::now();
+
+  auto report = [&](const char* phase) {
+    double ns = NanosecondsSince(start);
+    std::cout << name << ", " << phase << ": ";
+    if constexpr (kCounted) {
+      TreeStats stats = tree.stats();
+      auto per_op = [&](std::uint64_t value) { return static_cast<double>(value) / static_cast<double>(operations); };
+      std::cout << per_op(stats.rotations) << " rotations/op, " << per_op(stats.recolor_steps) << " insert repair steps/op, "
+                << per_op(stats.delete_repair_steps) << " erase repair steps/op, " << per_op(stats.comparisons)
+                << " comparisons/op";
+      TreeShape shape = tree.shape_report();
+      std::cout << "; height " << shape.height << ", average depth " << shape.average_depth << "\n";
+      tree.reset_stats();
+    } else {
+      std::cout << ns / static_cast<double>(operations) << " ns/op\n";
+    }
+    operations = 0;
+    start = std::chrono::steady_clock::now();
+  };
+
+  for (Key key : work.random) {
+    tree.insert(key);
+  }
+  operations = work.random.size();
+  report("random inserts");
+
+  for (Key key : work.lookups) {
+    checksum += *tree.find(key);
+  }
+  operations = work.lookups.size();
+  report("lookups");
+
+  for (std::size_t i = 0; i < work.churn_keys.size(); ++i) {
+    tree.erase(tree.statistic(work.churn_positions[i] % tree.size()));
+    tree.insert(work.churn_keys[i]);
+  }
+  operations = 2 * work.churn_keys.size();
+  report("erase + insert churn");
+
+  for (Key key : work.lookups) {
+    checksum += tree.find(key) != tree.end();
+  }
+  operations = work.lookups.size();
+  report("lookups after churn");
+
+  while (!tree.empty()) {
+    tree.erase(tree.statistic(work.churn_positions[operations % work.churn_positions.size()] % tree.size()));
+    ++operations;
+  }
+  report("random drain");
+
+  for (std::size_t i = 0; i < work.random.size(); ++i) {
+    tree.insert(static_cast<Key>(i));
+  }
+  operations = work.random.size();
+  report("sorted inserts");
+
+  if constexpr (!kCounted) {
+    std::cout << name << ": checksum " << checksum << "\n";
+  }
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  std::size_t count = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1'000'000;
+  std::size_t churn = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 2'000'000;
+
+  Workload work;
+  std::mt19937_64 rng(42);
+  work.random.resize(count);
+  std::iota(work.random.begin(), work.random.end(), Key(0));
+  for (Key& key : work.random) {
+    key = key * 2 + 1; // churn keys are even, so they never collide
+  }
+  std::shuffle(work.random.begin(), work.random.end(), rng);
+  work.lookups = work.random;
+  std::shuffle(work.lookups.begin(), work.lookups.end(), rng);
+  work.churn_positions.resize(churn);
+  work.churn_keys.resize(churn);
+  for (std::size_t i = 0; i < churn; ++i) {
+    work.churn_positions[i] = rng();
+    work.churn_keys[i] = (rng() % (4 * count)) * 2;
+  }
+
+  using Alloc = std::allocator<Key>;
+  Run<RedBlackTree<Key, std::less<Key>, Alloc, StatsTreePolicy<>>>("red-black", work);
+  Run<RedBlackTree<Key, std::less<Key>, Alloc, StatsTreePolicy<WeakAvlTreePolicy<>>>>("weak AVL ", work);
+  Run<RedBlackTree<Key>>("red-black", work);
+  Run<RedBlackTree<Key, std::less<Key>, Alloc, WeakAvlTreePolicy<>>>("weak AVL ", work);
+}
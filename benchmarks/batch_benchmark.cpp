@@ -0,0 +1,82 @@
+// Throughput of find_batch/statistic_batch against a loop of single lookups
+// Build: g++ -O2 -std=c++20 batch_benchmark.cpp -o batch_benchmark
+// Usage: ./batch_benchmark [count = 10000000]   (the tree should not fit in cache)
+#include "../RedBlackTree.h"
+#include "timing.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <numeric>
+#include <random>
+#include <vector>
+
+namespace {
+
+constexpr std::size_t kQueries = 4'000'000;
+
+using Tree = RedBlackTree<std::uint64_t>;
+
+template <typename Body>
+double NanosecondsPerQuery(Body body) {
+  auto start = std::chrono::steady_clock::now();
+  body();
+  return NanosecondsPer(start, kQueries);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  std::size_t count = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 10'000'000;
+  std::mt19937_64 rng(42);
+  std::vector<std::uint64_t> keys(count);
+  std::iota(keys.begin(), keys.end(), 0);
+  std::shuffle(keys.begin(), keys.end(), rng);
+  Tree tree;
+  for (std::uint64_t key : keys) {
+    tree.insert(key * 2);
+  }
+
+  std::vector<std::uint64_t> queries(kQueries);
+  std::vector<std::size_t> ranks(kQueries);
+  for (std::size_t i = 0; i < kQueries; ++i) {
+    queries[i] = rng() % (count * 2);
+    ranks[i] = rng() % count;
+  }
+  std::vector<Tree::iterator> out(kQueries);
+
+  std::size_t checksum = 0;
+  double single_find = NanosecondsPerQuery([&] {
+    for (std::size_t i = 0; i < kQueries; ++i) {
+      out[i] = tree.find(queries[i]);
+    }
+  });
+  double single_statistic = NanosecondsPerQuery([&] {
+    for (std::size_t i = 0; i < kQueries; ++i) {
+      out[i] = tree.statistic(ranks[i]);
+    }
+  });
+  checksum += out[kQueries / 2] != tree.end();
+  std::cout << "loop of find():      " << single_find << " ns/query\n";
+  std::cout << "loop of statistic(): " << single_statistic << " ns/query\n";
+
+  for (std::size_t batch : {64, 256, 1024}) {
+    double batch_find = NanosecondsPerQuery([&] {
+      for (std::size_t i = 0; i < kQueries; i += batch) {
+        tree.find_batch(std::span(queries).subspan(i, std::min(batch, kQueries - i)), std::span(out).subspan(i));
+      }
+    });
+    double batch_statistic = NanosecondsPerQuery([&] {
+      for (std::size_t i = 0; i < kQueries; i += batch) {
+        tree.statistic_batch(std::span(ranks).subspan(i, std::min(batch, kQueries - i)), std::span(out).subspan(i));
+      }
+    });
+    checksum += out[kQueries / 2] != tree.end();
+    std::cout << "batch " << batch << ": find_batch " << batch_find << " ns/query ("
+              << single_find / batch_find << "x), statistic_batch " << batch_statistic << " ns/query ("
+              << single_statistic / batch_statistic << "x)\n";
+  }
+  std::cout << "checksum " << checksum << '\n';
+}
@@ -0,0 +1,50 @@
+// Teardown cost: clear() against erasing elements one by one
+// Build: g++ -O2 -std=c++20 clear_benchmark.cpp -o clear_benchmark
+// Usage: ./clear_benchmark [count = 10000000]
+#include "../RedBlackTree.h"
+#include "timing.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <numeric>
+#include <random>
+#include <vector>
+
+int main(int argc, char** argv) {
+  std::size_t count = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 10'000'000;
+  std::vector<int> keys(count);
+  std::iota(keys.begin(), keys.end(), 0);
+  std::shuffle(keys.begin(), keys.end(), std::mt19937(42));
+
+  {
+    RedBlackTree<int> tree;
+    for (int key : keys) {
+      tree.insert(key);
+    }
+    auto start = std::chrono::steady_clock::now();
+    while (!tree.empty()) {
+      tree.erase(tree.begin());
+    }
+    std::cout << "erase(begin()) loop: " << MillisecondsSince(start) << " ms\n";
+  }
+  {
+    RedBlackTree<int> tree;
+    for (int key : keys) {
+      tree.insert(key);
+    }
+    auto start = std::chrono::steady_clock::now();
+    tree.clear();
+    std::cout << "clear():             " << MillisecondsSince(start) << " ms\n";
+  }
+  {
+    auto* tree = new RedBlackTree<int>;
+    for (int key : keys) {
+      tree->insert(key);
+    }
+    auto start = std::chrono::steady_clock::now();
+    delete tree;
+    std::cout << "~RedBlackTree():     " << MillisecondsSince(start) << " ms\n";
+  }
+}
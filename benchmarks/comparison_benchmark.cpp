@@ -0,0 +1,622 @@
+// RedBlackTree against std::set and the __gnu_pbds order-statistic tree: insert, find,
+// find_less_than, find_greater_than, statistic, iteration, copy, mixed reads and writes
+// and erase, for int, uint64_t and string keys under several key orders and sizes.
+// Prints ns/op, throughput and resident memory per element, and optionally cache misses
+// and a JSON report for tracking results across commits.
+// Build: cmake -S .. -B build && cmake --build build --target comparison_benchmark
+//        (or g++ -O2 -std=c++20 comparison_benchmark.cpp -o comparison_benchmark)
+// Usage: ./comparison_benchmark [--sizes 1000,1000000,100000000] [--keys int,uint64,string]
+//          [--workloads uniform,sorted,reverse,zipfian,mixed] [--containers rbtree,std_set,pbds]
+//          [--seed 42] [--target-ops 1000000] [--json results.json] [--perf] [--check]
+//   --target-ops  repeat small sizes until every operation ran about this many times
+//   --perf        cache misses per operation, where perf events are available
+//   --check       fail unless all containers agree on every result and the trees validate()
+#include "../RedBlackTree.h"
+#include "perf_counters.h"
+#include "timing.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <numeric>
+#include <optional>
+#include <random>
+#include <set>
+#include <sstream>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#if __has_include(<ext/pb_ds/assoc_container.hpp>)
+#include <ext/pb_ds/assoc_container.hpp>
+#include <ext/pb_ds/tree_policy.hpp>
+#define NENIY_BENCHMARK_PBDS 1
+#endif
+
+#if defined(__linux__)
+#include <unistd.h>
+#endif
+
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+namespace {
+
+constexpr std::size_t kMaxRounds = 1'000;
+constexpr std::size_t kMaxQueries = 1'000'000; // lookups per round
+
+struct Options {
+  std::vector<std::size_t> sizes = {1'000, 100'000, 1'000'000};
+  std::vector<std::string> keys = {"int", "uint64", "string"};
+  std::vector<std::string> workloads = {"uniform", "sorted", "reverse", "zipfian", "mixed"};
+  std::vector<std::string> containers = {"rbtree", "std_set", "pbds"};
+  std::uint64_t seed = 42;
+  // Every operation is repeated on rebuilt containers until it has run about this many
+  // times, so small sizes are not dominated by timer noise
+  std::size_t target_ops = 1'000'000;
+  std::string json;
+  bool perf = false;
+  bool check = false;
+};
+
+// Element i of the key space, increasing in i; containers hold the even ones, odd ones miss
+template <typename Key>
+Key MakeKey(std::uint64_t i);
+
+template <>
+int MakeKey<int>(std::uint64_t i) {
+  return static_cast<int>(i);
+}
+
+template <>
+std::uint64_t MakeKey<std::uint64_t>(std::uint64_t i) {
+  return i * 1'000'003;
+}
+
+template <> // longer than the small string buffer, with a shared prefix like real identifiers
+std::string MakeKey<std::string>(std::uint64_t i) {
+  char buffer[32];
+  std::snprintf(buffer, sizeof(buffer), "user:%016llu", static_cast<unsigned long long>(i));
+  return buffer;
+}
+
+template <typename Key>
+std::size_t Digest(const Key* key) {
+  return key == nullptr ? 0 : std::hash<Key>()(*key) % 1'000'003 + 1;
+}
+
+// Zipf ranks in [0, n) with skew theta as in Gray et al., "Quickly generating
+// billion-record synthetic databases"; rank 0 is the most popular
+class ZipfGenerator {
+ public:
+  ZipfGenerator(std::uint64_t n, double theta) : n(n), theta(theta) {
+    zeta_n = Zeta(n);
+    alpha = 1 / (1 - theta);
+    eta = (1 - std::pow(2.0 / static_cast<double>(n), 1 - theta)) / (1 - Zeta(2) / zeta_n);
+  }
+
+  template <typename Rng>
+  std::uint64_t operator()(Rng& rng) {
+    double u = std::uniform_real_distribution<double>(0, 1)(rng);
+    double uz = u * zeta_n;
+    if (uz < 1) {
+      return 0;
+    }
+    if (uz < 1 + std::pow(0.5, theta)) {
+      return 1;
+    }
+    auto rank = static_cast<std::uint64_t>(static_cast<double>(n) * std::pow(eta * u - eta + 1, alpha));
+    return std::min(rank, n - 1);
+  }
+
+ private:
+  double Zeta(std::uint64_t count) const {
+    double sum = 0;
+    for (std::uint64_t i = 1; i <= count; ++i) {
+      sum += 1 / std::pow(static_cast<double>(i), theta);
+    }
+    return sum;
+  }
+
+  std::uint64_t n;
+  double theta;
+  double zeta_n;
+  double alpha;
+  double eta;
+};
+
+enum class MixedKind { kFind, kInsert, kErase };
+
+// Keys of one workload, shared by all containers so that their checksums must agree
+template <typename Key>
+struct Streams {
+  std::vector<Key> inserts; // the n even keys in insertion order
+  std::vector<Key> queries; // lookups, half of them missing unless skewed
+  std::vector<std::size_t> positions; // for statistic
+  std::vector<std::pair<MixedKind, Key>> mixed;
+  std::vector<Key> erases; // the n even keys in erase order
+};
+
+// uniform: random order and lookups; sorted and reverse: ascending or descending inserts,
+// sweeps and erases; zipfian: random order, Zipf(0.99) lookups of present keys with the
+// hot ones scattered over the key space; mixed: zipfian plus a stream of 90% lookups, 5%
+// inserts and 5% erases of missing keys
+template <typename Key>
+Streams<Key> MakeStreams(const std::string& workload, std::size_t n, std::uint64_t seed) {
+  std::mt19937_64 rng(seed);
+  std::size_t query_count = std::min(n, kMaxQueries);
+  std::vector<std::uint64_t> order(n);
+  std::iota(order.begin(), order.end(), 0);
+  bool ascending = workload == "sorted";
+  bool descending = workload == "reverse";
+  if (descending) {
+    std::reverse(order.begin(), order.end());
+  } else if (!ascending) {
+    std::shuffle(order.begin(), order.end(), rng);
+  }
+
+  Streams<Key> streams;
+  streams.inserts.reserve(n);
+  for (std::uint64_t i : order) {
+    streams.inserts.push_back(MakeKey<Key>(2 * i));
+  }
+  if (!ascending && !descending) {
+    std::shuffle(order.begin(), order.end(), rng);
+  }
+  streams.erases.reserve(n);
+  for (std::uint64_t i : order) {
+    streams.erases.push_back(MakeKey<Key>(2 * i));
+  }
+
+  std::optional<ZipfGenerator> zipf;
+  if (workload == "zipfian" || workload == "mixed") {
+    zipf.emplace(n, 0.99);
+  }
+  auto hot_key = [&] { return MakeKey<Key>(2 * ((*zipf)(rng) * 0x9E3779B97F4A7C15ULL % n)); };
+  streams.queries.reserve(query_count);
+  streams.positions.reserve(query_count);
+  for (std::size_t q = 0; q < query_count; ++q) {
+    std::uint64_t sweep = static_cast<std::uint64_t>(static_cast<double>(q) / static_cast<double>(query_count) * 2 * n);
+    if (ascending) {
+      streams.queries.push_back(MakeKey<Key>(sweep));
+      streams.positions.push_back(sweep / 2);
+    } else if (descending) {
+      streams.queries.push_back(MakeKey<Key>(2 * n - 1 - sweep));
+      streams.positions.push_back(n - 1 - sweep / 2);
+    } else {
+      streams.queries.push_back(zipf ? hot_key() : MakeKey<Key>(rng() % (2 * n)));
+      streams.positions.push_back(rng() % n);
+    }
+  }
+  if (workload == "mixed") {
+    streams.mixed.reserve(query_count);
+    for (std::size_t q = 0; q < query_count; ++q) {
+      std::uint64_t dice = rng() % 20;
+      if (dice == 0) {
+        streams.mixed.emplace_back(MixedKind::kInsert, MakeKey<Key>(2 * (rng() % n) + 1));
+      } else if (dice == 1) {
+        streams.mixed.emplace_back(MixedKind::kErase, MakeKey<Key>(2 * (rng() % n) + 1));
+      } else {
+        streams.mixed.emplace_back(MixedKind::kFind, hot_key());
+      }
+    }
+  }
+  return streams;
+}
+
+// The operations under test, spelled for each container
+
+template <typename Key>
+struct RedBlackTreeSubject {
+  using Container = RedBlackTree<Key>;
+  static constexpr const char* kName = "rbtree";
+  static constexpr bool kHasStatistic = true;
+
+  static const Key* Pointer(const Container& tree, typename Container::const_iterator it) {
+    return it == tree.end() ? nullptr : &*it;
+  }
+
+  static bool Insert(Container& tree, const Key& key) { return tree.insert(key).second; }
+  static std::size_t Erase(Container& tree, const Key& key) { return tree.erase(key); }
+  static const Key* Find(const Container& tree, const Key& key) { return Pointer(tree, tree.find(key)); }
+  static const Key* LessThan(const Container& tree, const Key& key) { return Pointer(tree, tree.find_less_than(key)); }
+  static const Key* GreaterThan(const Container& tree, const Key& key) {
+    return Pointer(tree, tree.find_greater_than(key));
+  }
+  static const Key* Statistic(const Container& tree, std::size_t k) { return Pointer(tree, tree.statistic(k)); }
+  static void Validate(const Container& tree) { tree.validate(); }
+};
+
+template <typename Key>
+struct StdSetSubject {
+  using Container = std::set<Key>;
+  static constexpr const char* kName = "std_set";
+  static constexpr bool kHasStatistic = false; // std::next is O(n)
+
+  static const Key* Pointer(const Container& set, typename Container::const_iterator it) {
+    return it == set.end() ? nullptr : &*it;
+  }
+
+  static bool Insert(Container& set, const Key& key) { return set.insert(key).second; }
+  static std::size_t Erase(Container& set, const Key& key) { return set.erase(key); }
+  static const Key* Find(const Container& set, const Key& key) { return Pointer(set, set.find(key)); }
+  static const Key* LessThan(const Container& set, const Key& key) {
+    auto bound = set.lower_bound(key);
+    return bound == set.begin() ? nullptr : &*std::prev(bound);
+  }
+  static const Key* GreaterThan(const Container& set, const Key& key) { return Pointer(set, set.upper_bound(key)); }
+  static const Key* Statistic(const Container&, std::size_t) { return nullptr; }
+  static void Validate(const Container&) {}
+};
+
+#ifdef NENIY_BENCHMARK_PBDS
+template <typename Key>
+struct PbdsSubject {
+  using Container = __gnu_pbds::tree<Key, __gnu_pbds::null_type, std::less<Key>, __gnu_pbds::rb_tree_tag,
+                                     __gnu_pbds::tree_order_statistics_node_update>;
+  static constexpr const char* kName = "pbds";
+  static constexpr bool kHasStatistic = true;
+
+  static const Key* Pointer(const Container& tree, typename Container::const_iterator it) {
+    return it == tree.end() ? nullptr : &*it;
+  }
+
+  static bool Insert(Container& tree, const Key& key) { return tree.insert(key).second; }
+  static std::size_t Erase(Container& tree, const Key& key) { return tree.erase(key) ? 1 : 0; }
+  static const Key* Find(const Container& tree, const Key& key) { return Pointer(tree, tree.find(key)); }
+  static const Key* LessThan(const Container& tree, const Key& key) {
+    auto bound = tree.lower_bound(key);
+    return bound == tree.begin() ? nullptr : &*std::prev(bound);
+  }
+  static const Key* GreaterThan(const Container& tree, const Key& key) { return Pointer(tree, tree.upper_bound(key)); }
+  static const Key* Statistic(const Container& tree, std::size_t k) { return Pointer(tree, tree.find_by_order(k)); }
+  static void Validate(const Container&) {}
+};
+#endif
+
+struct Result {
+  std::string container;
+  std::string key;
+  std::string workload;
+  std::size_t size = 0;
+  std::string operation;
+  double ns_per_op = 0;
+  double ops_per_second = 0;
+  double rss_bytes_per_element = 0;
+  std::optional<double> cache_misses_per_op;
+  std::uint64_t checksum = 0;
+};
+
+std::size_t ResidentBytes() {
+#if defined(__linux__)
+  std::ifstream statm("/proc/self/statm");
+  std::size_t total_pages = 0;
+  std::size_t resident_pages = 0;
+  if (statm >> total_pages >> resident_pages) {
+    return resident_pages * static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+  }
+#endif
+  return 0;
+}
+
+// Freed nodes of the previous container would otherwise be reused without raising the RSS
+void ReturnFreedMemory() {
+#if defined(__GLIBC__)
+  malloc_trim(0);
+#endif
+}
+
+// Time, operation count, cache misses and checksum of one operation over all rounds
+class Meter {
+ public:
+  explicit Meter(bool perf) {
+    if (perf) {
+      misses.emplace();
+    }
+  }
+
+  template <typename Body> // body() does ops operations and returns a checksum
+  void Measure(std::size_t ops, Body body) {
+    if (misses) {
+      misses->start();
+    }
+    auto start = std::chrono::steady_clock::now();
+    checksum += body();
+    nanoseconds += NanosecondsSince(start);
+    if (misses) {
+      std::optional<std::uint64_t> counted = misses->stop();
+      if (counted) {
+        cache_misses = cache_misses.value_or(0) + *counted;
+      }
+    }
+    operations += ops;
+  }
+
+  Result Finish(std::string operation) const {
+    Result result;
+    result.operation = std::move(operation);
+    result.ns_per_op = operations == 0 ? 0 : nanoseconds / static_cast<double>(operations);
+    result.ops_per_second = nanoseconds == 0 ? 0 : static_cast<double>(operations) * 1e9 / nanoseconds;
+    if (cache_misses) {
+      result.cache_misses_per_op = static_cast<double>(*cache_misses) / static_cast<double>(operations);
+    }
+    result.checksum = checksum;
+    return result;
+  }
+
+ private:
+  std::optional<CacheMissCounter> misses; // only with --perf
+  double nanoseconds = 0;
+  std::uint64_t operations = 0;
+  std::optional<std::uint64_t> cache_misses;
+  std::uint64_t checksum = 0;
+};
+
+template <typename Subject, typename Key>
+std::vector<Result> RunContainer(const Streams<Key>& streams, std::size_t n, const Options& options) {
+  using Container = typename Subject::Container;
+  std::size_t rounds = std::clamp<std::size_t>(options.target_ops / std::max<std::size_t>(n, 1), 1, kMaxRounds);
+  Meter insert(options.perf);
+  Meter find(options.perf);
+  Meter less_than(options.perf);
+  Meter greater_than(options.perf);
+  Meter statistic(options.perf);
+  Meter iterate(options.perf);
+  Meter copy(options.perf);
+  Meter read_write(options.perf);
+  Meter erase(options.perf);
+  double rss_per_element = 0;
+
+  for (std::size_t round = 0; round < rounds; ++round) {
+    ReturnFreedMemory();
+    std::size_t rss_before = ResidentBytes();
+    Container container;
+    insert.Measure(n, [&] {
+      std::uint64_t inserted = 0;
+      for (const Key& key : streams.inserts) {
+        inserted += Subject::Insert(container, key);
+      }
+      return inserted;
+    });
+    if (round == 0) {
+      std::size_t rss_after = ResidentBytes();
+      rss_per_element = static_cast<double>(rss_after - std::min(rss_before, rss_after)) / static_cast<double>(n);
+      if (options.check) {
+        Subject::Validate(container);
+      }
+    }
+    auto lookups = [&](Meter& meter, auto lookup) {
+      meter.Measure(streams.queries.size(), [&] {
+        std::uint64_t sum = 0;
+        for (const Key& key : streams.queries) {
+          sum += Digest(lookup(container, key));
+        }
+        return sum;
+      });
+    };
+    lookups(find, Subject::Find);
+    lookups(less_than, Subject::LessThan);
+    lookups(greater_than, Subject::GreaterThan);
+    if constexpr (Subject::kHasStatistic) {
+      statistic.Measure(streams.positions.size(), [&] {
+        std::uint64_t sum = 0;
+        for (std::size_t k : streams.positions) {
+          sum += Digest(Subject::Statistic(container, k));
+        }
+        return sum;
+      });
+    }
+    iterate.Measure(n, [&] {
+      std::uint64_t sum = 0;
+      for (const Key& key : container) {
+        sum += Digest(&key);
+      }
+      return sum;
+    });
+    copy.Measure(n, [&] {
+      Container duplicate(container);
+      return duplicate.size();
+    });
+    if (!streams.mixed.empty()) {
+      read_write.Measure(streams.mixed.size(), [&] {
+        std::uint64_t sum = 0;
+        for (const auto& [kind, key] : streams.mixed) {
+          if (kind == MixedKind::kFind) {
+            sum += Digest(Subject::Find(container, key));
+          } else if (kind == MixedKind::kInsert) {
+            sum += Subject::Insert(container, key);
+          } else {
+            sum += Subject::Erase(container, key);
+          }
+        }
+        return sum;
+      });
+      if (options.check && round == 0) {
+        Subject::Validate(container);
+      }
+    }
+    erase.Measure(n, [&] {
+      std::uint64_t erased = 0;
+      for (const Key& key : streams.erases) {
+        erased += Subject::Erase(container, key);
+      }
+      return erased;
+    });
+  }
+
+  std::vector<std::pair<const char*, const Meter*>> measured = {
+      {"insert", &insert}, {"find", &find}, {"find_less_than", &less_than}, {"find_greater_than", &greater_than}};
+  if (Subject::kHasStatistic) {
+    measured.emplace_back("statistic", &statistic);
+  }
+  measured.insert(measured.end(), {{"iterate", &iterate}, {"copy", &copy}});
+  if (!streams.mixed.empty()) {
+    measured.emplace_back("read_write", &read_write);
+  }
+  measured.emplace_back("erase", &erase);
+  std::vector<Result> results;
+  for (auto [name, meter] : measured) {
+    Result result = meter->Finish(name);
+    result.container = Subject::kName;
+    result.size = n;
+    result.rss_bytes_per_element = rss_per_element;
+    results.push_back(std::move(result));
+  }
+  return results;
+}
+
+bool Selected(const std::vector<std::string>& selection, const std::string& name) {
+  return std::find(selection.begin(), selection.end(), name) != selection.end();
+}
+
+template <typename Key>
+void RunKey(const std::string& key_name, const Options& options, std::vector<Result>& all) {
+  for (std::size_t n : options.sizes) {
+    for (const std::string& workload : options.workloads) {
+      Streams<Key> streams = MakeStreams<Key>(workload, n, options.seed);
+      std::vector<Result> results;
+      auto run = [&]<typename Subject>() {
+        if (Selected(options.containers, Subject::kName)) {
+          std::vector<Result> measured = RunContainer<Subject>(streams, n, options);
+          results.insert(results.end(), measured.begin(), measured.end());
+        }
+      };
+      run.template operator()<RedBlackTreeSubject<Key>>();
+      run.template operator()<StdSetSubject<Key>>();
+#ifdef NENIY_BENCHMARK_PBDS
+      run.template operator()<PbdsSubject<Key>>();
+#endif
+      for (Result& result : results) {
+        result.key = key_name;
+        result.workload = workload;
+        std::cout << key_name << ' ' << workload << ' ' << n << ' ' << result.container << ' ' << result.operation
+                  << ": " << result.ns_per_op << " ns/op, " << result.ops_per_second / 1e6 << " Mops/s, "
+                  << result.rss_bytes_per_element << " RSS bytes/element";
+        if (result.cache_misses_per_op) {
+          std::cout << ", " << *result.cache_misses_per_op << " cache misses/op";
+        }
+        std::cout << '\n';
+      }
+      all.insert(all.end(), results.begin(), results.end());
+    }
+  }
+}
+
+// Containers that disagree on an operation have a bug, or the benchmark does
+bool ChecksumsAgree(const std::vector<Result>& results) {
+  std::map<std::tuple<std::string, std::string, std::size_t, std::string>, const Result*> first;
+  bool agree = true;
+  for (const Result& result : results) {
+    auto [it, inserted] = first.try_emplace({result.key, result.workload, result.size, result.operation}, &result);
+    if (!inserted && it->second->checksum != result.checksum) {
+      std::cerr << "checksum mismatch: " << result.key << ' ' << result.workload << ' ' << result.size << ' '
+                << result.operation << ": " << it->second->container << ' ' << it->second->checksum << ", "
+                << result.container << ' ' << result.checksum << '\n';
+      agree = false;
+    }
+  }
+  return agree;
+}
+
+void WriteJson(const std::vector<Result>& results, const Options& options) {
+  std::ofstream out(options.json);
+  out << "{\n  \"seed\": " << options.seed << ",\n  \"results\": [\n";
+  for (std::size_t i = 0; i < results.size(); ++i) {
+    const Result& result = results[i];
+    out << "    {\"container\": \"" << result.container << "\", \"key\": \"" << result.key << "\", \"workload\": \""
+        << result.workload << "\", \"size\": " << result.size << ", \"operation\": \"" << result.operation
+        << "\", \"ns_per_op\": " << result.ns_per_op << ", \"ops_per_second\": " << result.ops_per_second
+        << ", \"rss_bytes_per_element\": " << result.rss_bytes_per_element << ", \"cache_misses_per_op\": ";
+    if (result.cache_misses_per_op) {
+      out << *result.cache_misses_per_op;
+    } else {
+      out << "null";
+    }
+    out << ", \"checksum\": " << result.checksum << '}' << (i + 1 < results.size() ? "," : "") << '\n';
+  }
+  out << "  ]\n}\n";
+  if (!out) {
+    std::cerr << "can't write " << options.json << '\n';
+  }
+}
+
+std::vector<std::string> SplitList(const std::string& list) {
+  std::vector<std::string> items;
+  std::stringstream stream(list);
+  for (std::string item; std::getline(stream, item, ',');) {
+    if (!item.empty()) {
+      items.push_back(item);
+    }
+  }
+  return items;
+}
+
+Options ParseOptions(int argc, char** argv) {
+  Options options;
+  for (int i = 1; i < argc; ++i) {
+    std::string flag = argv[i];
+    bool has_value = i + 1 < argc;
+    if (flag == "--sizes" && has_value) {
+      options.sizes.clear();
+      for (const std::string& size : SplitList(argv[++i])) {
+        options.sizes.push_back(static_cast<std::size_t>(std::strtod(size.c_str(), nullptr))); // 1e8 works too
+      }
+    } else if (flag == "--keys" && has_value) {
+      options.keys = SplitList(argv[++i]);
+    } else if (flag == "--workloads" && has_value) {
+      options.workloads = SplitList(argv[++i]);
+    } else if (flag == "--containers" && has_value) {
+      options.containers = SplitList(argv[++i]);
+    } else if (flag == "--seed" && has_value) {
+      options.seed = std::strtoull(argv[++i], nullptr, 10);
+    } else if (flag == "--target-ops" && has_value) {
+      options.target_ops = std::strtoull(argv[++i], nullptr, 10);
+    } else if (flag == "--json" && has_value) {
+      options.json = argv[++i];
+    } else if (flag == "--perf") {
+      options.perf = true;
+    } else if (flag == "--check") {
+      options.check = true;
+    } else {
+      std::cerr << "unknown option " << flag << ", see the top of comparison_benchmark.cpp\n";
+      std::exit(2);
+    }
+  }
+  std::erase(options.sizes, 0);
+  return options;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  Options options = ParseOptions(argc, argv);
+  std::vector<Result> results;
+  try {
+    if (Selected(options.keys, "int")) {
+      RunKey<int>("int", options, results);
+    }
+    if (Selected(options.keys, "uint64")) {
+      RunKey<std::uint64_t>("uint64", options, results);
+    }
+    if (Selected(options.keys, "string")) {
+      RunKey<std::string>("string", options, results);
+    }
+  } catch (const std::logic_error& error) { // validate() failed
+    std::cerr << error.what() << '\n';
+    return 1;
+  }
+  if (!options.json.empty()) {
+    WriteJson(results, options);
+  }
+  if (options.check && !ChecksumsAgree(results)) {
+    return 1;
+  }
+}
@@ -0,0 +1,117 @@
+// Mixed find/statistic/insert/erase load: RedBlackTree behind std::shared_mutex against
+// ConcurrentRedBlackTree, for several thread counts and read shares
+// Build: g++ -O2 -std=c++20 -pthread concurrent_benchmark.cpp -o concurrent_benchmark
+// Usage: ./concurrent_benchmark [size = 1000000] [ops_per_thread = 1000000] [max_threads = 16]
+#include "../ConcurrentRedBlackTree.h"
+#include "timing.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+class LockedTree {
+ public:
+  explicit LockedTree(RedBlackTree<int> tree) : tree(std::move(tree)) {}
+
+  bool contains(int key) const {
+    std::shared_lock lock(mutex);
+    return tree.find(key) != tree.end();
+  }
+
+  bool has_statistic(std::size_t stat_num) const {
+    std::shared_lock lock(mutex);
+    return tree.statistic(stat_num) != tree.end();
+  }
+
+  void insert(int key) {
+    std::unique_lock lock(mutex);
+    tree.insert(key);
+  }
+
+  void erase(int key) {
+    std::unique_lock lock(mutex);
+    tree.erase(key);
+  }
+
+ private:
+  mutable std::shared_mutex mutex;
+  RedBlackTree<int> tree;
+};
+
+class LeftRightTree {
+ public:
+  explicit LeftRightTree(RedBlackTree<int> tree) : tree(std::move(tree)) {}
+
+  bool contains(int key) const { return tree.contains(key); }
+
+  bool has_statistic(std::size_t stat_num) const { return tree.statistic(stat_num).has_value(); }
+
+  void insert(int key) { tree.insert(key); }
+
+  void erase(int key) { tree.erase(key); }
+
+ private:
+  ConcurrentRedBlackTree<int> tree;
+};
+
+template <typename Set>
+double Run(Set& set, int size, std::size_t ops, std::size_t threads, unsigned read_percent) {
+  std::vector<std::thread> workers;
+  std::vector<std::size_t> hits(threads);
+  auto start = std::chrono::steady_clock::now();
+  for (std::size_t thread = 0; thread < threads; ++thread) {
+    workers.emplace_back([&, thread] {
+      std::mt19937 rng(static_cast<unsigned>(thread));
+      for (std::size_t op = 0; op < ops; ++op) {
+        int key = static_cast<int>(rng() % (2 * size));
+        unsigned kind = rng() % 100;
+        if (kind < read_percent / 2) {
+          hits[thread] += set.contains(key);
+        } else if (kind < read_percent) {
+          hits[thread] += set.has_statistic(key % size);
+        } else if (kind % 2 == 0) {
+          set.insert(key);
+        } else {
+          set.erase(key);
+        }
+      }
+    });
+  }
+  for (std::thread& worker : workers) {
+    worker.join();
+  }
+  return threads * ops / SecondsSince(start) / 1e6;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  int size = argc > 1 ? std::atoi(argv[1]) : 1'000'000;
+  std::size_t ops = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 1'000'000;
+  std::size_t max_threads = argc > 3 ? std::strtoull(argv[3], nullptr, 10) : 16;
+
+  RedBlackTree<int> initial;
+  for (int key = 0; key < 2 * size; key += 2) {
+    initial.insert(key);
+  }
+  std::cout << "hardware threads: " << std::thread::hardware_concurrency() << "\n";
+
+  for (unsigned read_percent : {50u, 95u, 99u, 100u}) {
+    for (std::size_t threads = 1; threads <= max_threads; threads *= 2) {
+      LockedTree locked(initial);
+      LeftRightTree left_right(initial);
+      double locked_rate = Run(locked, size, ops, threads, read_percent);
+      double left_right_rate = Run(left_right, size, ops, threads, read_percent);
+      std::cout << read_percent << "% reads, " << threads << " threads: shared_mutex " << locked_rate
+                << " Mops/s, ConcurrentRedBlackTree " << left_right_rate << " Mops/s\n";
+    }
+  }
+}
@@ -0,0 +1,172 @@
+// Keys with heavy duplication: the old workaround of a unique tree of (key, sequence)
+// pairs against MultiTreePolicy (a node per element) and CountedMultiTreePolicy (a node
+// per distinct key with a repeat count)
+// Build: g++ -O2 -std=c++20 duplicates_benchmark.cpp -o duplicates_benchmark
+// Usage: ./duplicates_benchmark [elements] [distinct keys] [--check]   (default: 2000000 1000)
+//   --check  instead of timing, compare both multiset modes with std::multiset and validate()
+#include "../RedBlackTree.h"
+#include "timing.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace {
+
+using Key = std::uint64_t;
+using Pair = std::pair<Key, std::uint64_t>;
+using PairTree = RedBlackTree<Pair>;
+using MultiTree = RedBlackTree<Key, std::less<Key>, std::allocator<Key>, MultiTreePolicy>;
+using CountedTree = RedBlackTree<Key, std::less<Key>, std::allocator<Key>, CountedMultiTreePolicy>;
+using LinkedMultiTree = RedBlackTree<Key, std::less<Key>, std::allocator<Key>, LinkedTreePolicy<MultiTreePolicy>>;
+using LinkedCountedTree = RedBlackTree<Key, std::less<Key>, std::allocator<Key>, LinkedTreePolicy<CountedMultiTreePolicy>>;
+
+// Inserts every key, answers a rank and a statistic query per key, then erases the keys
+// one copy at a time; the element type decides how a key and a duplicate are spelled
+template <typename Tree, typename MakeValue, typename Rank, typename EraseOne>
+void Run(const char* name, const std::vector<Key>& keys, MakeValue make_value, Rank rank, EraseOne erase_one) {
+  Tree tree;
+  auto start = std::chrono::steady_clock::now();
+  for (std::size_t i = 0; i < keys.size(); ++i) {
+    tree.insert(make_value(keys[i], i));
+  }
+  double insert_ms = MillisecondsSince(start);
+
+  std::size_t checksum = 0;
+  start = std::chrono::steady_clock::now();
+  for (std::size_t i = 0; i < keys.size(); ++i) {
+    checksum += rank(tree, keys[i]);
+    checksum += tree.statistic(keys[keys.size() - 1 - i] % tree.size()) != tree.end();
+  }
+  double query_ms = MillisecondsSince(start);
+
+  start = std::chrono::steady_clock::now();
+  for (Key key : keys) {
+    erase_one(tree, key);
+  }
+  double erase_ms = MillisecondsSince(start);
+
+  std::cout << name << ": insert " << insert_ms << " ms, rank + statistic " << query_ms << " ms, erase one "
+            << erase_ms << " ms, " << Tree::node_bytes() << " bytes/node (checksum " << checksum << ")\n";
+}
+
+// Every element in order, a counted node giving one entry per copy
+template <typename Tree>
+std::vector<Key> Elements(const Tree& tree) {
+  std::vector<Key> elements;
+  for (auto it = tree.begin(); it != tree.end(); ++it) {
+    elements.insert(elements.end(), tree.copies(it), *it);
+  }
+  return elements;
+}
+
+template <typename Tree>
+bool Agrees(const char* name, const char* step, const Tree& tree, const std::multiset<Key>& expected) {
+  tree.validate();
+  if (tree.size() != expected.size() || Elements(tree) != std::vector<Key>(expected.begin(), expected.end())) {
+    std::cerr << name << ": " << step << " disagrees with std::multiset\n";
+    return false;
+  }
+  return true;
+}
+
+// The parallel algorithms visit every node once for any number of threads, also when
+// counted copies put several chunk bounds into one node
+template <typename Tree>
+bool ParallelAgrees(const char* name, const Tree& tree) {
+  std::uint64_t nodes = 0;
+  std::uint64_t sum = 0;
+  for (Key key : tree) {
+    ++nodes;
+    sum += key;
+  }
+  for (std::size_t threads = 1; threads <= 16; threads *= 2) {
+    std::atomic<std::uint64_t> visited{0};
+    parallel_for_each(tree, [&](Key) { visited.fetch_add(1, std::memory_order_relaxed); }, threads);
+    if (visited.load() != nodes || parallel_reduce(tree, std::uint64_t{0}, std::plus<>(), std::identity(), threads) != sum) {
+      std::cerr << name << ": parallel_for_each or parallel_reduce missed elements with " << threads << " threads\n";
+      return false;
+    }
+  }
+  return true;
+}
+
+// Range erases between random keys, each bound at the first copy of its key
+template <typename Tree>
+bool Check(const char* name, const std::vector<Key>& keys, std::size_t distinct) {
+  Tree tree(keys.begin(), keys.end());
+  std::multiset<Key> expected(keys.begin(), keys.end());
+  if (!Agrees(name, "construction", tree, expected) || !ParallelAgrees(name, tree)) {
+    return false;
+  }
+  std::mt19937_64 rng(7);
+  for (int round = 0; round < 16 && !expected.empty(); ++round) {
+    Key low = rng() % (distinct + 1);
+    Key high = low + rng() % (distinct / 8 + 2);
+    auto after = tree.erase(tree.lower_bound(low), tree.lower_bound(high));
+    expected.erase(expected.lower_bound(low), expected.lower_bound(high));
+    if (!Agrees(name, "erase(first, last)", tree, expected) || !ParallelAgrees(name, tree)) {
+      return false;
+    }
+    if (after == tree.end() ? expected.lower_bound(high) != expected.end() : *after != *expected.lower_bound(high)) {
+      std::cerr << name << ": erase(first, last) returned a wrong position\n";
+      return false;
+    }
+  }
+  tree.erase(tree.begin(), tree.end());
+  return Agrees(name, "erasing everything", tree, {});
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  std::vector<std::size_t> numbers;
+  bool check = false;
+  for (int i = 1; i < argc; ++i) {
+    if (std::string(argv[i]) == "--check") {
+      check = true;
+    } else {
+      numbers.push_back(std::strtoull(argv[i], nullptr, 10));
+    }
+  }
+  std::size_t count = numbers.size() > 0 ? numbers[0] : 2'000'000;
+  std::size_t distinct = numbers.size() > 1 ? numbers[1] : 1'000;
+  std::mt19937_64 rng(42);
+  std::vector<Key> keys(count);
+  for (Key& key : keys) {
+    key = rng() % distinct;
+  }
+
+  if (check) {
+    std::vector<Key> few(101, 1); // fewer distinct keys than threads
+    few[50] = 0;
+    bool passed = Check<MultiTree>("MultiTreePolicy", keys, distinct) &&
+                  Check<CountedTree>("CountedMultiTreePolicy", keys, distinct) &&
+                  Check<CountedTree>("CountedMultiTreePolicy, 2 distinct keys", few, 2) &&
+                  Check<LinkedMultiTree>("LinkedTreePolicy<MultiTreePolicy>", keys, distinct) &&
+                  Check<LinkedCountedTree>("LinkedTreePolicy<CountedMultiTreePolicy>", keys, distinct);
+    std::cout << (passed ? "multiset checks passed\n" : "multiset checks failed\n");
+    return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+
+  Run<PairTree>(
+      "pair<key, seq>", keys, [](Key key, std::size_t i) { return Pair(key, i); },
+      [](const PairTree& tree, Key key) { return tree.rank(Pair(key, 0)); },
+      [](PairTree& tree, Key key) { tree.erase(tree.lower_bound(Pair(key, 0))); });
+  Run<MultiTree>(
+      "MultiTreePolicy", keys, [](Key key, std::size_t) { return key; },
+      [](const MultiTree& tree, Key key) { return tree.rank(key); },
+      [](MultiTree& tree, Key key) { tree.erase_one(key); });
+  Run<CountedTree>(
+      "CountedMultiTreePolicy", keys, [](Key key, std::size_t) { return key; },
+      [](const CountedTree& tree, Key key) { return tree.rank(key); },
+      [](CountedTree& tree, Key key) { tree.erase_one(key); });
+}
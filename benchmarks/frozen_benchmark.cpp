@@ -0,0 +1,85 @@
+// Lookup latency of FrozenRedBlackTree against the live RedBlackTree it was frozen from,
+// for sizes from L1-resident to DRAM-resident
+// Build: g++ -O2 -std=c++20 frozen_benchmark.cpp -o frozen_benchmark
+// Usage: ./frozen_benchmark [size...]   (default: 1000 30000 1000000 30000000)
+#include "../FrozenRedBlackTree.h"
+#include "timing.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <numeric>
+#include <random>
+#include <vector>
+
+namespace {
+
+constexpr std::size_t kQueries = 5'000'000;
+
+template <typename Query>
+double NsPerQuery(const std::vector<std::uint32_t>& queries, std::size_t& checksum, Query query) {
+  auto start = std::chrono::steady_clock::now();
+  for (std::uint32_t key : queries) {
+    checksum += query(key);
+  }
+  return NanosecondsPer(start, queries.size());
+}
+
+void Run(std::size_t count) {
+  std::vector<std::uint32_t> keys(count);
+  std::iota(keys.begin(), keys.end(), 0);
+  std::mt19937_64 rng(42);
+  std::shuffle(keys.begin(), keys.end(), rng);
+
+  RedBlackTree<std::uint32_t> tree;
+  for (std::uint32_t key : keys) {
+    tree.insert(key * 2); // odd keys miss
+  }
+  auto start = std::chrono::steady_clock::now();
+  FrozenRedBlackTree<std::uint32_t> frozen = freeze(tree);
+  double freeze_ms = MillisecondsSince(start);
+
+  std::vector<std::uint32_t> queries(kQueries);
+  for (std::uint32_t& query : queries) {
+    query = rng() % (count * 2);
+  }
+
+  std::size_t checksum = 0;
+  double tree_find = NsPerQuery(queries, checksum, [&](std::uint32_t key) { return tree.find(key) != tree.end(); });
+  double frozen_find =
+      NsPerQuery(queries, checksum, [&](std::uint32_t key) { return frozen.find(key) != frozen.end(); });
+  double tree_less = NsPerQuery(queries, checksum, [&](std::uint32_t key) {
+    return tree.find_less_than(key) != tree.end();
+  });
+  double frozen_less = NsPerQuery(queries, checksum, [&](std::uint32_t key) {
+    return frozen.find_less_than(key) != frozen.end();
+  });
+  double tree_statistic =
+      NsPerQuery(queries, checksum, [&](std::uint32_t key) { return *tree.statistic(key / 2); });
+  double frozen_statistic =
+      NsPerQuery(queries, checksum, [&](std::uint32_t key) { return *frozen.statistic(key / 2); });
+
+  std::cout << "size " << count << " (freeze " << freeze_ms << " ms, " << frozen.memory_bytes() / count
+            << " bytes/element vs " << tree.node_bytes() << "):\n"
+            << "  find            tree " << tree_find << " ns, frozen " << frozen_find << " ns\n"
+            << "  find_less_than  tree " << tree_less << " ns, frozen " << frozen_less << " ns\n"
+            << "  statistic       tree " << tree_statistic << " ns, frozen " << frozen_statistic << " ns\n"
+            << "  (checksum " << checksum << ")\n";
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  std::vector<std::size_t> sizes;
+  for (int i = 1; i < argc; ++i) {
+    sizes.push_back(std::strtoull(argv[i], nullptr, 10));
+  }
+  if (sizes.empty()) {
+    sizes = {1'000, 30'000, 1'000'000, 30'000'000};
+  }
+  for (std::size_t count : sizes) {
+    Run(count);
+  }
+}
@@ -0,0 +1,63 @@
+// Node size and speed of the default and compact node layouts
+// Build: g++ -O2 -std=c++20 layout_benchmark.cpp -o layout_benchmark
+// Usage: ./layout_benchmark [count = 10000000]
+#include "../RedBlackTree.h"
+#include "timing.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <numeric>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+template <typename Key, typename Policy>
+void Run(const std::string& name, const std::vector<Key>& keys) {
+  using Tree = RedBlackTree<Key, std::less<Key>, std::allocator<Key>, Policy>;
+  std::cout << name << ": sizeof(Node) = " << Tree::node_bytes() << " bytes";
+
+  Tree tree;
+  auto start = std::chrono::steady_clock::now();
+  for (const Key& key : keys) {
+    tree.insert(key);
+  }
+  std::cout << ", insert " << NanosecondsPer(start, keys.size()) << " ns/op";
+
+  std::size_t found = 0;
+  start = std::chrono::steady_clock::now();
+  for (const Key& key : keys) {
+    found += tree.find(key) != tree.end();
+  }
+  std::cout << ", find " << NanosecondsPer(start, keys.size()) << " ns/op";
+
+  Key sum{};
+  start = std::chrono::steady_clock::now();
+  for (const Key& key : tree) {
+    sum += key;
+  }
+  std::cout << ", traverse " << NanosecondsPer(start, keys.size()) << " ns/element"
+            << " (" << found << " found, checksum " << sum << ")\n";
+}
+
+template <typename Key>
+void RunAll(const std::string& key_name, std::size_t count) {
+  std::vector<Key> keys(count);
+  std::iota(keys.begin(), keys.end(), Key{});
+  std::shuffle(keys.begin(), keys.end(), std::mt19937(42));
+  Run<Key, DefaultTreePolicy>(key_name + " default          ", keys);
+  Run<Key, CompactTreePolicy<std::size_t>>(key_name + " compact, 64-bit  ", keys);
+  Run<Key, CompactTreePolicy<std::uint32_t>>(key_name + " compact, 32-bit  ", keys);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  std::size_t count = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 10'000'000;
+  RunAll<std::uint32_t>("uint32_t", count);
+  RunAll<std::uint64_t>("uint64_t", count);
+}
@@ -0,0 +1,63 @@
+// Lookup latency of find() for trees of several sizes
+// Build: g++ -O2 -std=c++20 lookup_benchmark.cpp -o lookup_benchmark
+// To compare with another revision of the tree, point RBT_HEADER at its copy:
+//   g++ -O2 -std=c++20 -DRBT_HEADER='"/tmp/old/RedBlackTree.h"' lookup_benchmark.cpp -o lookup_benchmark_old
+// Usage: ./lookup_benchmark [size...]   (default: 1000 1000000 100000000)
+#ifndef RBT_HEADER
+#define RBT_HEADER "../RedBlackTree.h"
+#endif
+#include RBT_HEADER
+#include "timing.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <numeric>
+#include <random>
+#include <vector>
+
+namespace {
+
+constexpr std::size_t kQueries = 10'000'000;
+
+void Run(std::size_t count) {
+  std::vector<std::uint32_t> keys(count);
+  std::iota(keys.begin(), keys.end(), 0);
+  std::mt19937_64 rng(42);
+  std::shuffle(keys.begin(), keys.end(), rng);
+
+  RedBlackTree<std::uint32_t> tree;
+  for (std::uint32_t key : keys) {
+    tree.insert(key * 2); // odd keys miss
+  }
+
+  std::vector<std::uint32_t> queries(kQueries);
+  for (std::uint32_t& query : queries) {
+    query = rng() % (count * 2);
+  }
+
+  std::size_t found = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (std::uint32_t query : queries) {
+    found += tree.find(query) != tree.end();
+  }
+  double ns = NanosecondsSince(start);
+  std::cout << "size " << count << ": " << ns / queries.size() << " ns/op (" << found << " hits)\n";
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  std::vector<std::size_t> sizes;
+  for (int i = 1; i < argc; ++i) {
+    sizes.push_back(std::strtoull(argv[i], nullptr, 10));
+  }
+  if (sizes.empty()) {
+    sizes = {1'000, 1'000'000, 100'000'000};
+  }
+  for (std::size_t count : sizes) {
+    Run(count);
+  }
+}
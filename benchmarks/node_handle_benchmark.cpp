@@ -0,0 +1,106 @@
+// Re-keying elements with erase + insert against extract + insert(node_type&&), and
+// merge() against copying the elements over, for small and large values
+// Build: g++ -O2 -std=c++20 node_handle_benchmark.cpp -o node_handle_benchmark
+// Usage: ./node_handle_benchmark [elements = 1000000] [re-keyed = 2000000]
+#include "../RedBlackTree.h"
+#include "timing.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <numeric>
+#include <random>
+#include <vector>
+
+namespace {
+
+using Key = std::uint64_t;
+
+struct Large {
+  Key key = 0;
+  std::array<char, 248> payload{};
+
+  bool operator<(const Large& other) const { return key < other.key; }
+};
+
+Key& KeyOf(Large& value) { return value.key; }
+
+Key& KeyOf(Key& value) { return value; }
+
+template <typename Value>
+Value Make(Key key) {
+  Value value{};
+  KeyOf(value) = key;
+  return value;
+}
+
+// Every step moves the element with key k to key k + size, so keys stay unique
+template <typename Value>
+void Run(const char* name, std::size_t count, std::size_t moves) {
+  std::vector<Key> keys(count);
+  std::iota(keys.begin(), keys.end(), Key(0));
+  std::shuffle(keys.begin(), keys.end(), std::mt19937_64(42));
+
+  RedBlackTree<Value> by_erase;
+  RedBlackTree<Value> by_extract;
+  for (Key key : keys) {
+    by_erase.insert(Make<Value>(key));
+    by_extract.insert(Make<Value>(key));
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  for (std::size_t i = 0; i < moves; ++i) {
+    Key key = keys[i % count] + i / count * count;
+    auto found = by_erase.find(Make<Value>(key));
+    Value value = *found;
+    by_erase.erase(found);
+    KeyOf(value) += count;
+    by_erase.insert(std::move(value));
+  }
+  double erase_ms = MillisecondsSince(start);
+
+  start = std::chrono::steady_clock::now();
+  for (std::size_t i = 0; i < moves; ++i) {
+    Key key = keys[i % count] + i / count * count;
+    auto handle = by_extract.extract(Make<Value>(key));
+    KeyOf(handle.value()) += count;
+    by_extract.insert(std::move(handle));
+  }
+  double extract_ms = MillisecondsSince(start);
+
+  // Interleaved halves, so every node of the source lands inside the target
+  RedBlackTree<Value> target;
+  RedBlackTree<Value> source;
+  RedBlackTree<Value> copy_target;
+  for (Key key : keys) {
+    (key % 2 == 0 ? target : source).insert(Make<Value>(key));
+    if (key % 2 == 0) {
+      copy_target.insert(Make<Value>(key));
+    }
+  }
+  start = std::chrono::steady_clock::now();
+  for (const Value& value : source) {
+    copy_target.insert(value);
+  }
+  double copy_ms = MillisecondsSince(start);
+  start = std::chrono::steady_clock::now();
+  target.merge(source);
+  double merge_ms = MillisecondsSince(start);
+
+  std::cout << name << ": re-key " << moves << " elements with erase + insert " << erase_ms << " ms, extract + insert "
+            << extract_ms << " ms; " << count / 2 << " elements copied " << copy_ms << " ms, merged " << merge_ms
+            << " ms (sizes " << by_erase.size() + by_extract.size() << ", " << target.size() + copy_target.size()
+            << ")\n";
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  std::size_t count = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1'000'000;
+  std::size_t moves = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 2'000'000;
+  Run<Key>("uint64_t", count, moves);
+  Run<Large>("256-byte value", count, moves);
+}
@@ -0,0 +1,113 @@
+// PersistentRedBlackTree: snapshot cost against copying a RedBlackTree, update throughput,
+// and the memory held by snapshots as the tree keeps changing
+// Build: g++ -O2 -std=c++20 persistent_benchmark.cpp -o persistent_benchmark
+// Usage: ./persistent_benchmark [count = 1000000] [updates_per_snapshot = 1000] [snapshots = 100]
+#include "../PersistentRedBlackTree.h"
+#include "../RedBlackTree.h"
+#include "timing.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <numeric>
+#include <random>
+#include <vector>
+
+namespace {
+
+std::size_t live_bytes = 0;
+
+// std::allocator that counts the bytes currently allocated
+template <typename T>
+struct CountingAllocator {
+  using value_type = T;
+
+  CountingAllocator() = default;
+
+  template <typename U>
+  CountingAllocator(const CountingAllocator<U>&) noexcept {}
+
+  T* allocate(std::size_t count) {
+    live_bytes += count * sizeof(T);
+    return std::allocator<T>().allocate(count);
+  }
+
+  void deallocate(T* pointer, std::size_t count) noexcept {
+    live_bytes -= count * sizeof(T);
+    std::allocator<T>().deallocate(pointer, count);
+  }
+
+  template <typename U>
+  bool operator==(const CountingAllocator<U>&) const noexcept {
+    return true;
+  }
+};
+
+using Persistent = PersistentRedBlackTree<int, std::less<int>, CountingAllocator<int>>;
+using Mutable = RedBlackTree<int, std::less<int>, CountingAllocator<int>>;
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  std::size_t count = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1'000'000;
+  std::size_t updates_per_snapshot = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 1000;
+  std::size_t snapshots = argc > 3 ? std::strtoull(argv[3], nullptr, 10) : 100;
+
+  std::vector<int> keys(count);
+  std::iota(keys.begin(), keys.end(), 0);
+  std::shuffle(keys.begin(), keys.end(), std::mt19937(42));
+
+  Mutable tree;
+  auto start = std::chrono::steady_clock::now();
+  for (int key : keys) {
+    tree.insert(key);
+  }
+  std::cout << "RedBlackTree insert:           " << count / SecondsSince(start) / 1e6 << " Mops/s, "
+            << double(live_bytes) / count << " bytes/element\n";
+  std::size_t mutable_bytes = live_bytes;
+
+  Persistent persistent;
+  start = std::chrono::steady_clock::now();
+  for (int key : keys) {
+    persistent.insert(key);
+  }
+  std::cout << "PersistentRedBlackTree insert: " << count / SecondsSince(start) / 1e6 << " Mops/s, "
+            << double(live_bytes - mutable_bytes) / count << " bytes/element\n";
+
+  start = std::chrono::steady_clock::now();
+  Mutable copy = tree;
+  std::cout << "RedBlackTree copy:    " << SecondsSince(start) * 1e3 << " ms\n";
+  start = std::chrono::steady_clock::now();
+  Persistent view = persistent.snapshot();
+  std::cout << "snapshot():           " << SecondsSince(start) * 1e9 << " ns\n";
+
+  // Snapshots taken every updates_per_snapshot random updates keep the replaced paths alive
+  std::size_t base_bytes = live_bytes;
+  std::vector<Persistent> held;
+  std::mt19937 rng(7);
+  start = std::chrono::steady_clock::now();
+  for (std::size_t snapshot = 0; snapshot < snapshots; ++snapshot) {
+    for (std::size_t update = 0; update < updates_per_snapshot; ++update) {
+      int key = static_cast<int>(rng() % (2 * count));
+      if (rng() % 2 == 0) {
+        persistent.insert(key);
+      } else {
+        persistent.erase(key);
+      }
+    }
+    held.push_back(persistent.snapshot());
+  }
+  double seconds = SecondsSince(start);
+  std::size_t updates = snapshots * updates_per_snapshot;
+  double extra = double(live_bytes) - double(base_bytes);
+  std::cout << "updates with snapshots:  " << updates / seconds / 1e6 << " Mops/s\n"
+            << "held by " << snapshots << " snapshots: " << extra / (1 << 20) << " MiB, " << extra / snapshots
+            << " bytes/snapshot, " << extra / updates << " bytes/update (a full copy is "
+            << double(mutable_bytes) / (1 << 20) << " MiB)\n";
+
+  held.clear();
+  view = Persistent();
+  std::cout << "after dropping snapshots: " << (double(live_bytes) - double(base_bytes)) / (1 << 20)
+            << " MiB above the start\n";
+}
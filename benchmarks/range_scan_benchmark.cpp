@@ -0,0 +1,104 @@
+// Short range scans, find_greater_than(x) followed by k steps of ++ or --, on the default
+// tree (parent pointer walks) against LinkedTreePolicy (one pointer per step)
+// Build: g++ -O2 -std=c++20 range_scan_benchmark.cpp -o range_scan_benchmark
+// Usage: ./range_scan_benchmark [sizes = 1000000,10000000] [scanned elements = 4000000]
+#include "../RedBlackTree.h"
+#include "timing.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <iterator>
+#include <numeric>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+using Key = std::uint64_t;
+using PlainTree = RedBlackTree<Key>;
+using LinkedTree = RedBlackTree<Key, std::less<Key>, std::allocator<Key>, LinkedTreePolicy<>>;
+
+std::vector<std::size_t> ParseSizes(const std::string& list) {
+  std::vector<std::size_t> sizes;
+  std::stringstream stream(list);
+  for (std::string item; std::getline(stream, item, ',');) {
+    sizes.push_back(std::strtoull(item.c_str(), nullptr, 10));
+  }
+  return sizes;
+}
+
+// Starts every scan from a random key, so the lookup and the first steps miss the cache
+// like in a real index; returns a checksum to keep the walks alive
+template <bool Forward, typename Tree>
+Key Scan(const Tree& tree, const std::vector<Key>& starts, std::size_t steps) {
+  Key checksum = 0;
+  for (Key start : starts) {
+    auto it = tree.find_greater_than(start);
+    for (std::size_t i = 0; i < steps; ++i) {
+      if constexpr (Forward) {
+        if (it == tree.end()) {
+          break;
+        }
+        checksum += *it;
+        ++it;
+      } else {
+        if (it == tree.begin()) {
+          break;
+        }
+        --it;
+        checksum += *it;
+      }
+    }
+  }
+  return checksum;
+}
+
+template <typename Tree>
+void Run(const char* name, const std::vector<Key>& keys, std::size_t scanned, std::mt19937_64& rng) {
+  // Random insertion order scatters the nodes in memory like a long-lived tree
+  Tree tree;
+  for (Key key : keys) {
+    tree.insert(key);
+  }
+  for (std::size_t steps : {1, 10, 100, 1000}) {
+    std::vector<Key> starts(std::max<std::size_t>(scanned / steps, 1));
+    for (Key& start : starts) {
+      start = rng() % (2 * keys.size());
+    }
+    auto start = std::chrono::steady_clock::now();
+    Key forward = Scan<true>(tree, starts, steps);
+    double forward_ns = NanosecondsSince(start) / starts.size();
+    start = std::chrono::steady_clock::now();
+    Key backward = Scan<false>(tree, starts, steps);
+    double backward_ns = NanosecondsSince(start) / starts.size();
+    std::cout << name << ", k = " << steps << ": ++ " << forward_ns << " ns/scan, -- " << backward_ns
+              << " ns/scan (checksum " << (forward ^ backward) << ")\n";
+  }
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  std::vector<std::size_t> sizes = ParseSizes(argc > 1 ? argv[1] : "1000000,10000000");
+  std::size_t scanned = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 4'000'000;
+
+  for (std::size_t size : sizes) {
+    // Every other number, so half of the scan starts fall between two keys
+    std::vector<Key> keys(size);
+    std::iota(keys.begin(), keys.end(), Key(0));
+    for (Key& key : keys) {
+      key *= 2;
+    }
+    std::shuffle(keys.begin(), keys.end(), std::mt19937_64(42));
+    std::cout << size << " keys, " << PlainTree::node_bytes() << " vs " << LinkedTree::node_bytes() << " bytes/node\n";
+    std::mt19937_64 rng(7);
+    Run<PlainTree>("default", keys, scanned, rng);
+    rng.seed(7);
+    Run<LinkedTree>("linked ", keys, scanned, rng);
+  }
+}
@@ -0,0 +1,70 @@
+// Scaling of merge_union, intersect and difference with the number of threads
+// Build: g++ -O2 -std=c++20 -pthread set_operations_benchmark.cpp -o set_operations_benchmark
+// Usage: ./set_operations_benchmark [count = 4000000] [max_threads = 32]
+#include "../RedBlackTree.h"
+#include "timing.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using Tree = RedBlackTree<long long>;
+
+// Per-thread accumulators overlapping by about half
+Tree RandomTree(std::size_t count, std::mt19937_64& rng) {
+  std::vector<long long> keys(count);
+  for (long long& key : keys) {
+    key = static_cast<long long>(rng() % (count * 4));
+  }
+  return Tree(keys.begin(), keys.end());
+}
+
+template <typename Operation>
+void Run(const std::string& name, const Tree& first, const Tree& second, std::size_t threads, Operation operation) {
+  Tree result = first;
+  Tree other = second;
+  auto start = std::chrono::steady_clock::now();
+  operation(result, std::move(other), threads);
+  std::cout << name << threads << " threads: " << SecondsSince(start) * 1e3 << " ms (size " << result.size() << ")\n";
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  std::size_t count = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 4'000'000;
+  std::size_t max_threads = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 32;
+  std::mt19937_64 rng(42);
+  Tree first = RandomTree(count, rng);
+  Tree second = RandomTree(count, rng);
+  std::cout << "hardware threads: " << std::thread::hardware_concurrency() << "\n";
+
+  for (std::size_t threads = 1; threads <= max_threads; threads *= 2) {
+    Run("merge_union, ", first, second, threads, [](Tree& tree, Tree other, std::size_t n) {
+      tree.merge_union(std::move(other), n);
+    });
+  }
+  for (std::size_t threads = 1; threads <= max_threads; threads *= 2) {
+    Run("intersect,   ", first, second, threads, [](Tree& tree, Tree other, std::size_t n) {
+      tree.intersect(std::move(other), n);
+    });
+  }
+  for (std::size_t threads = 1; threads <= max_threads; threads *= 2) {
+    Run("difference,  ", first, second, threads, [](Tree& tree, Tree other, std::size_t n) {
+      tree.difference(std::move(other), n);
+    });
+  }
+
+  // Serial baseline: insert every element of the other tree
+  Tree result = first;
+  auto start = std::chrono::steady_clock::now();
+  for (long long key : second) {
+    result.insert(key);
+  }
+  std::cout << "insert loop:  " << SecondsSince(start) * 1e3 << " ms (size " << result.size() << ")\n";
+}
@@ -0,0 +1,97 @@
+// SimdBTree against RedBlackTree for integer keys: insert, find, find_less_than, statistic
+// and erase
+// Build: g++ -O2 -std=c++20 -march=native simd_btree_benchmark.cpp -o simd_btree_benchmark
+//   (without -march the node search uses SSE2, or the scalar loop for 64-bit keys; with
+//   CMake, configure with -DRED_BLACK_TREE_NATIVE_ARCH=ON). The report names the search used.
+// Usage: ./simd_btree_benchmark [size...]   (default: 1000 1000000 10000000)
+#include "../SimdBTree.h"
+#include "timing.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <vector>
+
+namespace {
+
+constexpr std::size_t kQueries = 2'000'000;
+
+// Returns a checksum of the answers, which must not depend on the container
+template <typename Set>
+std::size_t Measure(const char* name, const std::vector<std::uint64_t>& keys, const std::vector<std::uint64_t>& queries) {
+  std::size_t checksum = 0;
+  auto start = std::chrono::steady_clock::now();
+  Set set;
+  for (std::uint64_t key : keys) {
+    set.insert(key);
+  }
+  double insert = NanosecondsPer(start, keys.size());
+
+  start = std::chrono::steady_clock::now();
+  for (std::uint64_t query : queries) {
+    checksum += set.find(query) != set.end();
+  }
+  double find = NanosecondsPer(start, queries.size());
+
+  start = std::chrono::steady_clock::now();
+  for (std::uint64_t query : queries) {
+    checksum += set.find_less_than(query) != set.end();
+  }
+  double less = NanosecondsPer(start, queries.size());
+
+  start = std::chrono::steady_clock::now();
+  for (std::uint64_t query : queries) {
+    checksum += *set.statistic(query % set.size());
+  }
+  double statistic = NanosecondsPer(start, queries.size());
+
+  start = std::chrono::steady_clock::now();
+  for (std::uint64_t key : keys) {
+    checksum += set.erase(key);
+  }
+  double erase = NanosecondsPer(start, keys.size());
+
+  std::cout << "  " << name << ": insert " << insert << ", find " << find << ", find_less_than " << less
+            << ", statistic " << statistic << ", erase " << erase << " ns/op (checksum " << checksum << ")\n";
+  return checksum;
+}
+
+bool Run(std::size_t count) {
+  std::mt19937_64 rng(42);
+  std::vector<std::uint64_t> keys(count);
+  for (std::uint64_t& key : keys) {
+    key = rng() >> 1;
+  }
+  std::vector<std::uint64_t> queries(kQueries);
+  for (std::uint64_t& query : queries) {
+    query = rng() % 2 == 0 ? keys[rng() % count] : rng() >> 1;
+  }
+  std::cout << "size " << count << " (uint64 keys):\n";
+  std::size_t expected = Measure<RedBlackTree<std::uint64_t>>("RedBlackTree", keys, queries);
+  if (Measure<SimdBTree<std::uint64_t>>("SimdBTree   ", keys, queries) != expected) {
+    std::cerr << "SimdBTree disagrees with RedBlackTree at size " << count << '\n';
+    return false;
+  }
+  return true;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  std::vector<std::size_t> sizes;
+  for (int i = 1; i < argc; ++i) {
+    sizes.push_back(std::strtoull(argv[i], nullptr, 10));
+  }
+  if (sizes.empty()) {
+    sizes = {1'000, 1'000'000, 10'000'000};
+  }
+  std::cout << "SimdBTree node search: " << SimdBTree<std::uint64_t>::node_search() << '\n';
+  bool agreed = true;
+  for (std::size_t count : sizes) {
+    agreed = Run(count) && agreed;
+  }
+  return agreed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,76 @@
+// Service startup: re-inserting every key against load() of a saved tree and against
+// mapping a RedBlackTreeImage, plus lookup speed of the mapped image
+// Build: g++ -O2 -std=c++20 startup_benchmark.cpp -o startup_benchmark
+// Usage: ./startup_benchmark [count = 10000000] [directory = /tmp]
+#include "../RedBlackTree.h"
+#include "../RedBlackTreeImage.h"
+#include "timing.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+int main(int argc, char** argv) {
+  std::size_t count = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 10'000'000;
+  std::string directory = argc > 2 ? argv[2] : "/tmp";
+  std::string saved_path = directory + "/startup_benchmark.rbt";
+  std::string image_path = directory + "/startup_benchmark.img";
+
+  std::mt19937_64 rng(42);
+  std::vector<std::uint64_t> keys(count);
+  for (std::uint64_t& key : keys) {
+    key = rng();
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  RedBlackTree<std::uint64_t> tree;
+  for (std::uint64_t key : keys) {
+    tree.insert(key);
+  }
+  std::cout << "re-insert:        " << SecondsSince(start) * 1e3 << " ms\n";
+
+  {
+    std::ofstream saved(saved_path, std::ios::binary);
+    tree.save(saved);
+    std::ofstream image(image_path, std::ios::binary);
+    RedBlackTreeImage<std::uint64_t>::write(tree, image);
+  }
+
+  start = std::chrono::steady_clock::now();
+  RedBlackTree<std::uint64_t> loaded;
+  {
+    std::ifstream saved(saved_path, std::ios::binary);
+    loaded.load(saved);
+  }
+  std::cout << "load():           " << SecondsSince(start) * 1e3 << " ms (" << loaded.size() << " elements)\n";
+
+  start = std::chrono::steady_clock::now();
+  MappedFile file(image_path.c_str());
+  RedBlackTreeImage<std::uint64_t> image(file.data(), file.size());
+  const std::uint64_t* first_hit = image.find(keys[0]);
+  std::cout << "mmap image:       " << SecondsSince(start) * 1e3 << " ms to the first find (" << (first_hit != nullptr)
+            << ")\n";
+
+  std::shuffle(keys.begin(), keys.end(), rng);
+  std::size_t lookups = std::min<std::size_t>(count, 2'000'000);
+  std::size_t hits = 0;
+  start = std::chrono::steady_clock::now();
+  for (std::size_t i = 0; i < lookups; ++i) {
+    hits += image.find(keys[i]) != nullptr;
+  }
+  std::cout << "image find:       " << SecondsSince(start) * 1e9 / lookups << " ns/lookup (cold pages included)\n";
+  start = std::chrono::steady_clock::now();
+  for (std::size_t i = 0; i < lookups; ++i) {
+    hits += loaded.find(keys[i]) != loaded.end();
+  }
+  std::cout << "tree find:        " << SecondsSince(start) * 1e9 / lookups << " ns/lookup (hits " << hits << ")\n";
+
+  std::remove(saved_path.c_str());
+  std::remove(image_path.c_str());
+}
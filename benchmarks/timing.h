@@ -0,0 +1,22 @@
+#pragma once
+#include <chrono>
+#include <cstddef>
+
+// Wall-clock time since start, measured with steady_clock, in the unit a report prints
+
+inline double SecondsSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+inline double MillisecondsSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+inline double NanosecondsSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Average over count operations timed together
+inline double NanosecondsPer(std::chrono::steady_clock::time_point start, std::size_t count) {
+  return NanosecondsSince(start) / count;
+}
@@ -0,0 +1,57 @@
+// Serial range-for against parallel_for_each and parallel_reduce
+// Build: g++ -O2 -std=c++20 -pthread traversal_benchmark.cpp -o traversal_benchmark
+// Usage: ./traversal_benchmark [count = 20000000] [max_threads = 32]
+#include "../RedBlackTree.h"
+#include "timing.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <numeric>
+#include <random>
+#include <thread>
+#include <vector>
+
+int main(int argc, char** argv) {
+  std::size_t count = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 20'000'000;
+  std::size_t max_threads = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 32;
+
+  // Random insertion order scatters the nodes in memory like a long-lived tree
+  std::vector<long long> keys(count);
+  std::iota(keys.begin(), keys.end(), 0);
+  std::shuffle(keys.begin(), keys.end(), std::mt19937(42));
+  RedBlackTree<long long> tree;
+  for (long long key : keys) {
+    tree.insert(key);
+  }
+  std::cout << "hardware threads: " << std::thread::hardware_concurrency() << "\n";
+
+  auto start = std::chrono::steady_clock::now();
+  long long sum = 0;
+  for (long long value : tree) {
+    sum += value;
+  }
+  std::cout << "range-for:                  " << SecondsSince(start) * 1e3 << " ms (sum " << sum << ")\n";
+
+  for (std::size_t threads = 1; threads <= max_threads; threads *= 2) {
+    start = std::chrono::steady_clock::now();
+    sum = parallel_reduce(tree, 0LL, std::plus<>{}, std::identity{}, threads);
+    std::cout << "parallel_reduce,   " << threads << " threads: " << SecondsSince(start) * 1e3 << " ms (sum " << sum
+              << ")\n";
+  }
+
+  for (std::size_t threads = 1; threads <= max_threads; threads *= 2) {
+    std::atomic<long long> odd{0};
+    start = std::chrono::steady_clock::now();
+    parallel_for_each(tree, [&odd](long long value) {
+      if (value % 1'000'003 == 1) {
+        odd.fetch_add(1, std::memory_order_relaxed);
+      }
+    }, threads);
+    std::cout << "parallel_for_each, " << threads << " threads: " << SecondsSince(start) * 1e3 << " ms (hits "
+              << odd.load() << ")\n";
+  }
+}
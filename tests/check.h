@@ -0,0 +1,40 @@
+#pragma once
+#include <cstdlib>
+#include <iostream>
+
+// Minimal assertions for the tests: a failed CHECK prints where it failed and the test
+// keeps going, so one run reports every broken case; main() returns TestResult()
+
+inline int& FailedChecks() {
+  static int failed = 0;
+  return failed;
+}
+
+#define CHECK(condition)                                                                   \
+  do {                                                                                     \
+    if (!(condition)) {                                                                    \
+      ++FailedChecks();                                                                    \
+      std::cerr << __FILE__ << ':' << __LINE__ << ": CHECK(" #condition ") failed\n";   \
+    }                                                                                      \
+  } while (false)
+
+// Expression must throw Exception
+#define CHECK_THROWS(Exception, expression)                                                \
+  do {                                                                                     \
+    bool thrown = false;                                                                   \
+    try {                                                                                  \
+      (void)(expression);                                                                  \
+    } catch (const Exception&) {                                                           \
+      thrown = true;                                                                       \
+    }                                                                                      \
+    CHECK(thrown && #expression " throws " #Exception);                                    \
+  } while (false)
+
+inline int TestResult(const char* name) {
+  if (FailedChecks() != 0) {
+    std::cerr << name << ": " << FailedChecks() << " checks failed\n";
+    return EXIT_FAILURE;
+  }
+  std::cout << name << ": all checks passed\n";
+  return EXIT_SUCCESS;
+}
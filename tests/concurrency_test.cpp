@@ -0,0 +1,268 @@
+// The code paths that run on several threads: parallel_for_each, parallel_reduce, set
+// operations with threads > 1 and ConcurrentRedBlackTree with readers racing a writer
+// and reader threads coming and going.
+// Small enough to run under ThreadSanitizer, see RED_BLACK_TREE_TSAN.
+#include "../ConcurrentRedBlackTree.h"
+#include "../RedBlackTree.h"
+#include "check.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <numeric>
+#include <optional>
+#include <random>
+#include <set>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+namespace {
+
+template <typename Policy>
+void ParallelTraversal() {
+  using Tree = RedBlackTree<std::uint64_t, std::less<std::uint64_t>, std::allocator<std::uint64_t>, Policy>;
+  std::mt19937_64 rng(31);
+  Tree tree;
+  for (int i = 0; i < 5000; ++i) {
+    tree.insert(rng() % 700);
+  }
+  std::uint64_t nodes = 0;
+  std::uint64_t sum = 0;
+  for (std::uint64_t value : tree) {
+    ++nodes;
+    sum += value;
+  }
+  for (std::size_t threads : {1, 2, 3, 8}) {
+    std::atomic<std::uint64_t> visited{0};
+    parallel_for_each(tree, [&](std::uint64_t& value) { visited.fetch_add(value + 1, std::memory_order_relaxed); }, threads);
+    CHECK(visited.load() == sum + nodes);
+    CHECK(parallel_reduce(tree, std::uint64_t{0}, std::plus<>(), std::identity(), threads) == sum);
+  }
+}
+
+void ParallelSetOperations() {
+  std::mt19937 rng(33);
+  std::set<int> a;
+  std::set<int> b;
+  for (int i = 0; i < 20000; ++i) {
+    a.insert(static_cast<int>(rng() % 60000));
+    b.insert(static_cast<int>(rng() % 60000));
+  }
+  std::vector<int> expected;
+  std::set_union(a.begin(), a.end(), b.begin(), b.end(), std::back_inserter(expected));
+  RedBlackTree<int> united(a.begin(), a.end());
+  united.merge_union(RedBlackTree<int>(b.begin(), b.end()), 4);
+  united.validate();
+  CHECK(std::equal(united.begin(), united.end(), expected.begin(), expected.end()));
+
+  expected.clear();
+  std::set_intersection(a.begin(), a.end(), b.begin(), b.end(), std::back_inserter(expected));
+  RedBlackTree<int> common(a.begin(), a.end());
+  common.intersect(RedBlackTree<int>(b.begin(), b.end()), 4);
+  common.validate();
+  CHECK(std::equal(common.begin(), common.end(), expected.begin(), expected.end()));
+}
+
+// Counts down a shared budget of comparisons and throws when it runs out
+struct ThrowingLess {
+  std::atomic<long>* budget;
+
+  bool operator()(int lhs, int rhs) const {
+    if (budget->fetch_sub(1, std::memory_order_relaxed) <= 0) {
+      throw std::runtime_error("out of comparisons");
+    }
+    return lhs < rhs;
+  }
+};
+
+std::atomic<long> live_nodes{0};
+
+// Counts the nodes allocated and not yet freed in live_nodes
+template <typename T>
+struct CountingAllocator {
+  using value_type = T;
+
+  CountingAllocator() = default;
+
+  template <typename U>
+  CountingAllocator(const CountingAllocator<U>&) noexcept {}
+
+  T* allocate(std::size_t count) {
+    live_nodes.fetch_add(static_cast<long>(count), std::memory_order_relaxed);
+    return std::allocator<T>().allocate(count);
+  }
+
+  void deallocate(T* pointer, std::size_t count) noexcept {
+    live_nodes.fetch_sub(static_cast<long>(count), std::memory_order_relaxed);
+    std::allocator<T>().deallocate(pointer, count);
+  }
+
+  template <typename U>
+  bool operator==(const CountingAllocator<U>&) const noexcept {
+    return true;
+  }
+};
+
+// A comparator throwing on either half of a forked set operation reaches the caller
+// instead of terminating the program, and every node of both trees is freed
+void ThrowingSetOperation() {
+  using Tree = RedBlackTree<int, ThrowingLess, CountingAllocator<int>>;
+  std::atomic<long> budget{std::numeric_limits<long>::max()};
+  ThrowingLess less{&budget};
+  std::vector<int> evens(40000);
+  std::vector<int> odds(40000);
+  for (int i = 0; i < 40000; ++i) {
+    evens[i] = 2 * i;
+    odds[i] = 2 * i + 1;
+  }
+  for (int operation = 0; operation < 3; ++operation) {
+    for (long allowed : {0L, 50L, 5000L, 50000L}) {
+      Tree ours(evens.begin(), evens.end(), less);
+      Tree theirs(odds.begin(), odds.end(), less);
+      budget.store(allowed);
+      if (operation == 0) {
+        CHECK_THROWS(std::runtime_error, ours.merge_union(std::move(theirs), 4));
+      } else if (operation == 1) {
+        CHECK_THROWS(std::runtime_error, ours.intersect(std::move(theirs), 4));
+      } else {
+        CHECK_THROWS(std::runtime_error, ours.difference(std::move(theirs), 4));
+      }
+      budget.store(std::numeric_limits<long>::max());
+      ours.validate();
+      CHECK(ours.empty() && live_nodes.load() == 0);
+    }
+  }
+}
+
+// A writer inserts 0, 1, 2... in order and erases the odd keys behind it, so a reader that
+// sees size() == n must find every even key below about 2n
+void ConcurrentReadersAndWriter() {
+  static constexpr int kKeys = 600;
+  ConcurrentRedBlackTree<int> tree;
+  std::atomic<bool> done{false};
+  std::atomic<int> inconsistent{0};
+  std::vector<std::thread> readers;
+  for (int reader = 0; reader < 4; ++reader) {
+    readers.emplace_back([&, reader] {
+      std::mt19937 rng(static_cast<unsigned>(reader));
+      while (!done.load()) {
+        bool check_shape = rng() % 16 == 0;
+        bool valid = tree.read([&](const auto& snapshot) {
+          if (check_shape) {
+            snapshot.validate();
+          }
+          std::size_t size = snapshot.size();
+          if (size == 0) {
+            return true;
+          }
+          int largest = *std::prev(snapshot.end());
+          int key = static_cast<int>(rng() % (largest + 1)) & ~1;
+          return snapshot.find(key) != snapshot.end() && *snapshot.statistic(size - 1) == largest;
+        });
+        if (!valid) {
+          inconsistent.fetch_add(1);
+        }
+        int key = static_cast<int>(rng() % kKeys);
+        std::optional<int> found = tree.find(key);
+        if (found && *found != key) {
+          inconsistent.fetch_add(1);
+        }
+      }
+    });
+  }
+  for (int key = 0; key < kKeys; ++key) {
+    tree.insert(key);
+    if (key % 2 == 1 && key > 2) {
+      tree.erase(key - 2);
+    }
+  }
+  done.store(true);
+  for (std::thread& reader : readers) {
+    reader.join();
+  }
+  CHECK(inconsistent.load() == 0);
+  std::size_t expected = kKeys / 2 + 1; // the even keys and the last odd one
+  CHECK(tree.size() == expected);
+  CHECK(tree.read([](const auto& snapshot) { return snapshot.rank(kKeys); }) == expected);
+}
+
+// A change throwing on the hidden copy is undone there; one throwing on the second copy
+// has been shown already and is kept in both
+void ThrowingWrite() {
+  ConcurrentRedBlackTree<int> tree;
+  std::set<int> expected;
+  for (int key = 0; key < 100; ++key) {
+    tree.insert(key);
+    expected.insert(key);
+  }
+  for (int failing_call : {0, 1}) {
+    int calls = 0;
+    CHECK_THROWS(std::runtime_error, tree.modify([&](auto& copy) {
+      copy.insert(1000 + failing_call);
+      copy.erase(failing_call);
+      if (calls++ == failing_call) {
+        throw std::runtime_error("failed change");
+      }
+    }));
+    if (failing_call == 1) {
+      expected.insert(1001);
+      expected.erase(1);
+    }
+    for (int key : {-1, -2}) { // show each copy in turn
+      tree.insert(key);
+      expected.insert(key);
+      CHECK(tree.read([&](const auto& copy) { return std::equal(copy.begin(), copy.end(), expected.begin(), expected.end()); }));
+      tree.erase(key);
+      expected.erase(key);
+    }
+  }
+}
+
+// Threads come and go while trees are created and destroyed; a slot is returned by an
+// exiting thread even after its tree is gone
+void ReaderThreadsComeAndGo() {
+  std::optional<ConcurrentRedBlackTree<int>> first(std::in_place);
+  ConcurrentRedBlackTree<int> second;
+  first->insert(1);
+  second.insert(2);
+  std::atomic<bool> release{false};
+  std::thread lingering([&] {
+    CHECK(first->find(1) == 1);
+    CHECK(second.find(2) == 2);
+    while (!release.load()) {
+      std::this_thread::yield();
+    }
+  });
+  for (int round = 0; round < 20; ++round) {
+    std::thread reader([&] {
+      CHECK(second.contains(2));
+      CHECK(second.read([&](const auto& outer) { return outer.size() + second.size(); }) == 2);
+    });
+    reader.join();
+    second.insert(round + 10);
+    second.erase(round + 10);
+  }
+  first.reset();
+  release.store(true);
+  lingering.join();
+  CHECK(second.size() == 1);
+}
+
+}  // namespace
+
+int main() {
+  ParallelTraversal<DefaultTreePolicy>();
+  ParallelTraversal<MultiTreePolicy>();
+  ParallelTraversal<CountedMultiTreePolicy>();
+  ParallelTraversal<LinkedTreePolicy<CountedMultiTreePolicy>>();
+  ParallelSetOperations();
+  ThrowingSetOperation();
+  ConcurrentReadersAndWriter();
+  ThrowingWrite();
+  ReaderThreadsComeAndGo();
+  return TestResult("concurrency_test");
+}
@@ -0,0 +1,286 @@
+// The containers built around RedBlackTree against std::set: PersistentRedBlackTree with
+// its snapshots, FrozenRedBlackTree, SimdBTree, RedBlackTreeImage and RedBlackTreeMap
+#include "../FrozenRedBlackTree.h"
+#include "../PersistentRedBlackTree.h"
+#include "../RedBlackTree.h"
+#include "../RedBlackTreeImage.h"
+#include "../RedBlackTreeMap.h"
+#include "../SimdBTree.h"
+#include "check.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <map>
+#include <optional>
+#include <random>
+#include <set>
+#include <span>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace {
+
+template <typename It, typename End, typename SetIt, typename Set>
+bool SamePosition(It found, End end, SetIt expected, const Set& set) {
+  return found == end ? expected == set.end() : expected != set.end() && *found == *expected;
+}
+
+// The ordered-set queries every container here shares, for keys around those of expected
+template <typename Container, typename Set>
+void CheckQueries(const Container& container, const Set& expected, std::mt19937_64& rng, std::uint64_t key_range) {
+  using Key = typename Set::key_type;
+  CHECK(container.size() == expected.size());
+  CHECK(std::equal(container.begin(), container.end(), expected.begin(), expected.end()));
+  for (int i = 0; i < 20; ++i) {
+    Key key = static_cast<Key>(rng() % key_range);
+    CHECK(SamePosition(container.find(key), container.end(), expected.find(key), expected));
+    CHECK(SamePosition(container.lower_bound(key), container.end(), expected.lower_bound(key), expected));
+    CHECK(SamePosition(container.upper_bound(key), container.end(), expected.upper_bound(key), expected));
+    auto below = expected.lower_bound(key);
+    CHECK(SamePosition(container.find_less_than(key), container.end(), below == expected.begin() ? expected.end() : std::prev(below), expected));
+    CHECK(container.rank(key) == static_cast<std::size_t>(std::distance(expected.begin(), below)));
+    std::size_t position = rng() % (expected.size() + 1);
+    CHECK(SamePosition(container.statistic(position), container.end(), std::next(expected.begin(), position), expected));
+  }
+}
+
+// Every kept snapshot still shows the contents it was taken with
+void Persistent() {
+  std::mt19937_64 rng(21);
+  PersistentRedBlackTree<int> tree;
+  std::set<int> expected;
+  std::vector<std::pair<PersistentRedBlackTree<int>, std::set<int>>> snapshots;
+  for (int step = 0; step < 3000; ++step) {
+    int key = static_cast<int>(rng() % 500);
+    if (rng() % 3 == 0) {
+      CHECK(tree.erase(key) == expected.erase(key));
+    } else {
+      CHECK(tree.insert(key) == expected.insert(key).second);
+    }
+    if (step % 300 == 0) {
+      snapshots.emplace_back(tree.snapshot(), expected);
+    }
+    if (step % 50 == 0) {
+      CheckQueries(tree, expected, rng, 500);
+    }
+  }
+  for (const auto& [snapshot, contents] : snapshots) {
+    CheckQueries(snapshot, contents, rng, 500);
+  }
+}
+
+// Orders by the remainder modulo a divisor chosen at run time, then by value
+struct ModuloOrder {
+  int divisor;
+  bool operator()(int lhs, int rhs) const {
+    return lhs % divisor != rhs % divisor ? lhs % divisor < rhs % divisor : lhs < rhs;
+  }
+};
+
+template <typename Tree>
+constexpr bool kFreezable = requires(const Tree& tree) { freeze(tree); };
+
+static_assert(kFreezable<RedBlackTree<int>>);
+static_assert(!kFreezable<RedBlackTree<int, std::less<int>, std::allocator<int>, MultiTreePolicy>>);
+static_assert(!kFreezable<RedBlackTree<int, std::less<int>, std::allocator<int>, CountedMultiTreePolicy>>);
+
+void Frozen() {
+  std::mt19937_64 rng(23);
+  for (std::size_t size : {0, 1, 2, 15, 16, 17, 1000, 4097}) {
+    std::set<std::uint32_t> expected;
+    while (expected.size() < size) {
+      expected.insert(static_cast<std::uint32_t>(rng() % (4 * size)));
+    }
+    RedBlackTree<std::uint32_t> tree(expected.begin(), expected.end());
+    FrozenRedBlackTree<std::uint32_t> index = freeze(tree);
+    CheckQueries(index, expected, rng, 4 * size + 2);
+    for (std::size_t position = 0; position < size; position += 7) {
+      CHECK(index.rank(index.statistic(position)) == position);
+    }
+  }
+
+  ModuloOrder order{7};
+  RedBlackTree<int, ModuloOrder> tree(order, std::allocator<int>());
+  std::set<int, ModuloOrder> expected(order);
+  for (int i = 0; i < 200; ++i) {
+    int value = static_cast<int>(rng() % 1000);
+    tree.insert(value);
+    expected.insert(value);
+  }
+  FrozenRedBlackTree<int, ModuloOrder> index = freeze(tree);
+  CHECK(std::equal(index.begin(), index.end(), expected.begin(), expected.end()));
+  for (int value : expected) {
+    CHECK(index.find(value) != index.end() && *index.find(value) == value);
+  }
+}
+
+template <typename Key>
+void Simd() {
+  std::mt19937_64 rng(25);
+  SimdBTree<Key> tree;
+  std::set<Key> expected;
+  for (int step = 0; step < 20000; ++step) {
+    Key key = static_cast<Key>(rng() % 3000);
+    switch (rng() % 4) {
+      case 0:
+        CHECK(tree.erase(key) == expected.erase(key));
+        break;
+      case 1: {
+        auto where = tree.find(key);
+        CHECK((where != tree.end()) == expected.contains(key));
+        if (where != tree.end()) {
+          auto after = tree.erase(where);
+          auto expected_after = expected.erase(expected.find(key));
+          CHECK(SamePosition(after, tree.end(), expected_after, expected));
+        }
+        break;
+      }
+      default:
+        CHECK(tree.insert(key).second == expected.insert(key).second);
+    }
+    if (step % 500 == 0) {
+      CheckQueries(tree, expected, rng, 3000);
+    }
+  }
+  CheckQueries(tree, expected, rng, 3000);
+  SimdBTree<Key> copy = tree;
+  CHECK(std::equal(copy.begin(), copy.end(), expected.begin(), expected.end()));
+  CHECK(std::equal(tree.rbegin(), tree.rend(), expected.rbegin(), expected.rend()));
+
+  // Erasing while walking forward, every other element and then the rest
+  for (int pass = 0; pass < 2; ++pass) {
+    auto expected_at = expected.begin();
+    for (auto where = copy.begin(); where != copy.end(); ++expected_at) {
+      CHECK(expected_at != expected.end() && *where == *expected_at);
+      if (pass == 1 || static_cast<std::int64_t>(*where) % 2 == 0) {
+        where = copy.erase(where);
+      } else {
+        ++where;
+      }
+    }
+    std::erase_if(expected, [&](Key key) { return pass == 1 || static_cast<std::int64_t>(key) % 2 == 0; });
+    CheckQueries(copy, expected, rng, 3000);
+  }
+  CHECK(copy.empty() && copy.begin() == copy.end());
+}
+
+void Image() {
+  std::mt19937_64 rng(27);
+  std::set<std::uint64_t> expected;
+  for (int i = 0; i < 5000; ++i) {
+    expected.insert(rng() % 50000);
+  }
+  RedBlackTree<std::uint64_t> tree(expected.begin(), expected.end());
+  std::stringstream out;
+  RedBlackTreeImage<std::uint64_t>::write(tree, out);
+  std::string bytes = out.str();
+  std::vector<std::uint64_t> storage(bytes.size() / sizeof(std::uint64_t) + 1); // aligned for the nodes
+  std::memcpy(storage.data(), bytes.data(), bytes.size());
+
+  RedBlackTreeImage<std::uint64_t> image(storage.data(), bytes.size());
+  CHECK(image.size() == expected.size());
+  for (int i = 0; i < 2000; ++i) {
+    std::uint64_t key = rng() % 50002;
+    auto found_value = [&](const std::uint64_t* found) { return found == nullptr ? std::optional<std::uint64_t>() : *found; };
+    auto expected_value = [&](auto it) { return it == expected.end() ? std::optional<std::uint64_t>() : *it; };
+    CHECK(found_value(image.find(key)) == expected_value(expected.find(key)));
+    CHECK(found_value(image.lower_bound(key)) == expected_value(expected.lower_bound(key)));
+    CHECK(found_value(image.upper_bound(key)) == expected_value(expected.upper_bound(key)));
+    CHECK(image.rank(key) == static_cast<std::size_t>(std::distance(expected.begin(), expected.lower_bound(key))));
+    std::size_t position = rng() % (expected.size() + 1);
+    CHECK(found_value(image.statistic(position)) == expected_value(std::next(expected.begin(), position)));
+  }
+  CHECK_THROWS(std::runtime_error, RedBlackTreeImage<std::uint64_t>(storage.data(), bytes.size() / 2));
+  CHECK_THROWS(std::runtime_error, RedBlackTreeImage<std::uint32_t>(storage.data(), bytes.size()));
+}
+
+void Map() {
+  std::mt19937_64 rng(29);
+  RedBlackTreeMap<std::string, int> map;
+  std::map<std::string, int> expected;
+  for (int step = 0; step < 3000; ++step) {
+    std::string key = "k" + std::to_string(rng() % 300);
+    switch (rng() % 5) {
+      case 0:
+        CHECK(map.erase(key) == expected.erase(key));
+        break;
+      case 1:
+        ++map[key];
+        ++expected[key];
+        break;
+      case 2:
+        CHECK(map.insert_or_assign(key, step).second == expected.insert_or_assign(key, step).second);
+        break;
+      case 3:
+        CHECK(map.try_emplace(key, step).second == expected.try_emplace(key, step).second);
+        break;
+      default:
+        CHECK(map.contains(key) == expected.contains(key));
+        if (expected.contains(key)) {
+          CHECK(map.at(key) == expected.at(key));
+        } else {
+          CHECK_THROWS(std::out_of_range, map.at(key));
+        }
+    }
+  }
+  map.validate();
+  CHECK(map.size() == expected.size());
+  CHECK(std::equal(map.begin(), map.end(), expected.begin(), expected.end(),
+                   [](const auto& lhs, const auto& rhs) { return lhs.first == rhs.first && lhs.second == rhs.second; }));
+  std::size_t position = map.size() / 2;
+  CHECK(map.statistic(position)->first == std::next(expected.begin(), position)->first);
+}
+
+// Lookups by std::string_view and const char*: passed through with a transparent
+// comparator, converted to std::string once otherwise
+template <typename Compare>
+void MapLookups() {
+  using Words = RedBlackTreeMap<std::string, int, Compare>;
+  static_assert(std::is_same_v<typename Words::value_type, std::pair<const std::string, int>>);
+  static_assert(requires { typename MapKeyCompare<std::string, Compare>::is_transparent; } == requires { typename Compare::is_transparent; });
+  Words words;
+  for (const char* word : {"beta", "alpha", "delta", "gamma"}) {
+    words.try_emplace(word, static_cast<int>(std::strlen(word)));
+  }
+  words[std::string("epsilon")] = 7;
+  CHECK(words.try_emplace(std::string_view("delta"), 0).second == false);
+  CHECK(words.at("alpha") == 5 && words.at(std::string_view("epsilon")) == 7);
+  CHECK(words.contains("gamma") && !words.contains(std::string_view("zeta")));
+  CHECK(words.find(std::string_view("beta"))->second == 4);
+  CHECK(words.lower_bound("c")->first == "delta");
+  CHECK(words.rank(std::string_view("delta")) == 2 && words.count("delta") == 1);
+  CHECK(words.insert_or_assign(std::string_view("zeta"), 4).second && words.at("zeta") == 4);
+  CHECK(words.erase("beta") == 1 && words.erase(std::string_view("beta")) == 0);
+  std::vector<std::string_view> keys{"alpha", "omega", "zeta"};
+  std::vector<typename Words::const_iterator> found(keys.size());
+  std::as_const(words).find_batch(std::span(keys), std::span(found));
+  CHECK(found[0] == words.begin() && found[1] == words.end() && found[2]->second == 4);
+  words.validate();
+
+  std::vector<std::pair<std::string, int>> unsorted{{"b", 1}, {"a", 2}, {"b", 3}, {"c", 4}};
+  Words built(unsorted.begin(), unsorted.end());
+  built.validate();
+  CHECK(built.size() == 3 && built.at("a") == 2 && built.at("b") == 1);
+}
+
+}  // namespace
+
+int main() {
+  Persistent();
+  Frozen();
+  Simd<std::uint64_t>();
+  Simd<std::int32_t>();
+  Simd<double>();
+  Image();
+  Map();
+  MapLookups<std::less<std::string>>();
+  MapLookups<std::less<>>();
+  return TestResult("containers_test");
+}
@@ -0,0 +1,531 @@
+// RedBlackTree under every policy against std::set and std::multiset: random inserts,
+// erases, extracts and queries with validate() after each step, then split/join, set
+// operations, node handles, save/load, subtree aggregates and batch lookups
+#include "../PoolAllocator.h"
+#include "../RedBlackTree.h"
+#include "check.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+#include <numeric>
+#include <random>
+#include <set>
+#include <span>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace {
+
+template <typename Policy>
+using IntTree = RedBlackTree<int, std::less<int>, std::allocator<int>, Policy>;
+
+template <typename Policy>
+using Reference = std::conditional_t<Policy::duplicates == DuplicateKeys::kRejected, std::set<int>, std::multiset<int>>;
+
+template <typename Tree>
+using ValueOf = typename Tree::const_iterator::value_type;
+
+// Every element in order, a counted node giving one entry per copy
+template <typename Tree>
+std::vector<ValueOf<Tree>> Elements(const Tree& tree) {
+  std::vector<ValueOf<Tree>> elements;
+  for (auto it = tree.begin(); it != tree.end(); ++it) {
+    elements.insert(elements.end(), tree.copies(it), *it);
+  }
+  return elements;
+}
+
+template <typename Tree, typename Set>
+bool Same(const Tree& tree, const Set& expected) {
+  tree.validate();
+  return tree.size() == expected.size() &&
+         Elements(tree) == std::vector<ValueOf<Tree>>(expected.begin(), expected.end());
+}
+
+template <typename TreeIt, typename Tree, typename SetIt, typename Set>
+bool SamePosition(TreeIt found, const Tree& tree, SetIt expected, const Set& set) {
+  return found == tree.end() ? expected == set.end() : expected != set.end() && *found == *expected;
+}
+
+template <typename Tree, typename Set>
+void CheckQueries(const Tree& tree, const Set& expected, int key, std::mt19937& rng) {
+  CHECK((tree.find(key) != tree.end()) == expected.contains(key));
+  CHECK(tree.count(key) == expected.count(key));
+  CHECK(SamePosition(tree.lower_bound(key), tree, expected.lower_bound(key), expected));
+  CHECK(SamePosition(tree.upper_bound(key), tree, expected.upper_bound(key), expected));
+  CHECK(SamePosition(tree.find_greater_than(key), tree, expected.upper_bound(key), expected));
+  auto below = expected.lower_bound(key);
+  CHECK(SamePosition(tree.find_less_than(key), tree, below == expected.begin() ? expected.end() : std::prev(below), expected));
+  std::size_t rank = std::distance(expected.begin(), expected.lower_bound(key));
+  CHECK(tree.rank(key) == rank);
+  CHECK(tree.rank(tree.lower_bound(key)) == rank);
+  CHECK(tree.count_range(key, key + 10) == static_cast<std::size_t>(std::distance(expected.lower_bound(key), expected.lower_bound(key + 10))));
+  if (!expected.empty()) {
+    std::size_t position = rng() % expected.size();
+    CHECK(*tree.statistic(position) == *std::next(expected.begin(), position));
+  }
+  CHECK(tree.statistic(expected.size()) == tree.end());
+}
+
+template <typename Set>
+void EraseCopies(Set& expected, int key, std::size_t copies) {
+  for (; copies > 0; --copies) {
+    expected.erase(expected.find(key));
+  }
+}
+
+// Random operations on keys from a small range, so that equal keys meet often
+template <typename Policy>
+void RandomOperations(const char* name, unsigned seed) {
+  IntTree<Policy> tree;
+  Reference<Policy> expected;
+  std::mt19937 rng(seed);
+  for (int step = 0; step < 3000; ++step) {
+    int key = static_cast<int>(rng() % 200);
+    switch (rng() % 10) {
+      case 0:
+      case 1: {
+        bool fresh = !expected.contains(key);
+        CHECK(tree.insert(key).second == (fresh || Policy::duplicates != DuplicateKeys::kRejected));
+        expected.insert(key);
+        break;
+      }
+      case 2:
+        tree.insert(tree.lower_bound(key), key);
+        expected.insert(key);
+        break;
+      case 3:
+        CHECK(tree.erase(key) == expected.erase(key));
+        break;
+      case 4: {
+        bool present = expected.contains(key);
+        CHECK(tree.erase_one(key) == (present ? 1u : 0u));
+        if (present) {
+          expected.erase(expected.find(key));
+        }
+        break;
+      }
+      case 5: {
+        auto where = tree.find(key);
+        if (where != tree.end()) {
+          EraseCopies(expected, key, tree.copies(where));
+          tree.erase(where);
+        }
+        break;
+      }
+      case 6: {
+        int high = key + static_cast<int>(rng() % 20);
+        auto after = tree.erase(tree.lower_bound(key), tree.lower_bound(high));
+        expected.erase(expected.lower_bound(key), expected.lower_bound(high));
+        CHECK(SamePosition(after, tree, expected.lower_bound(high), expected));
+        break;
+      }
+      case 7: { // re-key a node through its handle
+        auto where = tree.find(key);
+        if (where == tree.end()) {
+          break;
+        }
+        std::size_t copies = tree.copies(where);
+        EraseCopies(expected, key, copies);
+        auto handle = tree.extract(where);
+        int moved_to = static_cast<int>(rng() % 200);
+        handle.value() = moved_to;
+        bool accepted = !(Policy::duplicates == DuplicateKeys::kRejected && expected.contains(moved_to));
+        auto result = tree.insert(std::move(handle));
+        CHECK(result.inserted == accepted);
+        CHECK(result.node.empty() == accepted);
+        if (accepted) {
+          for (std::size_t copy = 0; copy < copies; ++copy) {
+            expected.insert(moved_to);
+          }
+        }
+        break;
+      }
+      default:
+        CheckQueries(tree, expected, key, rng);
+    }
+    if (!Same(tree, expected)) {
+      std::cerr << name << ": contents differ after step " << step << '\n';
+      CHECK(false);
+      return;
+    }
+  }
+}
+
+template <typename Policy>
+void CopyMoveAndSwap() {
+  using Tree = IntTree<Policy>;
+  std::vector<int> values(100);
+  std::iota(values.begin(), values.end(), 0);
+  Tree tree(values.begin(), values.end());
+  Tree copy = tree;
+  CHECK(Same(copy, std::set<int>(values.begin(), values.end())));
+  Tree moved = std::move(copy);
+  CHECK(Same(moved, std::set<int>(values.begin(), values.end())));
+  CHECK(copy.empty() && copy.begin() == copy.end());
+  copy.insert(5);
+  swap(copy, moved);
+  CHECK(copy.size() == 100 && moved.size() == 1);
+  moved = std::move(copy);
+  CHECK(moved.size() == 100 && copy.empty());
+  copy.validate();
+  moved.validate();
+
+  // Iterators, end() included, follow the elements to the tree that took them
+  auto middle = moved.find(50);
+  auto last = std::prev(moved.end());
+  auto end = moved.end();
+  Tree taken = std::move(moved);
+  CHECK(std::next(last) == end && end == taken.end() && std::prev(end) == last);
+  CHECK(std::distance(middle, end) == 50);
+  Tree other(values.begin(), values.begin() + 10);
+  auto other_end = other.end();
+  swap(taken, other);
+  CHECK(end == other.end() && other_end == taken.end());
+  CHECK(std::distance(other.begin(), middle) == 50 && std::distance(taken.begin(), other_end) == 10);
+  other = std::move(taken);
+  CHECK(other_end == other.end() && std::prev(other_end) == std::prev(other.end()));
+  taken.insert(1);
+  CHECK(taken.end() != other_end && *taken.begin() == 1);
+  taken.validate();
+  other.validate();
+}
+
+template <typename Policy>
+void RangeConstructor() {
+  std::mt19937 rng(11);
+  std::vector<int> values(500);
+  for (int& value : values) {
+    value = static_cast<int>(rng() % 300);
+  }
+  IntTree<Policy> tree(values.begin(), values.end());
+  CHECK(Same(tree, Reference<Policy>(values.begin(), values.end())));
+  std::sort(values.begin(), values.end());
+  IntTree<Policy> sorted(values.begin(), values.end());
+  CHECK(Same(sorted, Reference<Policy>(values.begin(), values.end())));
+}
+
+template <typename Policy>
+void SplitAndJoin() {
+  std::mt19937 rng(5);
+  Reference<Policy> expected;
+  IntTree<Policy> tree;
+  for (int i = 0; i < 400; ++i) {
+    int key = static_cast<int>(rng() % 250);
+    tree.insert(key);
+    expected.insert(key);
+  }
+  for (int key = -1; key <= 251; key += 9) {
+    IntTree<Policy> lower = tree;
+    IntTree<Policy> upper = lower.split(key);
+    CHECK(Same(lower, Reference<Policy>(expected.begin(), expected.lower_bound(key))));
+    CHECK(Same(upper, Reference<Policy>(expected.lower_bound(key), expected.end())));
+    lower.join(std::move(upper));
+    CHECK(Same(lower, expected));
+  }
+  IntTree<Policy> low;
+  low.insert(10);
+  IntTree<Policy> high;
+  high.insert(5);
+  CHECK_THROWS(std::invalid_argument, low.join(std::move(high)));
+}
+
+// Throws once the budget of comparisons it points to runs out
+struct BudgetLess {
+  long* budget;
+
+  bool operator()(int lhs, int rhs) const {
+    if ((*budget)-- <= 0) {
+      throw std::runtime_error("out of comparisons");
+    }
+    return lhs < rhs;
+  }
+};
+
+// split() compares before it cuts, so a throwing comparator leaves the tree whole; range
+// erase cuts by position and compares nothing
+template <typename Policy>
+void CutsWithThrowingCompare() {
+  using Tree = RedBlackTree<int, BudgetLess, std::allocator<int>, Policy>;
+  long budget = 1'000'000'000;
+  std::mt19937 rng(13);
+  Tree tree(BudgetLess{&budget}, std::allocator<int>());
+  Reference<Policy> expected;
+  for (int i = 0; i < 300; ++i) {
+    int key = static_cast<int>(rng() % 200);
+    tree.insert(key);
+    expected.insert(key);
+  }
+  for (long allowed = 0; allowed < 30; ++allowed) {
+    Tree copy = tree;
+    budget = allowed;
+    try {
+      Tree upper = copy.split(100);
+      budget = 1'000'000'000;
+      copy.join(std::move(upper));
+    } catch (const std::runtime_error&) {
+      budget = 1'000'000'000;
+    }
+    copy.validate();
+    CHECK(Same(copy, expected));
+  }
+  auto first = std::next(tree.begin(), 40);
+  auto last = std::next(first, 70);
+  expected.erase(std::next(expected.begin(), tree.rank(first)), std::next(expected.begin(), tree.rank(last)));
+  budget = 0;
+  tree.erase(first, last);
+  budget = 1'000'000'000;
+  tree.validate();
+  CHECK(Same(tree, expected));
+}
+
+template <typename Policy>
+void SetOperations() {
+  std::mt19937 rng(3);
+  for (std::size_t threads : {1, 4}) {
+    std::set<int> a;
+    std::set<int> b;
+    for (int i = 0; i < 3000; ++i) {
+      a.insert(static_cast<int>(rng() % 5000));
+      b.insert(static_cast<int>(rng() % 5000));
+    }
+    auto expect = [&](auto operation) {
+      std::set<int> result;
+      operation(a.begin(), a.end(), b.begin(), b.end(), std::inserter(result, result.end()));
+      return result;
+    };
+    IntTree<Policy> united(a.begin(), a.end());
+    united.merge_union(IntTree<Policy>(b.begin(), b.end()), threads);
+    CHECK(Same(united, expect([](auto... args) { return std::set_union(args...); })));
+    IntTree<Policy> common(a.begin(), a.end());
+    common.intersect(IntTree<Policy>(b.begin(), b.end()), threads);
+    CHECK(Same(common, expect([](auto... args) { return std::set_intersection(args...); })));
+    IntTree<Policy> rest(a.begin(), a.end());
+    rest.difference(IntTree<Policy>(b.begin(), b.end()), threads);
+    CHECK(Same(rest, expect([](auto... args) { return std::set_difference(args...); })));
+  }
+}
+
+// merge() takes what is missing here and leaves the rest in the source
+void MergeNodes() {
+  std::set<int> a = {1, 3, 5, 7};
+  std::set<int> b = {2, 3, 4, 7, 8};
+  RedBlackTree<int> target(a.begin(), a.end());
+  RedBlackTree<int> source(b.begin(), b.end());
+  target.merge(source);
+  CHECK(Same(target, std::set<int>{1, 2, 3, 4, 5, 7, 8}));
+  CHECK(Same(source, std::set<int>{3, 7}));
+
+  IntTree<MultiTreePolicy> multi_target(a.begin(), a.end());
+  IntTree<MultiTreePolicy> multi_source(b.begin(), b.end());
+  multi_target.merge(multi_source);
+  CHECK(Same(multi_target, std::multiset<int>{1, 2, 3, 3, 4, 5, 7, 7, 8}));
+  CHECK(multi_source.empty());
+
+  // Unequal pool allocators: values move into new nodes
+  using Pooled = RedBlackTree<int, std::less<int>, PoolAllocator<int>>;
+  Pooled pooled_target(a.begin(), a.end());
+  Pooled pooled_source(b.begin(), b.end());
+  pooled_target.merge(pooled_source);
+  CHECK(Same(pooled_target, std::set<int>{1, 2, 3, 4, 5, 7, 8}));
+  CHECK(Same(pooled_source, std::set<int>{3, 7}));
+}
+
+template <typename Policy>
+void SaveAndLoad() {
+  using Tree = RedBlackTree<std::uint64_t, std::less<std::uint64_t>, std::allocator<std::uint64_t>, Policy>;
+  std::mt19937_64 rng(9);
+  Tree tree;
+  for (int i = 0; i < 10000; ++i) {
+    tree.insert(rng() % 20000);
+  }
+  std::stringstream out;
+  tree.save(out);
+  std::string saved = out.str();
+
+  Tree loaded;
+  std::istringstream in(saved);
+  loaded.load(in);
+  loaded.validate();
+  CHECK(Elements(loaded) == Elements(tree));
+
+  Tree kept;
+  kept.insert(42);
+  for (std::size_t length : {std::size_t{0}, std::size_t{10}, saved.size() / 2, saved.size() - 1}) {
+    std::istringstream truncated(saved.substr(0, length));
+    CHECK_THROWS(std::runtime_error, kept.load(truncated));
+    CHECK(kept.size() == 1 && *kept.begin() == 42);
+  }
+  std::string unordered = saved;
+  std::swap_ranges(unordered.end() - 8, unordered.end(), unordered.end() - 16); // the last two values
+  std::istringstream swapped(unordered);
+  CHECK_THROWS(std::runtime_error, kept.load(swapped));
+  CHECK(kept.size() == 1);
+}
+
+void Aggregates() {
+  using Tree = RedBlackTree<int, std::less<int>, std::allocator<int>, AugmentedTreePolicy<SumAugmentation<long>>>;
+  using MaxTree = RedBlackTree<int, std::less<int>, std::allocator<int>, WeakAvlTreePolicy<AugmentedTreePolicy<MaxAugmentation<int>>>>;
+  std::mt19937 rng(13);
+  Tree tree;
+  MaxTree max_tree;
+  std::set<int> expected;
+  for (int step = 0; step < 2000; ++step) {
+    int key = static_cast<int>(rng() % 1000);
+    if (rng() % 3 == 0) {
+      tree.erase(key);
+      max_tree.erase(key);
+      expected.erase(key);
+    } else {
+      tree.insert(key);
+      max_tree.insert(key);
+      expected.insert(key);
+    }
+    tree.validate();
+    max_tree.validate();
+    std::size_t count = rng() % (expected.size() + 1);
+    CHECK(tree.prefix_aggregate(count) == std::accumulate(expected.begin(), std::next(expected.begin(), count), 0L));
+    CHECK(tree.aggregate() == std::accumulate(expected.begin(), expected.end(), 0L));
+    CHECK(max_tree.aggregate() == (expected.empty() ? MaxAugmentation<int>::identity() : *expected.rbegin()));
+    long target = static_cast<long>(rng() % 5000);
+    long sum = 0;
+    auto first_reaching = std::find_if(expected.begin(), expected.end(), [&](int value) { return (sum += value) >= target; });
+    CHECK(SamePosition(tree.search_prefix([&](long prefix) { return prefix >= target; }), tree, first_reaching, expected));
+  }
+  std::size_t low = expected.size() / 4;
+  std::size_t high = expected.size() / 2;
+  CHECK(tree.aggregate(tree.statistic(low), tree.statistic(high)) ==
+        std::accumulate(std::next(expected.begin(), low), std::next(expected.begin(), high), 0L));
+  Tree upper = tree.split(500);
+  tree.validate();
+  upper.validate();
+  CHECK(tree.aggregate() + upper.aggregate() == std::accumulate(expected.begin(), expected.end(), 0L));
+}
+
+template <typename Policy>
+void BatchLookups() {
+  using Tree = IntTree<Policy>;
+  std::mt19937 rng(17);
+  Tree tree;
+  for (int i = 0; i < 5000; ++i) {
+    tree.insert(static_cast<int>(rng() % 20000));
+  }
+  std::vector<int> keys(100);
+  for (int& key : keys) {
+    key = static_cast<int>(rng() % 20002) - 1;
+  }
+  std::vector<std::size_t> positions(100);
+  for (std::size_t& position : positions) {
+    position = rng() % (tree.size() + 2);
+  }
+  std::vector<typename Tree::const_iterator> out(keys.size());
+  const Tree& view = tree;
+  view.find_batch(std::span<const int>(keys), std::span(out));
+  for (std::size_t i = 0; i < keys.size(); ++i) {
+    CHECK(out[i] == view.find(keys[i]));
+  }
+  view.find_greater_than_batch(std::span<const int>(keys), std::span(out));
+  for (std::size_t i = 0; i < keys.size(); ++i) {
+    CHECK(out[i] == view.find_greater_than(keys[i]));
+  }
+  view.find_less_than_batch(std::span<const int>(keys), std::span(out));
+  for (std::size_t i = 0; i < keys.size(); ++i) {
+    CHECK(out[i] == view.find_less_than(keys[i]));
+  }
+  view.statistic_batch(std::span<const std::size_t>(positions), std::span(out));
+  for (std::size_t i = 0; i < positions.size(); ++i) {
+    CHECK(out[i] == view.statistic(positions[i]));
+  }
+}
+
+// Lookups by std::string_view and const char* in a tree of strings, transparent or not
+void HeterogeneousLookups() {
+  RedBlackTree<std::string, std::less<>> transparent;
+  RedBlackTree<std::string> plain;
+  for (const char* word : {"beta", "alpha", "delta", "gamma"}) {
+    transparent.insert(std::string(word));
+    plain.insert(std::string(word));
+  }
+  CHECK(transparent.find(std::string_view("delta")) != transparent.end());
+  CHECK(transparent.rank("gamma") == 3);
+  CHECK(plain.find("alpha") == plain.begin());
+  CHECK(*plain.lower_bound("c") == "delta");
+  CHECK(plain.erase("beta") == 1 && plain.size() == 3);
+}
+
+// Counts the conversions from int, which the tree's comparisons would otherwise make
+struct Converted {
+  static inline int conversions = 0;
+
+  Converted(int value) : value(value) { ++conversions; }
+
+  bool operator<(const Converted& other) const { return value < other.value; }
+
+  int value;
+};
+
+// Without a transparent comparator an inserted int becomes a Converted once, not at
+// every level of the descent
+void InsertConverts() {
+  RedBlackTree<Converted> tree;
+  for (int i = 0; i < 1000; ++i) {
+    tree.insert(Converted(2 * i));
+  }
+  Converted::conversions = 0;
+  CHECK(tree.insert(501).second);
+  CHECK(Converted::conversions == 1);
+  CHECK(!tree.insert(502).second);
+  CHECK(Converted::conversions == 2);
+  CHECK(tree.insert(tree.end(), 2001)->value == 2001);
+  CHECK(tree.insert(tree.begin(), 777)->value == 777);
+  CHECK(Converted::conversions == 4);
+  tree.validate();
+}
+
+}  // namespace
+
+int main() {
+  RandomOperations<DefaultTreePolicy>("DefaultTreePolicy", 1);
+  RandomOperations<MultiTreePolicy>("MultiTreePolicy", 2);
+  RandomOperations<CountedMultiTreePolicy>("CountedMultiTreePolicy", 3);
+  RandomOperations<CompactTreePolicy<>>("CompactTreePolicy", 4);
+  RandomOperations<LinkedTreePolicy<>>("LinkedTreePolicy", 5);
+  RandomOperations<LinkedTreePolicy<MultiTreePolicy>>("LinkedTreePolicy<MultiTreePolicy>", 6);
+  RandomOperations<LinkedTreePolicy<CountedMultiTreePolicy>>("LinkedTreePolicy<CountedMultiTreePolicy>", 7);
+  RandomOperations<WeakAvlTreePolicy<>>("WeakAvlTreePolicy", 8);
+  RandomOperations<WeakAvlTreePolicy<MultiTreePolicy>>("WeakAvlTreePolicy<MultiTreePolicy>", 9);
+  RandomOperations<WeakAvlTreePolicy<LinkedTreePolicy<CountedMultiTreePolicy>>>("WeakAvlTreePolicy<LinkedTreePolicy<CountedMultiTreePolicy>>", 10);
+  RandomOperations<StatsTreePolicy<WeakAvlTreePolicy<>>>("StatsTreePolicy<WeakAvlTreePolicy>", 11);
+
+  CopyMoveAndSwap<DefaultTreePolicy>();
+  CopyMoveAndSwap<LinkedTreePolicy<>>();
+  RangeConstructor<DefaultTreePolicy>();
+  RangeConstructor<MultiTreePolicy>();
+  RangeConstructor<CountedMultiTreePolicy>();
+
+  SplitAndJoin<DefaultTreePolicy>();
+  SplitAndJoin<MultiTreePolicy>();
+  SplitAndJoin<LinkedTreePolicy<>>();
+  SplitAndJoin<WeakAvlTreePolicy<>>();
+  SplitAndJoin<WeakAvlTreePolicy<LinkedTreePolicy<MultiTreePolicy>>>();
+  CutsWithThrowingCompare<DefaultTreePolicy>();
+  CutsWithThrowingCompare<MultiTreePolicy>();
+  CutsWithThrowingCompare<LinkedTreePolicy<CountedMultiTreePolicy>>();
+  SetOperations<DefaultTreePolicy>();
+  SetOperations<LinkedTreePolicy<>>();
+  SetOperations<WeakAvlTreePolicy<>>();
+  MergeNodes();
+
+  SaveAndLoad<DefaultTreePolicy>();
+  SaveAndLoad<MultiTreePolicy>();
+  Aggregates();
+  BatchLookups<DefaultTreePolicy>();
+  BatchLookups<CountedMultiTreePolicy>();
+  HeterogeneousLookups();
+  InsertConverts();
+  return TestResult("tree_test");
+}